@@ -0,0 +1,25 @@
+#include "alloc.h"
+#include <cstdlib>
+#include <new>
+
+// A plain integer needs no constructor, so it's safe to use this early in a thread
+thread_local uint64_t allocations = 0;
+
+uint64_t thread_allocations() {
+    return allocations;
+}
+
+void *operator new(std::size_t size) {
+    allocations++;
+    void *memory = std::malloc(size ? size : 1);
+    if (memory == nullptr)  throw std::bad_alloc();
+    return memory;
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstdint>
+
+/*
+ * The number of heap allocations the calling thread has made through
+ * operator new, which this module replaces with a counting one. Each
+ * thread counts its own, without any locked instructions. The difference
+ * between two calls is how much a piece of code allocated, e.g. for
+ * asserting in the tests that the ingest path allocates nothing per record
+ * once it's warmed up. Only the tests and benchmarks are linked with this
+ * module, so the client keeps the standard operator new.
+ */
+uint64_t thread_allocations();
@@ -0,0 +1,340 @@
+#include "alloc.h"
+#include "client.h"
+#include "grid.h"
+#include "simd.h"
+#include "zones.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Keeps the compiler from optimizing away results that aren't used
+volatile uint64_t sink;
+
+// A stream buffer that throws away everything written to it
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize count) override { return count; }
+};
+
+// What one call of a benchmarked function costs on average
+struct Measurement {
+    double seconds;     // Per operation
+    double allocations; // Per operation
+};
+
+/*
+ * Time how long one call of the function takes on average, calling it
+ * over and over for at least a tenth of a second. If each call does more
+ * than one operation, e.g. updates a batch of objects, the cost of one
+ * operation is given instead.
+ */
+template <typename Function>
+Measurement time_per_call(Function function, std::size_t operations = 1) {
+    using clock = std::chrono::steady_clock;
+    const uint64_t allocations = thread_allocations();
+    const auto start = clock::now();
+    uint64_t calls = 0;
+    std::chrono::duration<double> elapsed;
+    do {
+        function();
+        calls++;
+        elapsed = clock::now() - start;
+    } while (elapsed.count() < 0.1);
+    const double count = static_cast<double>(calls) * operations;
+    return Measurement{elapsed.count() / count, (thread_allocations() - allocations) / count};
+}
+
+// A measurement with what it measured, for the machine-readable results
+struct Result {
+    std::string name;
+    std::size_t objects; // How many objects there were, or 0 if it doesn't apply
+    Measurement measurement;
+};
+
+std::vector<Result> results;
+
+/*
+ * Keep the measurement for the results, and print it as a row of the
+ * table that's being printed.
+ */
+void report(const std::string& name, std::size_t objects, Measurement measurement) {
+    results.push_back(Result{name, objects, measurement});
+    std::cout << std::left << std::setw(28) << name << std::right << std::setw(10) << objects;
+    std::cout << std::fixed << std::setprecision(1) << std::setw(14) << measurement.seconds * 1e9;
+    std::cout << std::setprecision(0) << std::setw(14) << 1 / measurement.seconds;
+    std::cout << std::setprecision(2) << std::setw(12) << measurement.allocations << std::endl;
+}
+
+void print_header(const char *name) {
+    std::cout << std::left << std::setw(28) << name << std::right << std::setw(10) << "objects";
+    std::cout << std::setw(14) << "ns/op" << std::setw(14) << "ops/s" << std::setw(12) << "allocs/op" << std::endl;
+}
+
+const char *simd_name(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::SCALAR: return "scalar";
+        case SimdLevel::SSE2:   return "sse2";
+        case SimdLevel::AVX2:   return "avx2";
+    }
+    return "unknown";
+}
+
+/*
+ * Write the results as JSON, one object per measurement, so that runs
+ * can be compared by a script. Names are plain ASCII without quotes, so
+ * they aren't escaped.
+ */
+bool write_results(const std::string& path) {
+    std::ofstream file(path);
+    file << "{\n  \"simd\": \"" << simd_name(best_simd_level()) << "\",\n  \"results\": [\n";
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const Result& result = results[i];
+        file << "    {\"name\": \"" << result.name << "\", \"objects\": " << result.objects;
+        file << std::setprecision(6) << ", \"ns_per_op\": " << result.measurement.seconds * 1e9;
+        file << ", \"ops_per_sec\": " << 1 / result.measurement.seconds;
+        file << ", \"allocs_per_op\": " << result.measurement.allocations << "}";
+        file << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    file << "  ]\n}\n";
+    return file.good();
+}
+
+/*
+ * Compare the spatial grid with scanning every object for radius queries,
+ * nearest-neighbor queries, and coloring per zone, with objects spread
+ * over the map the way the server spreads them.
+ */
+void bench_spatial_grid() {
+    print_header("SpatialGrid");
+
+    ZoneRules rules = ZoneRules::defaults();
+    rules.points = {ZonePoint{60, 60}, ZonePoint{150, 150}, ZonePoint{240, 90}};
+
+    for (std::size_t count : {1000, 10000, 100000}) {
+        std::vector<Object> all(count);
+        SpatialGrid grid;
+        uint32_t random = 42;
+        for (std::size_t i = 0; i < count; i++) {
+            random = random * 1103515245 + 12345;
+            all[i].id    = i;
+            all[i].x     = (random >> 4) % MAP_WIDTH;
+            all[i].y     = (random >> 16) % MAP_HEIGHT;
+            all[i].type  = 1 + (random >> 28) % 3;
+            all[i].color = 0;
+            grid.update(all[i]);
+        }
+
+        std::vector<int64_t> ids;
+        const Measurement grid_within = time_per_call([&] {
+            grid.within(150, 150, 50, ids);
+            sink = ids.size();
+        });
+        const Measurement scan_within = time_per_call([&] {
+            ids.clear();
+            for (const auto& object : all) {
+                if (distance_squared(object.x, object.y, 150, 150) < 50 * 50)  ids.push_back(object.id);
+            }
+            sink = ids.size();
+        });
+        report("grid within r=50", count, grid_within);
+        report("scan within r=50", count, scan_within);
+
+        std::vector<std::pair<uint64_t, int64_t>> candidates;
+        const Measurement grid_nearest = time_per_call([&] {
+            grid.nearest(150, 150, 10, ids);
+            sink = ids.size();
+        });
+        const Measurement scan_nearest = time_per_call([&] {
+            candidates.clear();
+            for (const auto& object : all) {
+                candidates.emplace_back(distance_squared(object.x, object.y, 150, 150), object.id);
+            }
+            std::partial_sort(candidates.begin(), candidates.begin() + 10, candidates.end());
+            sink = candidates[0].second;
+        });
+        report("grid nearest k=10", count, grid_nearest);
+        report("scan nearest k=10", count, scan_nearest);
+
+        std::vector<std::pair<int64_t, uint8_t>> raised;
+        const Measurement grid_zones = time_per_call([&] {
+            grid.zone_levels(rules, raised);
+            sink = raised.size();
+        });
+        const Measurement scan_zones = time_per_call([&] {
+            raised.clear();
+            for (const auto& object : all) {
+                const uint8_t level = rules.evaluate(object.x, object.y, object.type);
+                if (level > rules.rules_for(object.type).base)  raised.emplace_back(object.id, level);
+            }
+            sink = raised.size();
+        });
+        report("grid zone colors", count, grid_zones);
+        report("scan zone colors", count, scan_zones);
+
+        // Moving every object a little, which is what the grid costs on ingest
+        const Measurement grid_update = time_per_call([&] {
+            for (auto& object : all) {
+                object.x = (object.x + 1) % MAP_WIDTH;
+                grid.update(object);
+            }
+        }, count);
+        report("grid move", count, grid_update);
+    }
+}
+
+// An object somewhere on the map, made up from the index
+Object made_up_object(uint64_t index) {
+    uint64_t random = (index + 1) * 0x9e3779b97f4a7c15;
+    random ^= random >> 29;
+    Object object;
+    object.id    = index;
+    object.x     = random % MAP_WIDTH;
+    object.y     = (random >> 16) % MAP_HEIGHT;
+    object.type  = 1 + (random >> 32) % 3;
+    object.color = 0;
+    return object;
+}
+
+std::string object_line(const Object& object) {
+    return "ID=" + std::to_string(object.id) + ";X=" + std::to_string(object.x) + ";Y=" + std::to_string(object.y)
+         + ";TYPE=" + std::to_string(object.type) + "\n";
+}
+
+/*
+ * The stages that every received line goes through, one line or object
+ * at a time.
+ */
+void bench_stages() {
+    print_header("Stage");
+
+    const std::string line = "ID=572912;X=50;Y=130;TYPE=1";
+    report("split_string", 0, time_per_call([&] {
+        sink = split_string(line, ';').size();
+    }));
+
+    Object object;
+    report("parse_object", 0, time_per_call([&] {
+        sink = static_cast<uint64_t>(parse_object(std::string_view(line), object));
+    }));
+
+    // Objects all over the map, so every zone is hit
+    std::vector<Object> all(1024);
+    for (std::size_t i = 0; i < all.size(); i++)  all[i] = made_up_object(i);
+    report("color_object", 0, time_per_call([&] {
+        for (auto& object : all)  color_object(object);
+        sink = all[0].color;
+    }, all.size()));
+}
+
+/*
+ * Updating the global list and relaying it, with from 10 to a million
+ * objects in the list. The updates move objects that are already in it,
+ * which is what almost every received line does.
+ */
+void bench_store() {
+    print_header("Store");
+
+    NullBuffer null_buffer;
+    std::ostream null_stream(&null_buffer);
+    const std::size_t BATCH = 1000;
+    for (std::size_t count = 10; count <= 1000000; count *= 10) {
+        clear_objects();
+        for (std::size_t i = 0; i < count; i++)  add_or_update_object(made_up_object(i));
+
+        uint64_t next = 0;
+        report("add_or_update_object", count, time_per_call([&] {
+            for (std::size_t i = 0; i < BATCH; i++) {
+                Object object = made_up_object((next * 7919) % count);
+                object.x = (object.x + next) % MAP_WIDTH;
+                add_or_update_object(object);
+                next++;
+            }
+        }, BATCH));
+
+        report("relay_info_once hex", count, time_per_call([&] {
+            relay_info_once(null_stream, FrameFormat::HEX, true);
+        }));
+        report("relay_info_once binary", count, time_per_call([&] {
+            relay_info_once(null_stream, FrameFormat::BINARY, true);
+        }));
+    }
+    clear_objects();
+}
+
+/*
+ * Run made-up feed data through the whole client in this process, from
+ * the framer to a relay of the result, the way replays do. Each of the
+ * 10000 objects is updated 100 times, and the data is cut into chunks
+ * of the size recv() usually returns, with lines straddling the cuts.
+ */
+void bench_end_to_end() {
+    print_header("End to end");
+
+    const std::size_t OBJECTS = 10000;
+    const std::size_t RECORDS = 1000000;
+    const std::size_t CHUNK_LENGTH = 65536;
+    const std::string path = "out/bench.cap";
+
+    std::string data;
+    for (std::size_t i = 0; i < RECORDS; i++) {
+        Object object = made_up_object(i % OBJECTS);
+        object.x = (object.x + i / OBJECTS) % MAP_WIDTH;
+        data += object_line(object);
+    }
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+        for (std::size_t offset = 0; offset < data.length(); offset += CHUNK_LENGTH) {
+            const CaptureHeader header = {0, 0, static_cast<uint32_t>(std::min(CHUNK_LENGTH, data.length() - offset))};
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            file.write(data.data() + offset, header.length);
+        }
+    }
+
+    CaptureReader capture;
+    std::string error;
+    if (!capture.open(path, error)) {
+        std::clog << "Could not open the made-up capture: " << error << std::endl;
+        return;
+    }
+
+    // Keep the feed from reporting that it closed after every run
+    NullBuffer null_buffer;
+    std::ostream null_stream(&null_buffer);
+    std::streambuf *log_buffer = std::clog.rdbuf(&null_buffer);
+    const Measurement measurement = time_per_call([&] {
+        clear_objects();
+        capture.rewind();
+        replay_capture(capture, 0);
+        relay_info_once(null_stream, FrameFormat::BINARY, true);
+    }, RECORDS);
+    std::clog.rdbuf(log_buffer);
+
+    report("records", OBJECTS, measurement);
+    clear_objects();
+    std::remove(path.c_str());
+}
+
+/*
+ * Run every benchmark and print the results as tables. If a path is
+ * given, the results are also written there as JSON.
+ */
+int main(int argc, char *argv[]) {
+    bench_stages();
+    bench_store();
+    bench_end_to_end();
+    bench_spatial_grid();
+
+    if (argc > 1 && !write_results(argv[1])) {
+        std::clog << "Could not write the results to " << argv[1] << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "capture.h"
+#include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The buffer of the capture file, large enough that a busy feed is
+// written with few system calls
+const std::size_t CAPTURE_BUFFER_LENGTH = 1 << 20;
+
+CaptureWriter::~CaptureWriter() {
+    close();
+}
+
+bool CaptureWriter::open(const std::string &path, std::string &error) {
+    close();
+    failed = false;
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        error = "could not create " + path;
+        return false;
+    }
+    std::setvbuf(file, nullptr, _IOFBF, CAPTURE_BUFFER_LENGTH);
+    failed = std::fwrite(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC), 1, file) != 1;
+    start = std::chrono::steady_clock::now();
+    return true;
+}
+
+void CaptureWriter::record(uint32_t feed, const char *data, std::size_t length) {
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const CaptureHeader header = {
+        static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()),
+        feed, static_cast<uint32_t>(length)
+    };
+
+    mutex.lock();
+    failed = failed || file == nullptr || std::fwrite(&header, sizeof(header), 1, file) != 1
+                    || (length > 0 && std::fwrite(data, length, 1, file) != 1);
+    mutex.unlock();
+}
+
+bool CaptureWriter::close() {
+    if (file == nullptr)  return !failed;
+    failed = std::fclose(file) != 0 || failed;
+    file = nullptr;
+    return !failed;
+}
+
+CaptureReader::~CaptureReader() {
+    close();
+}
+
+bool CaptureReader::open(const std::string &path, std::string &error) {
+    close();
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        file = nullptr;
+        error = "could not open " + path;
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    size = static_cast<std::size_t>(file_size.QuadPart);
+    if (size > 0) {
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        const void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (view == nullptr) {
+            close();
+            error = "could not map " + path;
+            return false;
+        }
+        data = static_cast<const char *>(view);
+    }
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "could not open " + path;
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) == 0 && status.st_size > 0) {
+        size = status.st_size;
+        void *view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view != MAP_FAILED) {
+            data = static_cast<const char *>(view);
+            // The records are read from start to end
+            madvise(view, size, MADV_SEQUENTIAL);
+        }
+    }
+    ::close(fd);
+    if (data == nullptr && size > 0) {
+        size = 0;
+        error = "could not map " + path;
+        return false;
+    }
+#endif
+
+    if (size < sizeof(CAPTURE_MAGIC) || std::memcmp(data, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0) {
+        close();
+        error = path + " is not a capture file";
+        return false;
+    }
+    rewind();
+    return true;
+}
+
+bool CaptureReader::next(CaptureRecord &record) {
+    CaptureHeader header;
+    if (size - offset < sizeof(header))  return false;
+    std::memcpy(&header, data + offset, sizeof(header)); // May not be aligned
+    if (size - offset - sizeof(header) < header.length)  return false;
+
+    record.time   = header.time;
+    record.feed   = header.feed;
+    record.length = header.length;
+    record.data   = data + offset + sizeof(header);
+    offset += sizeof(header) + header.length;
+    return true;
+}
+
+void CaptureReader::close() {
+#ifdef _WIN32
+    if (data != nullptr)  UnmapViewOfFile(data);
+    if (mapping != nullptr)  CloseHandle(mapping);
+    if (file != nullptr)  CloseHandle(file);
+    mapping = file = nullptr;
+#else
+    if (data != nullptr)  munmap(const_cast<char *>(data), size);
+#endif
+    data = nullptr;
+    size = offset = 0;
+}
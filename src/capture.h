@@ -0,0 +1,93 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+/*
+ * A capture file holds the raw bytes received from the feeds, as they
+ * were received, so that a run can be replayed without a server. It
+ * starts with CAPTURE_MAGIC, which is followed by one record per received
+ * chunk: a 16-byte header of the time in nanoseconds since the capture
+ * started (uint64), the index of the feed (uint32), and the length of
+ * the chunk (uint32), followed by the bytes of the chunk. The integers
+ * are in the byte order of the machine that captured them.
+ */
+const char CAPTURE_MAGIC[8] = {'F', 'E', 'E', 'D', 'C', 'A', 'P', '1'};
+
+struct CaptureHeader {
+    uint64_t time;
+    uint32_t feed;
+    uint32_t length;
+};
+
+// A record read from a capture file. The data points into the mapped file.
+struct CaptureRecord {
+    uint64_t time;
+    uint32_t feed;
+    uint32_t length;
+    const char *data;
+};
+
+/*
+ * Appends received chunks to a capture file. The file is written through
+ * a large buffer, and any number of threads may record at the same time.
+ */
+class CaptureWriter {
+public:
+    CaptureWriter() {}
+    ~CaptureWriter();
+    CaptureWriter(const CaptureWriter&) = delete;
+    CaptureWriter &operator=(const CaptureWriter&) = delete;
+
+    // Create the file, replacing any file with the same name
+    bool open(const std::string &path, std::string &error);
+    bool is_open() const { return file != nullptr; }
+
+    // Append the chunk. Recording without an open file counts as a failed write.
+    void record(uint32_t feed, const char *data, std::size_t length);
+
+    // Write out what's buffered and close the file. Returns false if any write failed.
+    bool close();
+
+private:
+    std::mutex mutex;
+    std::FILE *file = nullptr;
+    std::chrono::steady_clock::time_point start;
+    bool failed = false;
+};
+
+/*
+ * Reads the records of a capture file, which is mapped into memory so
+ * that the chunks are handed out where they lie rather than copied.
+ */
+class CaptureReader {
+public:
+    CaptureReader() {}
+    ~CaptureReader();
+    CaptureReader(const CaptureReader&) = delete;
+    CaptureReader &operator=(const CaptureReader&) = delete;
+
+    bool open(const std::string &path, std::string &error);
+
+    // Read the next record. Returns false at the end of the file, or if the
+    // rest of the file isn't a whole record, which truncated() then tells.
+    bool next(CaptureRecord &record);
+    bool truncated() const { return offset < size; }
+
+    // Go back to the first record, if a file is open
+    void rewind() { offset = data == nullptr ? 0 : sizeof(CAPTURE_MAGIC); }
+
+private:
+    const char *data = nullptr;
+    std::size_t size = 0;
+    std::size_t offset = 0;
+#ifdef _WIN32
+    void *file = nullptr;
+    void *mapping = nullptr;
+#endif
+
+    void close();
+};
@@ -1,24 +1,54 @@
 #include "client.h"
+#include "capture.h"
+#include "color.h"
+#include "expiry.h"
+#include "feed.h"
+#include "grid.h"
+#include "pipeline.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "subscribe.h"
+#include "track.h"
+#include "transport.h"
+#include "zones.h"
 #include <iostream>
-#include <winsock2.h>
-#include <ws2tcpip.h>
+#include <algorithm>
+#include <charconv>
 #include <chrono>
-#include <cmath>
 #include <thread>
-#include <iomanip>
 #include <mutex>
-
-// The size of the client's receive data buffer
-const u_int RECEIVE_BUFFER_LENGTH = 1024;
-
-// The duration between info relays
-const auto RELAY_INTERVAL = std::chrono::milliseconds(1500);
-
-// The global list of objects that the client has received.
-// We could use a hashtable but they aren't worth the
-// overhead for a small number of elements.
-std::vector<Object> objects;
-
+#include <atomic>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// The global list of objects that the client has received. It's
+// indexed by ID since a feed may have tens of thousands of objects.
+ObjectStore objects;
+
+// A spatial index of the global list, for queries by position
+SpatialGrid object_grid;
+
+// The changes made to the global list since the relay last took them,
+// and when the oldest of them was received, or 0 if there are none
+ObjectChanges pending_changes;
+uint64_t pending_since = 0;
+
+// Removes objects from the global list that haven't been seen for a while
+ObjectExpiry object_expiry;
+std::vector<int64_t> expired_ids; // Reused so that its memory is only allocated once
+
+// The recent positions of the objects in the global list, at the same
+// indices, while colors are predicted, and how far ahead in seconds, or 0
+TrackHistory object_tracks;
+double prediction_horizon = 0;
+
+// Tells the relay thread when the pending changes should be relayed
+RelayTrigger relay_trigger;
+
+// Guards the global list, its index, its expiry, its tracks, and the pending changes. The relay only holds
+// it for as long as it takes to swap the pending changes for empty ones.
 std::mutex objects_mutex;
 
 /*
@@ -27,117 +57,188 @@ std::mutex objects_mutex;
  *
  *     split_string(" Many   spaces ", ' ') -> ["", "Many", "", "", "spaces", ""]
  */
-std::vector<std::string> split_string(const std::string str, const char sep) {
+std::vector<std::string> split_string(const std::string& str, const char sep) {
 
     std::vector<std::string> substrings;
-    int start = 0; // Index of the last split, i.e., the start of the next substring
-
-    for (std::size_t i = 0; i <= str.length(); i++) {
-        if (i >= str.length() || str[i] == sep) {
-            // New substring found, either due to reaching the end of
-            // the string or finding the separator
-            const std::string substring = str.substr(start, i-start);
-            substrings.push_back(substring);
-            start = i+1; // Add one to skip the separator
-        }
+    std::size_t start = 0; // Index of the last split, i.e., the start of the next substring
+
+    while (true) {
+        // find() searches with memchr() rather than comparing one character at a time
+        const std::size_t end = std::min(str.find(sep, start), str.length());
+        substrings.push_back(str.substr(start, end-start));
+        if (end == str.length())  break;
+        start = end+1; // Add one to skip the separator
     }
     return substrings;
 }
 
 /*
- * Parse the string as an Object based on this format:
+ * Parse the whole text as an integer. Unlike std::stol(), no leading
+ * whitespace or trailing characters are accepted, and instead of throwing
+ * on values that don't fit in T, false is returned.
+ */
+template <typename T>
+bool parse_integer(std::string_view text, T& value) {
+    const char *last = text.data() + text.length();
+    const auto result = std::from_chars(text.data(), last, value);
+    return result.ec == std::errc() && result.ptr == last;
+}
+
+/*
+ * Parse the line as an Object based on this format:
  *
  *     ID=572912;X=50;Y=130;TYPE=1
  *
  * The ID is a 64-bit int, X and Y are 32-bit ints, and TYPE must be 1, 2, or 3.
- * If an error occurs, a message is written to std::clog and false is returned.
+ * The object is only assigned if the line is valid. This function never
+ * allocates memory or throws, so it can be called for every received line.
  */
-bool parse_object(const std::string line, Object& object, std::string& error) {
-
-    const auto fields = split_string(line, ';');
-    if (fields.size() != 4) {
-        error = "incorrect number of semicolons";
-        return false;
+ParseError parse_object(std::string_view line, Object& object) {
+
+    // Split the line at every semicolon without copying it
+    std::string_view fields[4];
+    std::size_t field_count = 0;
+    std::size_t start = 0; // Index of the start of the next field
+    while (true) {
+        const std::size_t end = std::min(line.find(';', start), line.length());
+        if (field_count == 4)  return ParseError::FIELD_COUNT; // Too many fields
+        fields[field_count++] = line.substr(start, end-start);
+        if (end == line.length())  break;
+        start = end+1; // Add one to skip the separator
     }
+    if (field_count != 4)  return ParseError::FIELD_COUNT;
 
-    std::string field = "ID=";
-    if (fields[0].rfind(field, 0) != 0) {
-        error = "the first field did not start with " + field;
-        return false;
-    }
-    auto id_string = fields[0].substr(field.length());
+    return parse_fields(fields, object);
+}
 
-    field = "X=";
-    if (fields[1].rfind(field, 0) != 0) {
-        error = "the first field did not start with " + field;
-        return false;
+/*
+ * Parse the four fields of a line, i.e., the line split at its semicolons,
+ * as an Object. This is the part of parse_object() that comes after the
+ * splitting, for callers that have already found the semicolons.
+ */
+ParseError parse_fields(const std::string_view (&fields)[4], Object& object) {
+
+    // Check and skip the names of the fields, leaving only the values
+    const std::string_view names[4] = {"ID=", "X=", "Y=", "TYPE="};
+    const ParseError name_errors[4] = {
+        ParseError::ID_FIELD, ParseError::X_FIELD, ParseError::Y_FIELD, ParseError::TYPE_FIELD
+    };
+    std::string_view values[4];
+    for (std::size_t i = 0; i < 4; i++) {
+        if (fields[i].compare(0, names[i].length(), names[i]) != 0)  return name_errors[i];
+        values[i] = fields[i].substr(names[i].length());
     }
-    auto x_string = fields[1].substr(field.length());
 
-    field = "Y=";
-    if (fields[2].rfind(field, 0) != 0) {
-        error = "the first field did not start with " + field;
-        return false;
-    }
-    auto y_string = fields[2].substr(field.length());
+    Object parsed;
+    if (!parse_integer(values[0], parsed.  id))  return ParseError::VALUE;
+    if (!parse_integer(values[1], parsed.   x))  return ParseError::VALUE;
+    if (!parse_integer(values[2], parsed.   y))  return ParseError::VALUE;
+    if (!parse_integer(values[3], parsed.type))  return ParseError::VALUE;
 
-    field = "TYPE=";
-    if (fields[3].rfind(field, 0) != 0) {
-        error = "the first field did not start with " + field;
-        return false;
+    if (parsed.type != 1 && parsed.type != 2 && parsed.type != 3) {
+        return ParseError::TYPE;
     }
-    auto type_string = fields[3].substr(field.length());
-
-    try {
-        object.id   = std::stoll( id_string);
-        object.x    = std::stol(   x_string);
-        object.y    = std::stol(   y_string);
-        object.type = std::stol(type_string);
-    } catch (std::exception const& e) {
-        error = "invalid field value";
-        return false;
+
+    object.id   = parsed.id;
+    object.x    = parsed.x;
+    object.y    = parsed.y;
+    object.type = parsed.type;
+    return ParseError::NONE;
+}
+
+/*
+ * Parse the string as an Object in the same way as the string_view
+ * overload, but describe the outcome with a message instead.
+ */
+bool parse_object(const std::string line, Object& object, std::string& error) {
+    const ParseError result = parse_object(std::string_view(line), object);
+    error = parse_error_string(result);
+    return result == ParseError::NONE;
+}
+
+/*
+ * Describe the parse error with a short message.
+ */
+const char *parse_error_string(ParseError error) {
+    switch (error) {
+        case ParseError::NONE:        return "success";
+        case ParseError::FIELD_COUNT: return "incorrect number of semicolons";
+        case ParseError::ID_FIELD:    return "the first field did not start with ID=";
+        case ParseError::X_FIELD:     return "the second field did not start with X=";
+        case ParseError::Y_FIELD:     return "the third field did not start with Y=";
+        case ParseError::TYPE_FIELD:  return "the fourth field did not start with TYPE=";
+        case ParseError::VALUE:       return "invalid field value";
+        case ParseError::TYPE:        return "invalid type";
+        case ParseError::LENGTH:      return "the line was too long";
     }
+    return "unknown error";
+}
 
-    if (object.type != 1 && object.type != 2 && object.type != 3) {
-        error = "invalid type";
-        return false;
+// The time in milliseconds, for expiring objects
+uint64_t milliseconds_now() {
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+}
+
+/*
+ * Remove the objects that have expired by now from the global list. The
+ * caller must hold objects_mutex. Returns true if any were removed.
+ */
+bool expire_objects(uint64_t now) {
+    expired_ids.clear();
+    object_expiry.expire(now, expired_ids);
+    for (const int64_t id : expired_ids) {
+        // The last track moves into the hole like the last object does
+        const std::size_t index = objects.find(id);
+        if (prediction_horizon > 0 && index != ObjectStore::NOT_FOUND)  object_tracks.remove(index);
+        objects.erase(id);
+        object_grid.erase(id);
+        pending_changes.remove(id);
     }
+    return !expired_ids.empty();
+}
 
-    error = "success";
-    return true;
+/*
+ * Remove objects from the global list when they haven't been updated for
+ * the time to live, or never if it's 0. The objects already in the list
+ * count as seen now.
+ */
+void set_object_ttl(std::chrono::milliseconds ttl) {
+    objects_mutex.lock();
+    const uint64_t now = milliseconds_now();
+    object_expiry.set_ttl(ttl.count(), now);
+    for (const auto& object : objects)  object_expiry.seen(object.id, now);
+    objects_mutex.unlock();
 }
 
 /*
- * Assign a color to the object based on its position, type, and category.
+ * Predict the colors that objects are heading for, at most this far ahead,
+ * from how they have moved, or stop predicting if it's 0. Relay frames then
+ * carry the predictions.
  */
-void color_object(Object& object) {
-    /*
-     * Color objects according to these conditions:
-     * Category 2 objects: Yellow unless closer than 100 from the designated coordinate then red.
-     * Type 1 objects: Green unless closer than 75 from the designated coordinate then yellow and if closer than 50 then red.
-     * Type 2 objects: Green unless closer than 50 from the designated coordinate then yellow.
-     */
-
-    const float dist = hypot(object.x - DESIGNATED_X, object.y - DESIGNATED_Y);
-
-    if (object.type == 3) {
-        // Category 2
-        object.color = YELLOW;
-        if (dist < 100) {
-            object.color = RED;
-        }
+void set_prediction_horizon(std::chrono::milliseconds horizon) {
+    objects_mutex.lock();
+    prediction_horizon = horizon.count() / 1000.0;
+    object_tracks.reset(horizon.count() ? objects.size() : 0);
+    objects_mutex.unlock();
+}
+
+/*
+ * Add where the object is now to its track and predict its color from
+ * the track. The caller must hold objects_mutex.
+ */
+void predict_from_track(Object& object, uint64_t time) {
+    // A new object gets a new track where it's about to be added
+    std::size_t track = objects.find(object.id);
+    if (track == ObjectStore::NOT_FOUND)  track = objects.size();
+    object_tracks.record(track, time, object.x, object.y);
+
+    double vx, vy;
+    if (object_tracks.velocity(track, vx, vy)) {
+        predict_color(object, vx, vy, prediction_horizon);
     } else {
-        // Category 1
-        object.color = GREEN;
-        if (object.type == 1) {
-            if (dist < 50) {
-                object.color = RED;
-            } else if (dist < 75) {
-                object.color = YELLOW;
-            }
-        } else if (object.type == 2 && dist < 50) {
-            object.color = YELLOW;
-        }
+        object.predicted = 0;
+        object.time_to_zone = 0;
     }
 }
 
@@ -145,185 +246,429 @@ void color_object(Object& object) {
  * Add the object to the global list of objects. If an object with
  * the same ID already exists, it is replaced by the new object.
  */
-void add_or_update_object(Object object) {
-    objects_mutex.lock();
+void add_or_update_object(const Object& object) {
+    add_or_update_objects(&object, 1);
+}
 
-    auto found = false;
-    for (std::size_t i = 0; i < objects.size(); i++) {
-        if (object.id == objects[i].id) {
-            objects[i] = object; // Update object
-            found = true;
-            break;
+/*
+ * Add or update the objects in the global list, noting in the pending
+ * changes when the oldest of them was received, and whether any object
+ * got a more severe color than it had. The caller must hold objects_mutex
+ * and have the time for the expiry. Returns how many objects were added.
+ */
+std::size_t store_objects(const Object *batch, std::size_t count, uint64_t received_at, uint64_t now, bool &escalated) {
+    if (count == 0)  return 0;
+    if (received_at == 0 && (pending_since == 0 || prediction_horizon > 0))  received_at = stats_clock();
+    if (pending_since == 0)  pending_since = received_at;
+    std::size_t inserted = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        // Green is never an escalation, so most objects skip the extra lookup
+        if (!escalated && batch[i].color != GREEN) {
+            const std::size_t index = objects.find(batch[i].id);
+            escalated = index == ObjectStore::NOT_FOUND
+                     || color_level(objects[index].color) < color_level(batch[i].color);
         }
+
+        Object predicted;
+        const Object *object = &batch[i];
+        if (prediction_horizon > 0) {
+            predicted = batch[i];
+            predict_from_track(predicted, received_at);
+            object = &predicted;
+        }
+        inserted += objects.upsert(*object);
+        object_grid.update(*object);
+        object_expiry.seen(object->id, now);
+        pending_changes.update(*object);
+    }
+    return inserted;
+}
+
+/*
+ * Add or update many objects at once, e.g. all the objects parsed from
+ * one batch of received data. The lock is only taken once, so receiving
+ * threads contend for it once per batch rather than once per object.
+ * The relay is told about the changes, and told to hurry if any object
+ * got a more severe color than it had. Objects that have expired by now
+ * are removed at the same time. The time the objects were received, from
+ * stats_clock(), is for timing how long they take to be relayed, and is
+ * taken to be now if it's 0.
+ */
+void add_or_update_objects(const Object *batch, std::size_t count, uint64_t received_at) {
+    const ObjectBatch whole = {batch, count, received_at};
+    add_or_update_batches(&whole, 1);
+}
+
+/*
+ * Add or update the objects of many batches, in order, taking the lock
+ * once for all of them. This is how the store owner of the ingest
+ * pipeline applies everything the parse workers have sent it since it
+ * last looked.
+ */
+void add_or_update_batches(const ObjectBatch *batches, std::size_t count) {
+    bool escalated = false;
+    std::size_t total = 0;
+    std::size_t inserted = 0;
+    objects_mutex.lock();
+    const uint64_t now = object_expiry.ttl() ? milliseconds_now() : 0;
+    for (std::size_t i = 0; i < count; i++) {
+        inserted += store_objects(batches[i].objects, batches[i].count, batches[i].received_at, now, escalated);
+        total += batches[i].count;
     }
+    const bool expired = object_expiry.ttl() && expire_objects(now);
+    objects_mutex.unlock();
+
+    ThreadStats &stats = thread_stats();
+    ::count(stats.inserts, inserted);
+    ::count(stats.updates, total - inserted);
+    if (total > 0 || expired)  relay_trigger.notify(escalated);
+}
+
+/*
+ * Remove all objects from the global list.
+ */
+void clear_objects() {
+    objects_mutex.lock();
+    objects.clear();
+    object_grid.clear();
+    object_expiry.clear();
+    object_tracks.reset(0);
+    pending_changes.clear_all();
+    objects_mutex.unlock();
+    relay_trigger.notify();
+}
 
-    if (!found)  objects.push_back(object); // Add object
+// Look up the objects with the IDs. The caller must hold objects_mutex.
+std::vector<Object> find_objects(const std::vector<int64_t> &ids) {
+    std::vector<Object> found;
+    found.reserve(ids.size());
+    for (const int64_t id : ids)  found.push_back(objects[objects.find(id)]);
+    return found;
+}
 
+/*
+ * Get the objects in the global list that are closer than the radius
+ * to the coordinate, using the spatial index rather than a scan.
+ */
+std::vector<Object> objects_within(int32_t x, int32_t y, int64_t radius) {
+    std::vector<int64_t> ids;
+    objects_mutex.lock();
+    object_grid.within(x, y, radius, ids);
+    const std::vector<Object> found = find_objects(ids);
     objects_mutex.unlock();
+    return found;
 }
 
 /*
- * Print info on the global list of objects. A preamble and the
- * number of objects are printed first, followed by the members
- * of each object. All values are printed as zero-padded hex
- * values. The padding is necessary because otherwise it would
- * be impossible to separate the values.
+ * Get the k objects in the global list nearest to the coordinate,
+ * nearest first, using the spatial index rather than a scan.
  */
-void relay_info_once(std::ostream &os) {
+std::vector<Object> nearest_objects(int32_t x, int32_t y, std::size_t k) {
+    std::vector<int64_t> ids;
     objects_mutex.lock();
+    object_grid.nearest(x, y, k, ids);
+    const std::vector<Object> found = find_objects(ids);
+    objects_mutex.unlock();
+    return found;
+}
+
+// The relay's copy of the global list and the changes it's applying.
+// Only the relay thread touches these, so they need no lock.
+ObjectSnapshot relay_snapshot;
+ObjectChanges relay_changes;
+uint64_t relay_pending_since = 0; // When the oldest of the relay changes was received
+bool relay_predictions = false;  // Whether the relay changes carry predicted colors
+std::string relay_frame; // Reused so that its memory is only allocated once
 
-    os << std::hex; // Print hexadecimals
-    auto old_filler = os.fill(); // Store the old fill char
-    os.fill('0'); // Zero-padding
+// Writes the frames of relay_info_continually() on a thread of its own
+FrameWriter relay_output;
 
-    // Print the preamble
-    const int32_t preamble = 0xfeff;
-    os << std::setw(sizeof(preamble)*2) << preamble;
+// Sends subscribers the objects they asked for on every relay
+SubscriptionServer subscriptions;
 
-    const int32_t count = objects.size();
-    os << std::setw(sizeof(count)*2) << count;
+/*
+ * Bring the relay's copy of the global list up to date and return it.
+ * The receiving thread is only blocked while expired objects are removed
+ * and the pending changes are swapped for the empty ones the relay applied
+ * last time. Expiring here as well means that objects expire on time even
+ * when nothing is received.
+ */
+const ObjectSnapshot& take_snapshot() {
+    objects_mutex.lock();
+    if (object_expiry.ttl())  expire_objects(milliseconds_now());
+    std::swap(pending_changes, relay_changes);
+    relay_pending_since = pending_since;
+    pending_since = 0;
+    relay_predictions = prediction_horizon > 0;
+    objects_mutex.unlock();
+
+    relay_snapshot.apply(relay_changes);
+    relay_changes.reset();
+    return relay_snapshot;
+}
 
-    for (auto object : objects) {
-        os << std::setw(sizeof(object.   id)*2) << object.   id;
-        os << std::setw(sizeof(object.    x)*2) << object.    x;
-        os << std::setw(sizeof(object.    y)*2) << object.    y;
-        os << std::setw(sizeof(object. type)*2) << object. type;
-        os << std::setw(sizeof(object.color)*2) << object.color;
+/*
+ * Serialize info on the global list of objects into the frame. A preamble
+ * and the number of objects come first, followed by the members of each
+ * object. By default all values are zero-padded hex values. The padding
+ * is necessary because otherwise it would be impossible to separate the
+ * values. In the binary format they are little-endian integers instead.
+ * The info is taken from a snapshot of the list, so serializing never
+ * blocks the thread that receives objects. Only one thread at a time may
+ * relay info.
+ *
+ * Unless a keyframe is asked for, only the objects that changed since
+ * the last relay are serialized, in a delta frame, along with the IDs of
+ * the objects that expired since then. A full frame is still serialized
+ * if the list was cleared since a delta frame can't express that.
+ * While colors are predicted, the frames carry the predictions.
+ * Returns when the oldest change in the frame was received, from
+ * stats_clock(), or 0 if nothing changed.
+ */
+uint64_t serialize_relay(std::string &frame, FrameFormat format, bool keyframe) {
+    ThreadStats &stats = thread_stats();
+    const uint64_t start = stats_clock();
+    const ObjectSnapshot& snapshot = take_snapshot();
+    const uint64_t snapshot_taken = stats_clock();
+
+    frame.clear();
+    if (keyframe || snapshot.cleared()) {
+        append_frame(frame, format, snapshot.objects().data(), snapshot.objects().size(), relay_predictions);
+    } else {
+        append_delta_frame(frame, format, snapshot.changed().data(), snapshot.changed().size(),
+                           snapshot.removed().data(), snapshot.removed().size(), relay_predictions);
     }
+    const uint64_t serialized = stats_clock();
 
-    os.fill(old_filler); // Restore the old fill char
-    os << std::dec; // Stop printing hexadecimals
+    stats.stage(Stage::SNAPSHOT).record(snapshot_taken - start);
+    stats.stage(Stage::SERIALIZE).record(serialized - snapshot_taken);
+    ::count(stats.relays);
+    return relay_pending_since;
+}
 
-    objects_mutex.unlock();
+/*
+ * Print info on the global list of objects to the stream, serialized as
+ * by serialize_relay(). The whole frame is serialized first so that it's
+ * printed with one write.
+ */
+void relay_info_once(std::ostream &os, FrameFormat format, bool keyframe) {
+    const uint64_t received_at = serialize_relay(relay_frame, format, keyframe);
+    const uint64_t serialized = stats_clock();
+    os.write(relay_frame.data(), relay_frame.size());
+    const uint64_t written = stats_clock();
+
+    ThreadStats &stats = thread_stats();
+    stats.stage(Stage::WRITE).record(written - serialized);
+    if (received_at != 0)  stats.stage(Stage::RECEIVE_TO_RELAY).record(written - received_at);
 }
 
-bool do_relay = true; // Informs the relay thread when to terminate
+/*
+ * Relay info about the objects in the global list whenever the relay
+ * trigger says that a relay is due, until it's stopped. The frames are
+ * handed to the relay output, which writes them on a thread of its own.
+ * Hex frames are written one per line. Binary frames are written back to
+ * back since their lengths follow from their object counts. If a keyframe
+ * interval is set, delta frames are relayed between the full frames, and
+ * a keyframe is relayed early if the output dropped frames that a delta
+ * would depend on. Subscribers are sent their part of every relay. A
+ * last relay is made when the trigger is stopped.
+ */
+void relay_info_continually(ClientOptions options) {
+    const FrameFormat format = options.format;
+    unsigned long relay = 0;
+    bool stopped = false;
+    while (true) {
+        // The first relay is always a keyframe so that the consumer has a starting point
+        const bool keyframe = options.keyframe_interval == 0 || relay % options.keyframe_interval == 0
+                           || relay_output.keyframe_needed();
+
+        const uint64_t received_at = serialize_relay(relay_frame, format, keyframe);
+        if (format == FrameFormat::HEX)  relay_frame += '\n';
+        if (!relay_output.submit(relay_frame, keyframe, received_at)) {
+            // The output dropped a frame since keyframe_needed() was asked,
+            // so the delta is replaced by a keyframe, which holds its changes
+            serialize_relay(relay_frame, format, true);
+            if (format == FrameFormat::HEX)  relay_frame += '\n';
+            relay_output.submit(relay_frame, true, received_at);
+        }
+        subscriptions.publish(relay_snapshot.objects(), relay_predictions);
+        relay++;
+        if (stopped)  break;
+
+        // Relay once more after being stopped, so that the last changes aren't lost
+        stopped = !relay_trigger.wait();
+    }
+}
 
 /*
- * Relay info about the objects in the global list with fixed time intervals.
+ * Open the output that relays are written to, and the subscription
+ * socket if one is asked for. If that fails, the error is printed to
+ * std::clog and false is returned.
  */
-void relay_info_continually() {
-    while (do_relay) {
-        relay_info_once(std::cout);
-        std::cout << std::endl;
-        std::this_thread::sleep_for(RELAY_INTERVAL);
+bool open_relay_output(const ClientOptions& options) {
+    std::string error;
+    if (!relay_output.open(options.output, error)) {
+        std::clog << "Could not open the output: " << error << std::endl;
+        return false;
+    }
+    if (!options.subscribe_path.empty() && !subscriptions.listen(options.subscribe_path, error)) {
+        std::clog << "Could not accept subscriptions: " << error << std::endl;
+        relay_output.close();
+        return false;
     }
+    return true;
 }
 
 /*
- * Start the socket communication with the server. Upon connecting, this
- * function accepts data from the server and parses it as it comes. A
- * child thread is spawned that continually relays info gathered from
- * said data. This function blocks the thread it's called from until the
- * server disconnects or an error occurs. If an error occurs, the error
- * is printed to std::clog and a non-zero value is returned.
+ * Start relaying info to the opened relay output on a separate thread
+ * with the options.
  */
-int start_client(const char *server_ip, const char *server_port) {
-
-    // Init Winsock
-    WORD wVersionRequested = MAKEWORD(2,2);
-    WSADATA lpWSAData;
-    int error_code = WSAStartup(wVersionRequested, &lpWSAData);
-    if (error_code) {
-        std::clog << "WSAStartup() failed with the error code " << error_code << std::endl;
+std::thread start_relay(const ClientOptions& options) {
+#ifdef _WIN32
+    // Keep Windows from turning the bytes of binary frames that happen
+    // to be '\n' into "\r\n"
+    if (options.format == FrameFormat::BINARY)  _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    set_object_ttl(options.ttl);
+    set_prediction_horizon(options.prediction_horizon);
+    relay_trigger.set_timing(options.timing);
+    relay_trigger.restart();
+    relay_output.start(options.slow_output);
+    return std::thread(relay_info_continually, options);
+}
+
+/*
+ * Make the relay thread quit without waiting for its next relay, close
+ * the subscription socket, and close the relay output once everything
+ * relayed has been written. Returns false if any write to the output failed.
+ */
+bool stop_relay(std::thread& relay_thread) {
+    relay_trigger.stop();
+    relay_thread.join();
+    subscriptions.close();
+    return relay_output.close();
+}
+
+/*
+ * Start the socket communication with the servers. Upon connecting, this
+ * function accepts data from the servers and parses it as it comes. The
+ * objects from all servers are gathered in the global list. The data goes
+ * through an IngestPipeline, whose feeds are spread over the given number
+ * of parse threads so that parsing can use many cores. A child thread is
+ * spawned that continually relays info gathered from said data. This
+ * function blocks the thread it's called from until every server
+ * disconnects or an error occurs. A server that can't be connected to is
+ * skipped. If an error occurs, the error is printed to std::clog and a
+ * non-zero value is returned. If a capture path is given, everything
+ * received is recorded there for replay_client().
+ */
+int start_client(const std::vector<Endpoint>& endpoints, const ClientOptions& options) {
+
+    CaptureWriter capture;
+    std::string error;
+    if (!options.capture_path.empty() && !capture.open(options.capture_path, error)) {
+        std::clog << "Could not start the capture: " << error << std::endl;
         return 1;
     }
 
-    // Set hints for the socket communication
-    struct addrinfo hints;
-    ZeroMemory(&hints, sizeof(hints));
-    hints.ai_family   = AF_UNSPEC;   // Unspecified address family
-    hints.ai_socktype = SOCK_STREAM; // Byte stream socket
-    hints.ai_protocol = IPPROTO_TCP; // Use TCP
-
-    // Resolve the server address and port
-    struct addrinfo *addrinfos = nullptr; // Linked list
-    error_code = getaddrinfo(server_ip, server_port, &hints, &addrinfos);
-    if (error_code) {
-        std::clog << "getaddrinfo() failed with the error code " << error_code << std::endl;
-        WSACleanup();
+    if (!init_sockets())  return 1;
+    if (!open_relay_output(options)) {
+        cleanup_sockets();
         return 1;
     }
 
-    // Attempt to connect to an address until one succeeds
-    SOCKET sock = INVALID_SOCKET;
-    struct addrinfo *ptr = nullptr;
-    for (ptr = addrinfos; ptr != nullptr; ptr = ptr->ai_next) {
-
-        // Create the socket
-        sock = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
-        if (sock == INVALID_SOCKET) {
-            std::clog << "socket() failed with the error code " << WSAGetLastError() << std::endl;
-            WSACleanup();
-            return 1;
-        }
+    // Parse on one thread per core unless told otherwise
+    const unsigned parse_threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    IngestPipeline pipeline(parse_threads, capture.is_open() ? &capture : nullptr);
+
+    // Connect to every server
+    std::vector<socket_t> socks;
+    for (const auto& endpoint : endpoints) {
+        const socket_t sock = connect_to_server(endpoint.ip.c_str(), endpoint.port.c_str());
+        if (sock == NO_SOCKET)  continue;
 
-        // Connect to the server
-        error_code = connect(sock, ptr->ai_addr, (int)ptr->ai_addrlen);
-        if (error_code) {
-            closesocket(sock);
-            sock = INVALID_SOCKET;
+        if (!pipeline.add(sock, endpoint)) {
+            close_socket(sock);
             continue;
         }
-
-        break; // Success!
+        socks.push_back(sock);
     }
-
-    freeaddrinfo(addrinfos);
-
-    if (sock == INVALID_SOCKET) {
-        std::clog << "Failed to connect" << std::endl;
-        WSACleanup();
+    if (socks.empty()) {
+        std::clog << "Could not connect to any server" << std::endl;
+        relay_output.close();
+        subscriptions.close();
+        cleanup_sockets();
         return 1;
     }
 
-    // Start receiving data on a separate thread
-    std::thread relay_thread(relay_info_continually);
-
-    // Receive data until we stop receiving, i.e., the connection closes
-    char receive_buffer[RECEIVE_BUFFER_LENGTH];
-    int bytes_received;
-    do {
-        // Note: recv() clears the buffer before adding data
-        bytes_received = recv(sock, receive_buffer, RECEIVE_BUFFER_LENGTH, 0);
-
-        auto lines = split_string(receive_buffer, '\n');
-
-        for (auto line : lines) {
-            // Skip empty lines. Maybe we should check for blank lines as well?
-            if (!line.length())  continue;
-
-            Object object;
-            std::string error;
-            bool ok = parse_object(line, object, error);
-            if (ok) {
-                color_object(object);
-                add_or_update_object(object);
-            } else {
-                std::clog << "Could not parse the line below (" << error << ")" << std::endl;
-                std::clog << line << std::endl;
-            }
-        }
-
-        /*
-        // Debug print
-        if (bytes_received > 0) {
-            std::cout << "Bytes received: " << bytes_received << std::endl;
-        } else if (bytes_received == 0) {
-            std::cout << "Connection closed" << std::endl;
-        } else {
-            std::cout << "recv() failed with error: " << WSAGetLastError() << std::endl;
-        }
-        */
+    StatsReporter stats_reporter;
+    stats_reporter.start(std::clog, options.stats_interval);
+    std::thread relay_thread = start_relay(options);
 
-    } while (bytes_received > 0);
+    // Receive data until every connection closes and everything received is in the global list
+    bool ok = pipeline.run();
 
     // TODO: Catch keyboard interrupts to exit gracefully
 
-    do_relay = false; // Make the relay thread quit
-    relay_thread.join();
-    closesocket(sock);
-    WSACleanup();
+    if (!stop_relay(relay_thread))  ok = false;
+    stats_reporter.stop();
+    for (const auto sock : socks) {
+        close_socket(sock);
+    }
+    cleanup_sockets();
+
+    if (!capture.close()) {
+        std::clog << "Could not write the whole capture to " << options.capture_path << std::endl;
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
+
+/*
+ * Feed the chunks of the capture through an IngestPipeline like live
+ * data, as one feed per captured feed, parsed on at most the given number
+ * of threads. At a speed of 1 the chunks are handed over with the same
+ * timing as they were received, at a speed of n that many times faster,
+ * and at a speed of 0 as fast as possible. Returns the number of chunks
+ * replayed, once their objects are all in the global list.
+ */
+std::size_t replay_capture(CaptureReader& capture, double speed, unsigned parse_threads) {
+    IngestPipeline pipeline(parse_threads);
+    const std::size_t chunks = pipeline.replay(capture, speed);
+    if (capture.truncated()) {
+        std::clog << "The capture ends with an incomplete chunk, which was skipped" << std::endl;
+    }
+    return chunks;
+}
+
+/*
+ * Run the client on a capture from start_client() instead of live feeds,
+ * relaying info like start_client() does. The speed is as for
+ * replay_capture(). If an error occurs, the error is printed to std::clog
+ * and a non-zero value is returned.
+ */
+int replay_client(const std::string& path, double speed, const ClientOptions& options) {
+    CaptureReader capture;
+    std::string error;
+    if (!capture.open(path, error)) {
+        std::clog << "Could not replay the capture: " << error << std::endl;
+        return 1;
+    }
+
+    // The output may be a TCP connection
+    if (!init_sockets())  return 1;
+    if (!open_relay_output(options)) {
+        cleanup_sockets();
+        return 1;
+    }
 
-    return 0;
+    StatsReporter stats_reporter;
+    stats_reporter.start(std::clog, options.stats_interval);
+    std::thread relay_thread = start_relay(options);
+    replay_capture(capture, speed, options.threads ? options.threads : std::thread::hardware_concurrency());
+    const bool ok = stop_relay(relay_thread);
+    stats_reporter.stop();
+    cleanup_sockets();
+    return ok ? 0 : 1;
 }
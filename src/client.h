@@ -1,7 +1,15 @@
+#pragma once
 #include <stdio.h>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <iostream>
+#include "frame.h"
+#include "object.h"
+#include "store.h"
+#include "trigger.h"
+#include "capture.h"
+#include "output.h"
 
 // The designation all objects will be assessed against
 const int DESIGNATED_X = 150;
@@ -12,28 +20,93 @@ const uint32_t RED    = 0x1B5B316D;
 const uint32_t YELLOW = 0x1B5B336D;
 const uint32_t GREEN  = 0x1B5B326D;
 
-// Represents an object of interest
-struct Object {
-    int64_t  id;
-    int32_t  x;
-    int32_t  y;
-    uint32_t type;
-    uint32_t color;
+// The reasons a line can fail to be parsed as an Object
+enum class ParseError {
+    NONE,        // The line was parsed successfully
+    FIELD_COUNT, // There were not exactly four fields
+    ID_FIELD,    // The first field did not start with ID=
+    X_FIELD,     // The second field did not start with X=
+    Y_FIELD,     // The third field did not start with Y=
+    TYPE_FIELD,  // The fourth field did not start with TYPE=
+    VALUE,       // A value was not an integer or did not fit in its member
+    TYPE,        // TYPE was not 1, 2, or 3
+    LENGTH,      // The line was too long to be kept, so it was dropped
 };
 
-inline bool operator==(const Object& lhs, const Object& rhs) {
-    return (lhs.id == rhs.id) && (lhs.x == rhs.x) && (lhs.y == rhs.y) && (lhs.type == rhs.type);
-}
+// The address of a server that feeds the client objects
+struct Endpoint {
+    std::string ip;
+    std::string port;
+};
+
+// Counts what a feed has received
+struct FeedStats {
+    uint64_t bytes        = 0;
+    uint64_t lines        = 0;
+    uint64_t objects      = 0;
+    uint64_t parse_errors = 0;
+};
+
+// Objects received together, and when they were received, from stats_clock()
+struct ObjectBatch {
+    const Object *objects;
+    std::size_t   count;
+    uint64_t      received_at;
+};
+
+// Settings for start_client() that can be given on the command line
+struct ClientOptions {
+    FrameFormat format = FrameFormat::HEX; // How relay frames are printed
+
+    // If not 0, only what changed is relayed, in delta frames, except
+    // for every this many relays when a full frame is relayed
+    unsigned keyframe_interval = 0;
+
+    // The most threads that parse data from the feeds, or 0 for one per core
+    unsigned threads = 0;
 
-inline std::ostream& operator<<(std::ostream &os, const Object &o) {
-    return os << "Object{id=" << o.id << ", x=" << o.x << ", y=" << o.y << ", type=" << o.type << "}";
-}
+    RelayTiming timing; // When relays are published after changes
+
+    // Objects not updated for this long are removed, or never if 0
+    std::chrono::milliseconds ttl = std::chrono::milliseconds(0);
+
+    // If not 0, the colors objects are heading for this far ahead are
+    // predicted from their tracks and relayed with them
+    std::chrono::milliseconds prediction_horizon = std::chrono::milliseconds(0);
+
+    // If not empty, everything received is recorded in this capture file
+    std::string capture_path;
+
+    // If not 0, counters and stage timings are printed to std::clog this often
+    std::chrono::milliseconds stats_interval = std::chrono::milliseconds(0);
+
+    // Where relay frames are written, as for FrameWriter::open(), and what's
+    // done when it falls behind. Empty means stdout.
+    std::string output;
+    SlowOutputPolicy slow_output = SlowOutputPolicy::BLOCK;
+
+    // If not empty, local consumers can subscribe to filtered relays on a
+    // UNIX-domain socket at this path, as described at SubscriptionServer
+    std::string subscribe_path;
+};
 
-extern std::vector<Object> objects;
+extern ObjectStore objects;
 
-std::vector<std::string> split_string(const std::string str, const char sep);
+std::vector<std::string> split_string(const std::string& str, const char sep);
+ParseError parse_object(std::string_view line, Object& object);
+ParseError parse_fields(const std::string_view (&fields)[4], Object& object);
 bool parse_object(const std::string data, Object& object, std::string& error);
+const char *parse_error_string(ParseError error);
 void color_object(Object& object);
-void add_or_update_object(Object object);
-void relay_info_once(std::ostream &os);
-int start_client(const char *server_ip, const char *server_port);
+void add_or_update_object(const Object& object);
+void add_or_update_objects(const Object *batch, std::size_t count, uint64_t received_at = 0);
+void add_or_update_batches(const ObjectBatch *batches, std::size_t count);
+void clear_objects();
+void set_object_ttl(std::chrono::milliseconds ttl);
+void set_prediction_horizon(std::chrono::milliseconds horizon);
+std::vector<Object> objects_within(int32_t x, int32_t y, int64_t radius);
+std::vector<Object> nearest_objects(int32_t x, int32_t y, std::size_t k);
+void relay_info_once(std::ostream &os, FrameFormat format = FrameFormat::HEX, bool keyframe = true);
+int start_client(const std::vector<Endpoint>& endpoints, const ClientOptions& options = ClientOptions());
+std::size_t replay_capture(CaptureReader& capture, double speed, unsigned parse_threads = 1);
+int replay_client(const std::string& path, double speed, const ClientOptions& options = ClientOptions());
@@ -0,0 +1,280 @@
+#include "color.h"
+#include "client.h"
+#include <algorithm>
+#include <memory>
+
+// The zone radii, squared. An integer distance d is less than a radius r
+// exactly when d*d < r*r, so comparing squares needs no square roots.
+const int64_t NEAR_SQUARED   =  50 *  50;
+const int64_t MIDDLE_SQUARED =  75 *  75;
+const int64_t FAR_SQUARED    = 100 * 100;
+
+// No zone reaches further than this from the designated coordinate
+const int32_t MAX_RADIUS = 100;
+
+// The compiled zone rules, or null while the default rules are used
+std::unique_ptr<ColorRaster> zone_raster;
+
+// The zone rules themselves, for predicting colors
+ZoneRules zone_rules = ZoneRules::defaults();
+
+void set_zone_rules(const ZoneRules &rules) {
+    zone_raster.reset(rules.is_default() ? nullptr : new ColorRaster(rules));
+    zone_rules = rules;
+}
+
+/*
+ * Assign a color to the object based on its position, type, and category
+ * according to the default zone rules.
+ */
+void color_with_default_rules(Object& object) {
+    /*
+     * Color objects according to these conditions:
+     * Category 2 objects: Yellow unless closer than 100 from the designated coordinate then red.
+     * Type 1 objects: Green unless closer than 75 from the designated coordinate then yellow and if closer than 50 then red.
+     * Type 2 objects: Green unless closer than 50 from the designated coordinate then yellow.
+     */
+
+    // Squared distance, which can't overflow an unsigned 64-bit int even at the ends of the int32 range
+    const int64_t dx = static_cast<int64_t>(object.x) - DESIGNATED_X;
+    const int64_t dy = static_cast<int64_t>(object.y) - DESIGNATED_Y;
+    const uint64_t dist_squared = static_cast<uint64_t>(dx*dx) + static_cast<uint64_t>(dy*dy);
+
+    if (object.type == 3) {
+        // Category 2
+        object.color = YELLOW;
+        if (dist_squared < FAR_SQUARED) {
+            object.color = RED;
+        }
+    } else {
+        // Category 1
+        object.color = GREEN;
+        if (object.type == 1) {
+            if (dist_squared < NEAR_SQUARED) {
+                object.color = RED;
+            } else if (dist_squared < MIDDLE_SQUARED) {
+                object.color = YELLOW;
+            }
+        } else if (object.type == 2 && dist_squared < NEAR_SQUARED) {
+            object.color = YELLOW;
+        }
+    }
+}
+
+/*
+ * Assign a color to the object based on its position, type, and category.
+ */
+void color_object(Object& object) {
+    if (zone_raster) {
+        object.color = zone_raster->color(object.x, object.y, object.type);
+    } else {
+        color_with_default_rules(object);
+    }
+}
+
+/*
+ * Color the objects from start to the end of the columns one at a time.
+ * This is the fallback for CPUs without SIMD and for the tails of the
+ * columns that the SIMD implementations can't fill a whole register with.
+ */
+void color_objects_from(const ObjectColumns &columns, std::size_t start) {
+    Object object;
+    for (std::size_t i = start; i < columns.count; i++) {
+        object.x    = columns.x[i];
+        object.y    = columns.y[i];
+        object.type = columns.type[i];
+        color_with_default_rules(object);
+        columns.color[i] = object.color;
+    }
+}
+
+#ifdef SIMD_X86
+
+/*
+ * Each SIMD implementation works like this for every lane:
+ *
+ *  1. Check that the object is within MAX_RADIUS of the designated
+ *     coordinate on both axes. Objects outside that box are outside
+ *     every zone. This is done first since x - DESIGNATED_X could
+ *     overflow for objects far away.
+ *  2. Inside the box, dx and dy fit in 16 bits, so dx*dx + dy*dy can be
+ *     computed with one multiply-add of 16-bit pairs (pmaddwd) after
+ *     packing dx into the low half of the lane and dy into the high half.
+ *  3. Start from green and blend in yellow and then red wherever the
+ *     type and the distance call for it.
+ */
+
+__attribute__((target("sse2")))
+void color_objects_sse2(const ObjectColumns &columns) {
+    const __m128i min_x   = _mm_set1_epi32(DESIGNATED_X - MAX_RADIUS - 1);
+    const __m128i max_x   = _mm_set1_epi32(DESIGNATED_X + MAX_RADIUS + 1);
+    const __m128i min_y   = _mm_set1_epi32(DESIGNATED_Y - MAX_RADIUS - 1);
+    const __m128i max_y   = _mm_set1_epi32(DESIGNATED_Y + MAX_RADIUS + 1);
+    const __m128i center_x = _mm_set1_epi32(DESIGNATED_X);
+    const __m128i center_y = _mm_set1_epi32(DESIGNATED_Y);
+    const __m128i low_half = _mm_set1_epi32(0xffff);
+    const __m128i near    = _mm_set1_epi32(NEAR_SQUARED);
+    const __m128i middle  = _mm_set1_epi32(MIDDLE_SQUARED);
+    const __m128i far     = _mm_set1_epi32(FAR_SQUARED);
+    const __m128i type1   = _mm_set1_epi32(1);
+    const __m128i type2   = _mm_set1_epi32(2);
+    const __m128i type3   = _mm_set1_epi32(3);
+    const __m128i red     = _mm_set1_epi32(RED);
+    const __m128i yellow  = _mm_set1_epi32(YELLOW);
+    const __m128i green   = _mm_set1_epi32(GREEN);
+
+    std::size_t i = 0;
+    for (; i + 4 <= columns.count; i += 4) {
+        const __m128i x    = _mm_loadu_si128(reinterpret_cast<const __m128i *>(columns.x + i));
+        const __m128i y    = _mm_loadu_si128(reinterpret_cast<const __m128i *>(columns.y + i));
+        const __m128i type = _mm_loadu_si128(reinterpret_cast<const __m128i *>(columns.type + i));
+
+        // 1. The box around the zones
+        const __m128i in_box = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(x, min_x), _mm_cmplt_epi32(x, max_x)),
+                                             _mm_and_si128(_mm_cmpgt_epi32(y, min_y), _mm_cmplt_epi32(y, max_y)));
+
+        // 2. The squared distance
+        const __m128i dx = _mm_sub_epi32(x, center_x);
+        const __m128i dy = _mm_sub_epi32(y, center_y);
+        const __m128i packed = _mm_or_si128(_mm_and_si128(dx, low_half), _mm_slli_epi32(dy, 16));
+        const __m128i dist_squared = _mm_madd_epi16(packed, packed);
+
+        const __m128i is_near   = _mm_and_si128(in_box, _mm_cmplt_epi32(dist_squared, near));
+        const __m128i is_middle = _mm_and_si128(in_box, _mm_cmplt_epi32(dist_squared, middle));
+        const __m128i is_far    = _mm_and_si128(in_box, _mm_cmplt_epi32(dist_squared, far));
+
+        // 3. The colors
+        const __m128i is_type1 = _mm_cmpeq_epi32(type, type1);
+        const __m128i is_type2 = _mm_cmpeq_epi32(type, type2);
+        const __m128i is_type3 = _mm_cmpeq_epi32(type, type3);
+
+        const __m128i to_yellow = _mm_or_si128(_mm_or_si128(_mm_and_si128(is_type1, is_middle),
+                                                            _mm_and_si128(is_type2, is_near)),
+                                               _mm_andnot_si128(is_far, is_type3));
+        const __m128i to_red    = _mm_or_si128(_mm_and_si128(is_type1, is_near), _mm_and_si128(is_type3, is_far));
+
+        __m128i color = green;
+        color = _mm_or_si128(_mm_and_si128(to_yellow, yellow), _mm_andnot_si128(to_yellow, color));
+        color = _mm_or_si128(_mm_and_si128(to_red,    red),    _mm_andnot_si128(to_red,    color));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(columns.color + i), color);
+    }
+    color_objects_from(columns, i);
+}
+
+__attribute__((target("avx2")))
+void color_objects_avx2(const ObjectColumns &columns) {
+    const __m256i min_x   = _mm256_set1_epi32(DESIGNATED_X - MAX_RADIUS - 1);
+    const __m256i max_x   = _mm256_set1_epi32(DESIGNATED_X + MAX_RADIUS + 1);
+    const __m256i min_y   = _mm256_set1_epi32(DESIGNATED_Y - MAX_RADIUS - 1);
+    const __m256i max_y   = _mm256_set1_epi32(DESIGNATED_Y + MAX_RADIUS + 1);
+    const __m256i center_x = _mm256_set1_epi32(DESIGNATED_X);
+    const __m256i center_y = _mm256_set1_epi32(DESIGNATED_Y);
+    const __m256i low_half = _mm256_set1_epi32(0xffff);
+    const __m256i near    = _mm256_set1_epi32(NEAR_SQUARED);
+    const __m256i middle  = _mm256_set1_epi32(MIDDLE_SQUARED);
+    const __m256i far     = _mm256_set1_epi32(FAR_SQUARED);
+    const __m256i type1   = _mm256_set1_epi32(1);
+    const __m256i type2   = _mm256_set1_epi32(2);
+    const __m256i type3   = _mm256_set1_epi32(3);
+    const __m256i red     = _mm256_set1_epi32(RED);
+    const __m256i yellow  = _mm256_set1_epi32(YELLOW);
+    const __m256i green   = _mm256_set1_epi32(GREEN);
+
+    std::size_t i = 0;
+    for (; i + 8 <= columns.count; i += 8) {
+        const __m256i x    = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(columns.x + i));
+        const __m256i y    = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(columns.y + i));
+        const __m256i type = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(columns.type + i));
+
+        // 1. The box around the zones
+        const __m256i in_box = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(x, min_x), _mm256_cmpgt_epi32(max_x, x)),
+                                                _mm256_and_si256(_mm256_cmpgt_epi32(y, min_y), _mm256_cmpgt_epi32(max_y, y)));
+
+        // 2. The squared distance
+        const __m256i dx = _mm256_sub_epi32(x, center_x);
+        const __m256i dy = _mm256_sub_epi32(y, center_y);
+        const __m256i packed = _mm256_or_si256(_mm256_and_si256(dx, low_half), _mm256_slli_epi32(dy, 16));
+        const __m256i dist_squared = _mm256_madd_epi16(packed, packed);
+
+        const __m256i is_near   = _mm256_and_si256(in_box, _mm256_cmpgt_epi32(near,   dist_squared));
+        const __m256i is_middle = _mm256_and_si256(in_box, _mm256_cmpgt_epi32(middle, dist_squared));
+        const __m256i is_far    = _mm256_and_si256(in_box, _mm256_cmpgt_epi32(far,    dist_squared));
+
+        // 3. The colors
+        const __m256i is_type1 = _mm256_cmpeq_epi32(type, type1);
+        const __m256i is_type2 = _mm256_cmpeq_epi32(type, type2);
+        const __m256i is_type3 = _mm256_cmpeq_epi32(type, type3);
+
+        const __m256i to_yellow = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(is_type1, is_middle),
+                                                                  _mm256_and_si256(is_type2, is_near)),
+                                                  _mm256_andnot_si256(is_far, is_type3));
+        const __m256i to_red    = _mm256_or_si256(_mm256_and_si256(is_type1, is_near), _mm256_and_si256(is_type3, is_far));
+
+        __m256i color = green;
+        color = _mm256_blendv_epi8(color, yellow, to_yellow);
+        color = _mm256_blendv_epi8(color, red,    to_red);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(columns.color + i), color);
+    }
+    color_objects_from(columns, i);
+}
+
+#endif
+
+void color_objects(const ObjectColumns &columns, SimdLevel level) {
+    switch (level) {
+#ifdef SIMD_X86
+        case SimdLevel::SSE2: color_objects_sse2(columns); break;
+        case SimdLevel::AVX2: color_objects_avx2(columns); break;
+#endif
+        default:              color_objects_from(columns, 0); break;
+    }
+}
+
+void color_objects(const ObjectColumns &columns) {
+    if (zone_raster) {
+        for (std::size_t i = 0; i < columns.count; i++) {
+            columns.color[i] = zone_raster->color(columns.x[i], columns.y[i], columns.type[i]);
+        }
+    } else {
+        color_objects(columns, best_simd_level());
+    }
+}
+
+// The number of objects copied into columns at a time
+const std::size_t BLOCK_LENGTH = 256;
+
+void color_objects(Object *objects, std::size_t count) {
+    if (zone_raster) {
+        // A lookup per object doesn't gain anything from columns
+        for (std::size_t i = 0; i < count; i++)  color_object(objects[i]);
+        return;
+    }
+
+    int32_t  x[BLOCK_LENGTH];
+    int32_t  y[BLOCK_LENGTH];
+    uint32_t type[BLOCK_LENGTH];
+    uint32_t color[BLOCK_LENGTH];
+
+    for (std::size_t start = 0; start < count; start += BLOCK_LENGTH) {
+        const std::size_t length = std::min(BLOCK_LENGTH, count - start);
+        for (std::size_t i = 0; i < length; i++) {
+            x[i]    = objects[start + i].x;
+            y[i]    = objects[start + i].y;
+            type[i] = objects[start + i].type;
+        }
+
+        color_objects(ObjectColumns{x, y, type, color, length});
+
+        for (std::size_t i = 0; i < length; i++) {
+            objects[start + i].color = color[i];
+        }
+    }
+}
+
+void predict_color(Object &object, double vx, double vy, double horizon) {
+    const uint8_t level = color_level(object.color);
+    double seconds;
+    const uint8_t predicted = zone_rules.predict(object.x, object.y, object.type, level, vx, vy, horizon, seconds);
+    object.predicted    = predicted > level ? level_color(predicted) : 0;
+    object.time_to_zone = predicted > level ? static_cast<uint32_t>(seconds * 1000 + 0.5) : 0;
+}
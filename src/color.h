@@ -0,0 +1,54 @@
+#pragma once
+#include "object.h"
+#include "simd.h"
+#include "zones.h"
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * A structure-of-arrays view of the members of many objects that
+ * coloring reads and writes, so that SIMD registers can be loaded with
+ * the same member of consecutive objects.
+ */
+struct ObjectColumns {
+    const int32_t  *x;
+    const int32_t  *y;
+    const uint32_t *type;
+    uint32_t       *color;
+    std::size_t     count;
+};
+
+/*
+ * Color objects by the rules from now on. Rules other than the default
+ * ones are compiled into a ColorRaster. This isn't thread-safe, so it
+ * should be called before any objects are received.
+ */
+void set_zone_rules(const ZoneRules &rules);
+
+/*
+ * Assign a color to every object in the columns, with the same result as
+ * calling color_object() for each of them.
+ */
+void color_objects(const ObjectColumns &columns);
+
+/*
+ * Color the objects in the columns by the default zone rules, which is
+ * what color_objects() does unless other rules have been set. Distances
+ * are compared squared, as integers, so no square roots are taken and
+ * there's no rounding at the zone boundaries. The SIMD implementations
+ * classify 4 (SSE2) or 8 (AVX2) objects per instruction and select colors
+ * with masks instead of branches.
+ */
+void color_objects(const ObjectColumns &columns, SimdLevel level);
+
+// Color an array of objects by copying blocks of them into columns
+void color_objects(Object *objects, std::size_t count);
+
+/*
+ * Predict the color the object is heading for from its velocity, in
+ * coordinates per second: the most severe color, more severe than the one
+ * it has, that it gets within the horizon, in seconds, if it keeps going
+ * in a straight line. The zone rules are evaluated exactly rather than
+ * through the raster. Sets predicted to 0 if there's no such color.
+ */
+void predict_color(Object &object, double vx, double vy, double horizon);
@@ -0,0 +1,109 @@
+#include "expiry.h"
+
+TimerWheel::TimerWheel(uint64_t now) : current(now), count(0) {}
+
+/*
+ * Put the timer in the lowest level that reaches its deadline from the
+ * current tick. Deadlines past the highest level are put as far ahead as
+ * it reaches, and put in again from there when that time comes.
+ */
+void TimerWheel::place(const Timer &timer) {
+    const uint64_t deadline = timer.deadline < current ? current : timer.deadline;
+    const uint64_t delta = deadline - current;
+    for (unsigned level = 0; level < LEVELS; level++) {
+        if (delta < uint64_t(1) << (SLOT_BITS * (level + 1))) {
+            slots[level][(deadline >> (SLOT_BITS * level)) & (SLOTS - 1)].push_back(timer);
+            return;
+        }
+    }
+    const unsigned top = LEVELS - 1;
+    const uint64_t furthest = current + (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+    slots[top][(furthest >> (SLOT_BITS * top)) & (SLOTS - 1)].push_back(timer);
+}
+
+void TimerWheel::schedule(int64_t id, uint64_t deadline) {
+    place(Timer{id, deadline});
+    count++;
+}
+
+void TimerWheel::advance(uint64_t now, std::vector<int64_t> &due) {
+    // Nothing to fire on the way, so skip straight there
+    if (count == 0) {
+        if (now >= current)  current = now + 1;
+        return;
+    }
+
+    std::vector<Timer> moved;
+    for (; current <= now; current++) {
+        // Spread the slots of the higher levels that start at this tick
+        // over the levels below, highest first so they trickle all the way down
+        for (unsigned level = LEVELS - 1; level > 0; level--) {
+            if ((current & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) != 0)  continue;
+            moved.swap(slots[level][(current >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+            for (const Timer& timer : moved)  place(timer);
+            moved.clear();
+        }
+
+        std::vector<Timer> &slot = slots[0][current & (SLOTS - 1)];
+        if (slot.empty())  continue;
+        moved.swap(slot);
+        for (const Timer& timer : moved) {
+            if (timer.deadline <= current) {
+                due.push_back(timer.id);
+                count--;
+            } else {
+                place(timer); // Was too far ahead for the wheel to reach
+            }
+        }
+        moved.clear();
+    }
+}
+
+void TimerWheel::clear() {
+    for (auto& level : slots) {
+        for (auto& slot : level)  slot.clear();
+    }
+    count = 0;
+}
+
+ObjectExpiry::ObjectExpiry(uint64_t ttl, uint64_t now) : time_to_live(ttl), wheel(now / TICK) {}
+
+void ObjectExpiry::set_ttl(uint64_t ttl, uint64_t now) {
+    time_to_live = ttl;
+    wheel = TimerWheel(now / TICK);
+    last_seen.clear();
+}
+
+void ObjectExpiry::seen(int64_t id, uint64_t now) {
+    if (time_to_live == 0)  return;
+
+    const auto inserted = last_seen.emplace(id, now);
+    if (inserted.second) {
+        // Round up so that objects never expire early
+        wheel.schedule(id, (now + time_to_live + TICK - 1) / TICK);
+    } else {
+        inserted.first->second = now;
+    }
+}
+
+void ObjectExpiry::clear() {
+    wheel.clear();
+    last_seen.clear();
+}
+
+void ObjectExpiry::expire(uint64_t now, std::vector<int64_t> &expired) {
+    if (time_to_live == 0)  return;
+
+    due.clear();
+    wheel.advance(now / TICK, due);
+    for (const int64_t id : due) {
+        const auto found = last_seen.find(id);
+        const uint64_t deadline = found->second + time_to_live;
+        if (deadline <= now) {
+            expired.push_back(id);
+            last_seen.erase(found);
+        } else {
+            wheel.schedule(id, (deadline + TICK - 1) / TICK);
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * A hierarchical timer wheel. Each level is a ring of slots, and each
+ * slot of a level spans as many ticks as a whole ring of the level below.
+ * A timer is put in the slot of the lowest level whose ring reaches its
+ * deadline. When the lowest ring comes round to the start again, the
+ * timers of the next slot of the level above are spread over it, and so
+ * on up the levels. Scheduling is O(1), and every timer is moved at most
+ * once per level before it fires, no matter how many timers there are.
+ */
+class TimerWheel {
+public:
+    static const unsigned SLOT_BITS = 6;
+    static const unsigned SLOTS     = 1 << SLOT_BITS;
+    static const unsigned LEVELS    = 4; // Reaches 2^24 ticks ahead
+
+    explicit TimerWheel(uint64_t now = 0);
+
+    std::size_t size() const { return count; }
+
+    // Fire the ID at the deadline tick, or at the next advance() if it has passed
+    void schedule(int64_t id, uint64_t deadline);
+
+    // Move time forward to the tick and add the IDs whose deadlines have
+    // come to due, in the order of their deadlines
+    void advance(uint64_t now, std::vector<int64_t> &due);
+
+    void clear();
+
+private:
+    struct Timer {
+        int64_t  id;
+        uint64_t deadline;
+    };
+
+    std::vector<Timer> slots[LEVELS][SLOTS];
+    uint64_t current; // The next tick to process
+    std::size_t count;
+
+    void place(const Timer &timer);
+};
+
+/*
+ * Expires objects that haven't been seen for the time to live. Seeing an
+ * object only records the time, and each object has at most one timer in
+ * the wheel. When the timer fires, the object is expired if it still
+ * hasn't been seen for the time to live, and otherwise the timer is set
+ * again for when it could expire next. So an object that is updated all
+ * the time costs one timer per time to live, not one per update. Times
+ * are in milliseconds and objects are expired within one tick of their
+ * time to live.
+ */
+class ObjectExpiry {
+public:
+    // The length of a timer wheel tick in milliseconds
+    static const uint64_t TICK = 10;
+
+    explicit ObjectExpiry(uint64_t ttl = 0, uint64_t now = 0);
+
+    // Expire objects after this many milliseconds without being seen,
+    // or never if 0, and forget every object seen so far
+    void set_ttl(uint64_t ttl, uint64_t now);
+    uint64_t ttl() const { return time_to_live; }
+
+    void seen(int64_t id, uint64_t now);
+    void clear();
+
+    // Add the IDs of the objects that have expired by now to expired
+    void expire(uint64_t now, std::vector<int64_t> &expired);
+
+private:
+    uint64_t time_to_live;
+    TimerWheel wheel;
+    std::unordered_map<int64_t, uint64_t> last_seen; // When the objects with timers were last seen
+    std::vector<int64_t> due;                     // Reused by expire()
+};
@@ -0,0 +1,56 @@
+#include "feed.h"
+#include "color.h"
+#include "stats.h"
+#include <iostream>
+
+FeedParser::FeedParser(const std::string &name) : name(name), framer(RECEIVE_BUFFER_LENGTH) {}
+
+void FeedParser::parse(std::size_t length, std::vector<Object> &batch) {
+    ThreadStats &totals = thread_stats();
+    const uint64_t start = stats_clock();
+
+    const std::size_t dropped = framer.dropped_lines();
+    framer.commit(length);
+    if (framer.dropped_lines() != dropped) {
+        stats.parse_errors++;
+        ::count(totals.parse_errors[static_cast<std::size_t>(ParseError::LENGTH)]);
+        std::clog << "Dropped a line longer than " << LineFramer::MAX_LINE_LENGTH << " bytes from " << name << std::endl;
+    }
+    const std::size_t parsed_length = scanner.parse(framer.pending(), records);
+    batch.clear();
+    for (const auto& record : records) {
+        if (record.error == ParseError::NONE) {
+            batch.push_back(record.object);
+        } else {
+            stats.parse_errors++;
+            ::count(totals.parse_errors[static_cast<std::size_t>(record.error)]);
+            std::clog << "Could not parse the line below from " << name;
+            std::clog << " (" << parse_error_string(record.error) << ")" << std::endl;
+            std::clog << record.line << std::endl;
+        }
+    }
+    framer.consume(parsed_length); // The records' lines are invalid from here on
+    const uint64_t parsed = stats_clock();
+    color_objects(batch.data(), batch.size());
+    const uint64_t colored = stats_clock();
+
+    stats.bytes   += length;
+    stats.lines   += records.size();
+    stats.objects += batch.size();
+    ::count(totals.bytes, length);
+    ::count(totals.lines, records.size());
+    totals.stage(Stage::PARSE).record(parsed - start);
+    totals.stage(Stage::COLOR).record(colored - parsed);
+}
+
+void FeedParser::closed() {
+    // Whatever is left was cut off by the disconnect, so it can't be trusted
+    if (!framer.pending().empty()) {
+        std::clog << "Discarding an incomplete line at the end of the stream from " << name << std::endl;
+        std::clog << framer.pending() << std::endl;
+    }
+
+    std::clog << "Feed " << name << " closed after " << stats.bytes << " bytes, ";
+    std::clog << stats.lines << " lines, " << stats.objects << " objects, and ";
+    std::clog << stats.parse_errors << " parse errors" << std::endl;
+}
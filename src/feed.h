@@ -0,0 +1,42 @@
+#pragma once
+#include "client.h"
+#include "framer.h"
+#include "scan.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The number of bytes the client asks for in each recv() call. Since
+// lines are reassembled across calls, this can be large enough for
+// each call to carry many records.
+const std::size_t RECEIVE_BUFFER_LENGTH = 64*1024;
+
+/*
+ * Turns the byte stream from one server into colored objects. A line may
+ * be cut anywhere by a recv() call, so the framer keeps the partial line
+ * until the rest of it has been received. All the complete lines of each
+ * chunk are then parsed and colored as one batch. Lines that can't be
+ * parsed are reported to std::clog and skipped.
+ */
+class FeedParser {
+public:
+    explicit FeedParser(const std::string &name);
+
+    // Returns space for writing at least length received bytes
+    char *prepare(std::size_t length) { return framer.prepare(length); }
+
+    // Parse and color the lines completed by the length bytes just written
+    // to the prepared space, replacing the objects in batch with them
+    void parse(std::size_t length, std::vector<Object> &batch);
+
+    // Called once the stream has ended, to report on it
+    void closed();
+
+private:
+    const std::string name; // The endpoint of the feed, for messages
+    FeedStats stats;
+    LineFramer framer;
+    RecordScanner scanner;
+    std::vector<ParsedRecord> records;
+};
@@ -0,0 +1,197 @@
+#include "frame.h"
+#include <cstring>
+
+// The number of bytes the members of an object take up in a binary frame
+const std::size_t BINARY_OBJECT_LENGTH = sizeof(Object::id) + sizeof(Object::x) + sizeof(Object::y)
+                                       + sizeof(Object::type) + sizeof(Object::color);
+
+// And in a frame with predictions
+const std::size_t PREDICTED_OBJECT_LENGTH = BINARY_OBJECT_LENGTH + sizeof(Object::predicted)
+                                          + sizeof(Object::time_to_zone);
+
+/*
+ * The two lowercase hex digits of every byte value
+ */
+struct HexDigits {
+    char pairs[256][2];
+
+    constexpr HexDigits() : pairs() {
+        const char digits[] = "0123456789abcdef";
+        for (int i = 0; i < 256; i++) {
+            pairs[i][0] = digits[i >> 4];
+            pairs[i][1] = digits[i & 0xf];
+        }
+    }
+};
+
+constexpr HexDigits HEX_DIGITS;
+
+/*
+ * Writes values as zero-padded hex with two digits for each of their
+ * bytes, most significant byte first.
+ */
+struct HexWriter {
+    static const std::size_t CHARS_PER_BYTE = 2;
+
+    template <typename T>
+    static char *write(char *out, T value) {
+        const uint64_t bits = static_cast<uint64_t>(value); // Negative values are printed as unsigned
+        for (int shift = 8 * (sizeof(T) - 1); shift >= 0; shift -= 8) {
+            std::memcpy(out, HEX_DIGITS.pairs[(bits >> shift) & 0xff], 2);
+            out += 2;
+        }
+        return out;
+    }
+};
+
+/*
+ * Writes values as little-endian integers.
+ */
+struct BinaryWriter {
+    static const std::size_t CHARS_PER_BYTE = 1;
+
+    template <typename T>
+    static char *write(char *out, T value) {
+        const uint64_t bits = static_cast<uint64_t>(value);
+        for (std::size_t i = 0; i < sizeof(T); i++) {
+            out[i] = static_cast<char>(bits >> (8 * i));
+        }
+        return out + sizeof(T);
+    }
+};
+
+/*
+ * Write the members of the object, and its predictions if asked for.
+ * Returns the end of the written values.
+ */
+template <typename Writer, bool Predictions>
+char *write_object(char *out, const Object &object) {
+    out = Writer::write(out, object.   id);
+    out = Writer::write(out, object.    x);
+    out = Writer::write(out, object.    y);
+    out = Writer::write(out, object. type);
+    out = Writer::write(out, object.color);
+    if (Predictions) {
+        out = Writer::write(out, object.   predicted);
+        out = Writer::write(out, object.time_to_zone);
+    }
+    return out;
+}
+
+/*
+ * Write the number of objects followed by the members of each object,
+ * and their predictions if asked for. Returns the end of the written values.
+ */
+template <typename Writer, bool Predictions>
+char *write_objects(char *out, const Object *objects, std::size_t count) {
+    out = Writer::write(out, static_cast<int32_t>(count));
+    for (std::size_t i = 0; i < count; i++) {
+        out = write_object<Writer, Predictions>(out, objects[i]);
+    }
+    return out;
+}
+
+/*
+ * Append a full frame, resizing the string only once.
+ */
+template <typename Writer, bool Predictions = false>
+void append_full_frame(std::string &frame, const Object *objects, std::size_t count) {
+    const std::size_t object_length = Predictions ? PREDICTED_OBJECT_LENGTH : BINARY_OBJECT_LENGTH;
+    const std::size_t length = sizeof(FRAME_PREAMBLE) + sizeof(int32_t) + count*object_length;
+
+    const std::size_t start = frame.length();
+    frame.resize(start + length*Writer::CHARS_PER_BYTE);
+
+    char *out = &frame[start];
+    out = Writer::write(out, Predictions ? PREDICTED_FRAME_PREAMBLE : FRAME_PREAMBLE);
+    write_objects<Writer, Predictions>(out, objects, count);
+}
+
+/*
+ * Append a delta frame, resizing the string only once.
+ */
+template <typename Writer, bool Predictions>
+void append_delta_frame(std::string &frame, const Object *changed, std::size_t changed_count,
+                        const int64_t *removed, std::size_t removed_count) {
+    const std::size_t object_length = Predictions ? PREDICTED_OBJECT_LENGTH : BINARY_OBJECT_LENGTH;
+    const std::size_t length = sizeof(DELTA_PREAMBLE) + sizeof(int32_t) + changed_count*object_length
+                             + sizeof(int32_t) + removed_count*sizeof(int64_t);
+
+    const std::size_t start = frame.length();
+    frame.resize(start + length*Writer::CHARS_PER_BYTE);
+
+    char *out = &frame[start];
+    out = Writer::write(out, Predictions ? PREDICTED_DELTA_PREAMBLE : DELTA_PREAMBLE);
+    out = write_objects<Writer, Predictions>(out, changed, changed_count);
+    out = Writer::write(out, static_cast<int32_t>(removed_count));
+    for (std::size_t i = 0; i < removed_count; i++) {
+        out = Writer::write(out, removed[i]);
+    }
+}
+
+void append_hex_frame(std::string &frame, const Object *objects, std::size_t count) {
+    append_full_frame<HexWriter>(frame, objects, count);
+}
+
+void append_binary_frame(std::string &frame, const Object *objects, std::size_t count) {
+    append_full_frame<BinaryWriter>(frame, objects, count);
+}
+
+void append_frame(std::string &frame, FrameFormat format, const Object *objects, std::size_t count,
+                  bool predictions) {
+    if (predictions) {
+        if (format == FrameFormat::BINARY) {
+            append_full_frame<BinaryWriter, true>(frame, objects, count);
+        } else {
+            append_full_frame<HexWriter, true>(frame, objects, count);
+        }
+    } else if (format == FrameFormat::BINARY) {
+        append_binary_frame(frame, objects, count);
+    } else {
+        append_hex_frame(frame, objects, count);
+    }
+}
+
+void append_delta_frame(std::string &frame, FrameFormat format,
+                        const Object *changed, std::size_t changed_count,
+                        const int64_t *removed, std::size_t removed_count, bool predictions) {
+    if (format == FrameFormat::BINARY) {
+        if (predictions) {
+            append_delta_frame<BinaryWriter, true>(frame, changed, changed_count, removed, removed_count);
+        } else {
+            append_delta_frame<BinaryWriter, false>(frame, changed, changed_count, removed, removed_count);
+        }
+    } else if (predictions) {
+        append_delta_frame<HexWriter, true>(frame, changed, changed_count, removed, removed_count);
+    } else {
+        append_delta_frame<HexWriter, false>(frame, changed, changed_count, removed, removed_count);
+    }
+}
+
+std::size_t object_record_length(FrameFormat format, bool predictions) {
+    const std::size_t length = predictions ? PREDICTED_OBJECT_LENGTH : BINARY_OBJECT_LENGTH;
+    return format == FrameFormat::BINARY ? length : length*HexWriter::CHARS_PER_BYTE;
+}
+
+void append_frame_header(std::string &frame, FrameFormat format, std::size_t count, bool predictions) {
+    const int32_t preamble = predictions ? PREDICTED_FRAME_PREAMBLE : FRAME_PREAMBLE;
+    const std::size_t start = frame.length();
+    if (format == FrameFormat::BINARY) {
+        frame.resize(start + 2*sizeof(int32_t));
+        char *out = BinaryWriter::write(&frame[start], preamble);
+        BinaryWriter::write(out, static_cast<int32_t>(count));
+    } else {
+        frame.resize(start + 2*sizeof(int32_t)*HexWriter::CHARS_PER_BYTE);
+        char *out = HexWriter::write(&frame[start], preamble);
+        HexWriter::write(out, static_cast<int32_t>(count));
+    }
+}
+
+char *write_object_record(char *out, FrameFormat format, const Object &object, bool predictions) {
+    if (format == FrameFormat::BINARY) {
+        return predictions ? write_object<BinaryWriter, true>(out, object)
+                           : write_object<BinaryWriter, false>(out, object);
+    }
+    return predictions ? write_object<HexWriter, true>(out, object)
+                       : write_object<HexWriter, false>(out, object);
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "object.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Starts every frame so that consumers can find where frames begin.
+// In binary frames it also tells the consumer the byte order.
+const int32_t FRAME_PREAMBLE = 0xfeff;
+
+// Starts delta frames, which only hold what changed since the last frame
+const int32_t DELTA_PREAMBLE = 0xfefd;
+
+// Start full and delta frames whose objects also have the predicted color
+// and the time to it, when colors are predicted
+const int32_t PREDICTED_FRAME_PREAMBLE = 0xfefe;
+const int32_t PREDICTED_DELTA_PREAMBLE = 0xfefc;
+
+// The ways a frame can be written
+enum class FrameFormat {
+    HEX,    // Zero-padded hex digits, two for each byte
+    BINARY, // Fixed-width little-endian integers
+};
+
+/*
+ * Append a relay frame to the string. The frame is the preamble and the
+ * number of objects, followed by the id, x, y, type, and color of each
+ * object. All values are written as zero-padded hex, i.e., two digits for
+ * every byte of the value, without anything between them. The digits of
+ * each byte are copied from a lookup table, and the string is only
+ * resized once per frame.
+ */
+void append_hex_frame(std::string &frame, const Object *objects, std::size_t count);
+
+/*
+ * Append a relay frame to the string with the same values as the hex
+ * frame, but as little-endian integers of the same widths, i.e., the
+ * int32 preamble and count followed by 24 bytes for each object. This
+ * is half the size of a hex frame, and consumers need no parsing.
+ */
+void append_binary_frame(std::string &frame, const Object *objects, std::size_t count);
+
+/*
+ * Append a relay frame in the given format to the string. With
+ * predictions, it starts with PREDICTED_FRAME_PREAMBLE instead, and each
+ * object is followed by its predicted color and time to zone, as uint32,
+ * so binary objects take 32 bytes.
+ */
+void append_frame(std::string &frame, FrameFormat format, const Object *objects, std::size_t count,
+                  bool predictions = false);
+
+/*
+ * Append a delta frame in the given format to the string. It starts with
+ * the delta preamble and the number of changed objects, followed by the
+ * members of each changed object like in a full frame. Then comes the
+ * number of removed objects as an int32, followed by the int64 ID of
+ * each removed object. Applying delta frames in order to the objects of
+ * the last full frame gives the objects a full frame would have held.
+ * With predictions, the objects are as in a full frame with predictions,
+ * after PREDICTED_DELTA_PREAMBLE.
+ */
+void append_delta_frame(std::string &frame, FrameFormat format,
+                        const Object *changed, std::size_t changed_count,
+                        const int64_t *removed, std::size_t removed_count, bool predictions = false);
+
+/*
+ * A full frame can also be put together a piece at a time, e.g. from
+ * records written once and copied into several frames: the header, i.e.
+ * the preamble and the number of objects, followed by that many object
+ * records of object_record_length() characters each.
+ */
+std::size_t object_record_length(FrameFormat format, bool predictions);
+
+void append_frame_header(std::string &frame, FrameFormat format, std::size_t count, bool predictions);
+
+// Write the record of the object, which takes object_record_length()
+// characters from out. Returns the end of the record.
+char *write_object_record(char *out, FrameFormat format, const Object &object, bool predictions);
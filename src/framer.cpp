@@ -0,0 +1,83 @@
+#include "framer.h"
+#include <algorithm>
+#include <cstring>
+
+LineFramer::LineFramer(std::size_t capacity, std::size_t max_line_length)
+    : buffer(capacity), begin(0), end(0), line_start(0), max_line_length(max_line_length),
+      discarding(false), dropped(0) {}
+
+char *LineFramer::prepare(std::size_t length) {
+    if (buffer.size() - end < length) {
+        // Move the partial line to the front to make room after it
+        const std::size_t pending_length = end - begin;
+        std::memmove(buffer.data(), buffer.data() + begin, pending_length);
+        line_start -= begin;
+        begin = 0;
+        end   = pending_length;
+
+        // Grow if the partial line is so long that there still isn't room
+        if (buffer.size() - end < length) {
+            buffer.resize(std::max(buffer.size() * 2, end + length));
+        }
+    }
+    return buffer.data() + end;
+}
+
+void LineFramer::commit(std::size_t length) {
+    char *received = buffer.data() + end;
+    if (discarding) {
+        // Drop the received bytes up to the end of the dropped line
+        const char *newline = static_cast<const char *>(std::memchr(received, '\n', length));
+        if (!newline)  return;
+        const std::size_t skipped = newline + 1 - received;
+        std::memmove(received, newline + 1, length - skipped);
+        length -= skipped;
+        discarding = false;
+    }
+
+    // Only the received bytes can hold a new start of the partial line, and
+    // searching from their end finds it after a line's length at most
+    for (std::size_t i = length; i > 0; i--) {
+        if (received[i-1] == '\n') {
+            line_start = end + i;
+            break;
+        }
+    }
+    end += length;
+
+    if (end - line_start > max_line_length) {
+        end = line_start;
+        discarding = true;
+        dropped++;
+    }
+    if (begin == end)  begin = end = line_start = 0;
+}
+
+bool LineFramer::next_line(std::string_view &line) {
+    const char *start   = buffer.data() + begin;
+    const char *newline = static_cast<const char *>(std::memchr(start, '\n', end - begin));
+    if (!newline)  return false; // Only a partial line, or nothing, is left
+
+    std::size_t length = newline - start;
+    begin += length + 1; // Add one to skip the newline
+
+    if (length && start[length-1] == '\r')  length--;
+    line = std::string_view(start, length);
+
+    if (begin == end)  begin = end = line_start = 0; // Everything consumed, start over at the front
+    return true;
+}
+
+std::string_view LineFramer::pending() const {
+    return std::string_view(buffer.data() + begin, end - begin);
+}
+
+void LineFramer::consume(std::size_t length) {
+    begin += length;
+    if (begin == end)  begin = end = line_start = 0;
+}
+
+void LineFramer::clear() {
+    begin = end = line_start = 0;
+    discarding = false;
+}
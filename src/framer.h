@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+/*
+ * Reassembles newline-terminated lines from a byte stream that arrives
+ * in chunks of arbitrary size, e.g. from recv(). Data is written directly
+ * into the framer's buffer and complete lines are handed out as views
+ * into that buffer, so nothing is copied. A line that is cut by a chunk
+ * boundary is kept until the rest of it arrives. A trailing '\r' is
+ * removed from every line since the server may use "\r\n" line endings.
+ *
+ * A partial line is only kept up to the maximum line length, so that a
+ * peer that never ends its line can't make the buffer grow without end.
+ * A longer line is dropped, along with the rest of it up to its '\n',
+ * and counted, and framing carries on with the line after it.
+ */
+class LineFramer {
+public:
+    // The default longest line kept, far more than any valid record needs
+    static const std::size_t MAX_LINE_LENGTH = 4096;
+
+    explicit LineFramer(std::size_t capacity, std::size_t max_line_length = MAX_LINE_LENGTH);
+
+    // Returns space for writing at least length bytes. Views handed
+    // out by next_line() are invalidated by this call.
+    char *prepare(std::size_t length);
+
+    // Marks length bytes of the space from prepare() as received
+    void commit(std::size_t length);
+
+    // Hands out the next complete line without its line ending.
+    // Returns false if there is no complete line left.
+    bool next_line(std::string_view &line);
+
+    // The bytes that have not been handed out as lines yet
+    std::string_view pending() const;
+
+    // Marks the first length pending bytes as handed out, for callers
+    // that find the lines in pending() by themselves
+    void consume(std::size_t length);
+
+    // Removes everything, e.g. before reusing the framer on a new stream
+    void clear();
+
+    // The number of lines dropped for being longer than the maximum
+    std::size_t dropped_lines() const { return dropped; }
+
+private:
+    std::vector<char> buffer;
+    std::size_t begin;      // Start of the first byte not handed out yet
+    std::size_t end;        // End of the received bytes
+    std::size_t line_start; // Start of the partial line after the last '\n'
+    std::size_t max_line_length;
+    bool discarding;        // Whether the rest of a dropped line is still coming
+    std::size_t dropped;
+};
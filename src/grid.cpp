@@ -0,0 +1,201 @@
+#include "grid.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <queue>
+
+SpatialGrid::SpatialGrid(int32_t cell_size) : cell_size(cell_size) {}
+
+// Round down rather than toward zero so that cells don't straddle 0
+int64_t SpatialGrid::cell_of(int64_t coordinate) const {
+    const int64_t cell = coordinate / cell_size;
+    return coordinate % cell_size < 0 ? cell - 1 : cell;
+}
+
+uint64_t SpatialGrid::cell_key(int64_t column, int64_t row) {
+    return static_cast<uint64_t>(static_cast<uint32_t>(column)) << 32 | static_cast<uint32_t>(row);
+}
+
+void SpatialGrid::update(const Object &object) {
+    const uint64_t cell = cell_key(cell_of(object.x), cell_of(object.y));
+    const Entry entry = {object.id, object.x, object.y, object.type};
+
+    // A new object gets a location, and a moving one keeps its own
+    const auto found = locations.try_emplace(object.id).first;
+    Location &location = found->second;
+    if (location.index != NOWHERE && location.cell == cell) {
+        // Still in the same cell
+        cells[cell][location.index] = entry;
+        return;
+    }
+    if (location.index != NOWHERE)  remove_entry(location);
+
+    Cell &entries = cells[cell];
+    location = Location{cell, static_cast<uint32_t>(entries.size())};
+    entries.push_back(entry);
+}
+
+bool SpatialGrid::erase(int64_t id) {
+    const auto found = locations.find(id);
+    if (found == locations.end())  return false;
+    remove_entry(found->second);
+    locations.erase(found);
+    return true;
+}
+
+/*
+ * Take the entry at the location out of its cell, moving the last entry
+ * of the cell into its place.
+ */
+void SpatialGrid::remove_entry(const Location &location) {
+    const auto cell = cells.find(location.cell);
+    Cell &entries = cell->second;
+    if (location.index != entries.size() - 1) {
+        entries[location.index] = entries.back();
+        locations[entries[location.index].id].index = location.index;
+    }
+    entries.pop_back();
+
+    // Empty cells are dropped so that objects moving around don't leave
+    // a trail of them behind
+    if (entries.empty())  cells.erase(cell);
+}
+
+void SpatialGrid::clear() {
+    cells.clear();
+    locations.clear();
+}
+
+template <typename Visit>
+void SpatialGrid::visit_cells(int64_t left, int64_t top, int64_t right, int64_t bottom, Visit visit) const {
+    const int64_t first_column = cell_of(left), last_column = cell_of(right);
+    const int64_t first_row    = cell_of(top),  last_row    = cell_of(bottom);
+
+    // When the square covers more cells than there are occupied ones,
+    // it's quicker to go through the occupied ones
+    const uint64_t square_cells = static_cast<uint64_t>(last_column - first_column + 1) * (last_row - first_row + 1);
+    if (square_cells > cells.size()) {
+        for (const auto& [key, entries] : cells) {
+            const int64_t column = static_cast<int32_t>(key >> 32);
+            const int64_t row    = static_cast<int32_t>(key);
+            if (column < first_column || column > last_column || row < first_row || row > last_row)  continue;
+            visit(key, entries);
+        }
+        return;
+    }
+
+    for (int64_t row = first_row; row <= last_row; row++) {
+        for (int64_t column = first_column; column <= last_column; column++) {
+            const auto cell = cells.find(cell_key(column, row));
+            if (cell != cells.end())  visit(cell->first, cell->second);
+        }
+    }
+}
+
+void SpatialGrid::within(int32_t x, int32_t y, int64_t radius, std::vector<int64_t> &ids) const {
+    ids.clear();
+    if (radius <= 0)  return;
+
+    // No two coordinates are further apart than this, and its square still fits
+    radius = std::min<int64_t>(radius, UINT32_MAX);
+
+    const uint64_t radius_squared = static_cast<uint64_t>(radius) * radius;
+    visit_cells(x - radius, y - radius, x + radius, y + radius, [&](uint64_t, const Cell& entries) {
+        for (const Entry& entry : entries) {
+            if (distance_squared(entry.x, entry.y, x, y) < radius_squared)  ids.push_back(entry.id);
+        }
+    });
+}
+
+/*
+ * Search rings of cells around the coordinate's cell, nearest ring first.
+ * An object in ring n is at least (n - 1) cells away, so the search stops
+ * once the k nearest objects found so far are all closer than that. If the
+ * rings grow larger than the number of occupied cells before then, the
+ * rest of the occupied cells are searched instead.
+ */
+void SpatialGrid::nearest(int32_t x, int32_t y, std::size_t k, std::vector<int64_t> &ids) const {
+    ids.clear();
+    if (k == 0 || locations.empty())  return;
+
+    // The k nearest so far, farthest on top
+    using Candidate = std::pair<uint64_t, int64_t>;
+    std::priority_queue<Candidate> best;
+    std::size_t visited = 0;
+    const auto consider = [&](const Entry& entry) {
+        visited++;
+        best.emplace(distance_squared(entry.x, entry.y, x, y), entry.id);
+        if (best.size() > k)  best.pop();
+    };
+
+    const int64_t center_column = cell_of(x), center_row = cell_of(y);
+    for (int64_t ring = 0; visited < locations.size(); ring++) {
+        if (best.size() == k) {
+            const uint64_t gap = static_cast<uint64_t>(std::max<int64_t>(ring - 1, 0)) * cell_size;
+            if (best.top().first < gap * gap)  break;
+        }
+
+        if (8 * static_cast<uint64_t>(ring) > cells.size()) {
+            for (const auto& [key, entries] : cells) {
+                const int64_t column = static_cast<int32_t>(key >> 32);
+                const int64_t row    = static_cast<int32_t>(key);
+                if (std::max(std::abs(column - center_column), std::abs(row - center_row)) < ring)  continue;
+                for (const Entry& entry : entries)  consider(entry);
+            }
+            break;
+        }
+
+        for (int64_t row = center_row - ring; row <= center_row + ring; row++) {
+            // Only the first and last rows of the ring are whole
+            const bool edge = row == center_row - ring || row == center_row + ring;
+            const int64_t step = edge ? 1 : std::max<int64_t>(2 * ring, 1);
+            for (int64_t column = center_column - ring; column <= center_column + ring; column += step) {
+                const auto cell = cells.find(cell_key(column, row));
+                if (cell == cells.end())  continue;
+                for (const Entry& entry : cell->second)  consider(entry);
+            }
+        }
+    }
+
+    ids.resize(best.size());
+    for (std::size_t i = ids.size(); i > 0; i--) {
+        ids[i - 1] = best.top().second;
+        best.pop();
+    }
+}
+
+void SpatialGrid::zone_levels(const ZoneRules &rules, std::vector<std::pair<int64_t, uint8_t>> &raised) const {
+    raised.clear();
+
+    // Only the widest ring that raises any type's color needs to be visited
+    int64_t reach_squared = 0;
+    for (const auto& [type, type_rules] : rules.types) {
+        for (const auto& ring : type_rules.rings) {
+            if (ring.level > type_rules.base)  reach_squared = std::max(reach_squared, ring.radius_squared);
+        }
+    }
+    for (const auto& ring : rules.other.rings) {
+        if (ring.level > rules.other.base)  reach_squared = std::max(reach_squared, ring.radius_squared);
+    }
+    if (reach_squared == 0)  return;
+
+    int64_t reach = static_cast<int64_t>(std::sqrt(static_cast<double>(reach_squared)));
+    while (reach * reach < reach_squared)  reach++;
+
+    // Zones may overlap, so the cells near every designated coordinate are
+    // gathered first in order to evaluate the objects in each only once
+    std::vector<uint64_t> near;
+    for (const auto& point : rules.points) {
+        visit_cells(point.x - reach, point.y - reach, point.x + reach, point.y + reach,
+                    [&](uint64_t key, const Cell&) { near.push_back(key); });
+    }
+    std::sort(near.begin(), near.end());
+    near.erase(std::unique(near.begin(), near.end()), near.end());
+
+    for (const uint64_t key : near) {
+        for (const Entry& entry : cells.find(key)->second) {
+            const uint8_t level = rules.evaluate(entry.x, entry.y, entry.type);
+            if (level > rules.rules_for(entry.type).base)  raised.emplace_back(entry.id, level);
+        }
+    }
+}
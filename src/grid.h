@@ -0,0 +1,87 @@
+#pragma once
+#include "object.h"
+#include "zones.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// The side of a grid cell in map units
+const int32_t DEFAULT_CELL_SIZE = 16;
+
+/*
+ * A spatial index of objects in a uniform grid of square cells. Only
+ * cells with objects in them are stored, in a hash table keyed by the
+ * cell's coordinates, so the grid covers any coordinates without having
+ * to know the bounds of the map. Updating an object only touches its old
+ * and new cells, and a query only visits the cells that overlap the area
+ * it asks about, rather than every object.
+ */
+class SpatialGrid {
+public:
+    explicit SpatialGrid(int32_t cell_size = DEFAULT_CELL_SIZE);
+
+    std::size_t size() const { return locations.size(); }
+
+    // Adds the object, or moves it to where it is now
+    void update(const Object &object);
+
+    // Removes the object with the ID. Returns false if there was none.
+    bool erase(int64_t id);
+
+    void clear();
+
+    // The IDs of the objects closer than the radius to the coordinate
+    void within(int32_t x, int32_t y, int64_t radius, std::vector<int64_t> &ids) const;
+
+    // The IDs of the k objects nearest to the coordinate, nearest first.
+    // Objects at the same distance are ordered by ID.
+    void nearest(int32_t x, int32_t y, std::size_t k, std::vector<int64_t> &ids) const;
+
+    /*
+     * Color by the rules per zone: visit the cells within each ring of each
+     * designated coordinate and find the objects that the rings give a more
+     * severe color than the base color of their type. Every other object
+     * has the base color of its type. The IDs are given with the levels,
+     * in no particular order.
+     */
+    void zone_levels(const ZoneRules &rules, std::vector<std::pair<int64_t, uint8_t>> &raised) const;
+
+private:
+    // What the grid needs to know about an object
+    struct Entry {
+        int64_t  id;
+        int32_t  x, y;
+        uint32_t type;
+    };
+
+    // Marks a location that isn't in any cell yet
+    static const uint32_t NOWHERE = UINT32_MAX;
+
+    // Where an object is in the grid
+    struct Location {
+        uint64_t cell  = 0;
+        uint32_t index = NOWHERE;
+    };
+
+    using Cell = std::pmr::vector<Entry>;
+
+    int32_t cell_size;
+
+    // Cells are dropped and made again as objects move between them, so
+    // their memory goes back to a pool to be reused rather than to the
+    // heap, and moving objects around allocates nothing once it's warm
+    std::pmr::unsynchronized_pool_resource pool;
+    std::pmr::unordered_map<uint64_t, Cell> cells{&pool};
+    std::pmr::unordered_map<int64_t, Location> locations{&pool};
+
+    int64_t cell_of(int64_t coordinate) const;
+    void remove_entry(const Location &location);
+    static uint64_t cell_key(int64_t column, int64_t row);
+
+    // Call visit with the key and entries of every occupied cell overlapping the square
+    template <typename Visit>
+    void visit_cells(int64_t left, int64_t top, int64_t right, int64_t bottom, Visit visit) const;
+};
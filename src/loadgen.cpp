@@ -0,0 +1,289 @@
+#include "transport.h"
+#include "zones.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+// The most bytes one line can take, malformed or not
+const std::size_t MAX_LINE_LENGTH = 96;
+
+// The most records formatted and sent at once
+const std::size_t BATCH_RECORDS = 8192;
+
+// The most bytes per send() when cutting the stream into pieces
+const std::size_t MAX_PIECE_LENGTH = 256;
+
+// The IDs of each connection start this far apart, so they never overlap
+const int64_t CONNECTION_ID_SPAN = 1000000000000;
+
+struct LoadOptions {
+    std::string port = "5463";
+    uint64_t objects = 1000;  // Objects per connection
+    uint64_t rate = 0;        // Records per second per connection, or 0 for as fast as possible
+    uint64_t records = 0;     // Records per connection before closing it, or 0 for never
+    double churn = 0;         // The share of records that replace their object with a new ID
+    double malformed = 0;     // The share of lines that can't be parsed
+    bool straddle = false;    // Cut the stream into small pieces that split lines
+};
+
+// Records sent by every connection, for the statistics
+std::atomic<uint64_t> total_records(0);
+std::atomic<uint64_t> total_bytes(0);
+std::atomic<unsigned> open_connections(0);
+
+/*
+ * Makes up the lines of one connection. The objects are updated in turn
+ * and take a random step each time, like the server's objects do, but
+ * without any path planning to slow it down.
+ */
+class LineGenerator {
+public:
+    LineGenerator(const LoadOptions &options, int64_t first_id, uint64_t seed)
+        : churn_threshold(options.churn * 4294967296.0), malformed_threshold(options.malformed * 4294967296.0),
+          next_id(first_id + options.objects), random_state(seed | 1), next_object(0) {
+        objects.resize(options.objects);
+        for (uint64_t i = 0; i < options.objects; i++) {
+            const uint64_t bits = random();
+            objects[i].id   = first_id + i;
+            objects[i].x    = bits % MAP_WIDTH;
+            objects[i].y    = (bits >> 20) % MAP_HEIGHT;
+            objects[i].type = 1 + (bits >> 40) % 3;
+        }
+    }
+
+    // Write count lines to the buffer, which must hold count * MAX_LINE_LENGTH
+    // bytes. Returns how many bytes were written.
+    std::size_t generate(char *buffer, std::size_t count) {
+        char *out = buffer;
+        for (std::size_t i = 0; i < count; i++) {
+            const uint64_t bits = random();
+            if ((bits & 0xffffffff) < malformed_threshold) {
+                out = append_malformed(out, bits >> 32);
+                continue;
+            }
+
+            Generated &object = objects[next_object];
+            next_object = next_object + 1 == objects.size() ? 0 : next_object + 1;
+            if ((bits >> 32) < churn_threshold)  object.id = next_id++;
+            object.x = step(object.x, bits >> 4, MAP_WIDTH);
+            object.y = step(object.y, bits >> 8, MAP_HEIGHT);
+
+            out = append(out, "ID=", object.id);
+            out = append(out, ";X=", object.x);
+            out = append(out, ";Y=", object.y);
+            out = append(out, ";TYPE=", object.type);
+            *out++ = '\n';
+        }
+        return out - buffer;
+    }
+
+private:
+    struct Generated {
+        int64_t id;
+        int32_t x;
+        int32_t y;
+        int32_t type;
+    };
+
+    std::vector<Generated> objects;
+    uint64_t churn_threshold;
+    uint64_t malformed_threshold;
+    int64_t next_id;
+    uint64_t random_state;
+    std::size_t next_object;
+
+    // xorshift64*, which is plenty random for this and costs a few cycles
+    uint64_t random() {
+        random_state ^= random_state >> 12;
+        random_state ^= random_state << 25;
+        random_state ^= random_state >> 27;
+        return random_state * 0x2545f4914f6cdd1d;
+    }
+
+    // Move one step back, none or one step forward, staying on the map
+    static int32_t step(int32_t position, uint64_t bits, int32_t size) {
+        const int32_t moved = position + static_cast<int32_t>(bits % 3) - 1;
+        return moved < 0 || moved >= size ? position : moved;
+    }
+
+    template <typename T>
+    static char *append(char *out, const char *key, T value) {
+        const std::size_t key_length = std::strlen(key);
+        std::memcpy(out, key, key_length);
+        return std::to_chars(out + key_length, out + MAX_LINE_LENGTH, value).ptr;
+    }
+
+    // The ways the client should be able to cope with a bad line
+    static char *append_malformed(char *out, uint64_t bits) {
+        static const char *const LINES[] = {
+            "ID=17;X=1;Y=2\n",                           // A field is missing
+            "ID=17;X=1;Y=two;TYPE=1\n",                  // Not a number
+            "ID=99999999999999999999;X=1;Y=2;TYPE=1\n",  // Out of range
+            "ID=17;X=1;Y=2;TYPE=1;SPEED=3\n",            // Too many fields
+            "garbage\n",
+        };
+        const char *line = LINES[bits % (sizeof(LINES) / sizeof(LINES[0]))];
+        const std::size_t length = std::strlen(line);
+        std::memcpy(out, line, length);
+        return out + length;
+    }
+};
+
+/*
+ * Send to one connection until it closes or the records per connection
+ * have been sent. With a rate, the records are sent in batches small
+ * enough that the stream stays smooth, each when it's due.
+ */
+void serve_connection(socket_t sock, LoadOptions options, unsigned index) {
+    using clock = std::chrono::steady_clock;
+
+    if (options.straddle) {
+        // Send every piece right away, so that each tends to be a segment of its own
+        const int no_delay = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&no_delay, sizeof(no_delay));
+    }
+
+    LineGenerator generator(options, (index + 1) * CONNECTION_ID_SPAN, 0x9e3779b97f4a7c15 * (index + 1));
+    std::vector<char> buffer(BATCH_RECORDS * MAX_LINE_LENGTH);
+    uint64_t piece_state = index + 1;
+
+    const std::size_t batch_records = options.rate == 0 ? BATCH_RECORDS
+                                    : std::clamp<uint64_t>(options.rate / 200, 1, BATCH_RECORDS);
+    const auto start = clock::now();
+    uint64_t sent = 0;
+    bool open = true;
+    while (open && (options.records == 0 || sent < options.records)) {
+        std::size_t count = batch_records;
+        if (options.records != 0)  count = std::min<uint64_t>(count, options.records - sent);
+        const std::size_t length = generator.generate(buffer.data(), count);
+
+        if (options.straddle) {
+            for (std::size_t offset = 0; open && offset < length;) {
+                piece_state = piece_state * 6364136223846793005 + 1442695040888963407;
+                const std::size_t piece = std::min(length - offset, 1 + (piece_state >> 33) % MAX_PIECE_LENGTH);
+                open = send_all(sock, buffer.data() + offset, piece);
+                offset += piece;
+            }
+        } else {
+            open = send_all(sock, buffer.data(), length);
+        }
+        if (!open)  break;
+
+        sent += count;
+        total_records += count;
+        total_bytes += length;
+        if (options.rate != 0) {
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds(sent * 1000000000 / options.rate));
+        }
+    }
+
+    close_socket(sock);
+    open_connections--;
+}
+
+// Print what was sent each second
+void print_statistics() {
+    uint64_t last_records = 0;
+    uint64_t last_bytes = 0;
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        const uint64_t records = total_records;
+        const uint64_t bytes = total_bytes;
+        std::cout << open_connections << " connections, " << records - last_records << " records/s, "
+                  << (bytes - last_bytes) / 1000000.0 << " MB/s" << std::endl;
+        last_records = records;
+        last_bytes = bytes;
+    }
+}
+
+// Parse the whole text as a number. Returns false if it isn't one.
+template <typename T>
+bool parse_number(const std::string &text, T &value) {
+    const char *last = text.c_str() + text.length();
+    const auto result = std::from_chars(text.c_str(), last, value);
+    return result.ec == std::errc() && result.ptr == last;
+}
+
+bool parse_share(const std::string &text, double &share) {
+    return parse_number(text, share) && share >= 0 && share <= 1;
+}
+
+/*
+ * Serves objects the way the server does, but as fast as asked, to put
+ * load on the client. Each connection gets objects of its own. Options:
+ *
+ *     --port=<n>       Listen on the port (default: 5463)
+ *     --objects=<n>    Objects per connection (default: 1000)
+ *     --rate=<n>       Records per second per connection (default: as fast as possible)
+ *     --records=<n>    Close each connection after this many records (default: never)
+ *     --churn=<p>      Give this share of the records a new ID, dropping the old one (default: 0)
+ *     --malformed=<p>  Make this share of the lines impossible to parse (default: 0)
+ *     --straddle       Send small pieces of random length, so lines are cut across segments
+ */
+int main(int argc, char *argv[]) {
+    LoadOptions options;
+    for (int arg = 1; arg < argc; arg++) {
+        const std::string option = argv[arg];
+        bool ok = true;
+        if (option.rfind("--port=", 0) == 0) {
+            options.port = option.substr(7);
+        } else if (option.rfind("--objects=", 0) == 0) {
+            ok = parse_number(option.substr(10), options.objects) && options.objects > 0;
+        } else if (option.rfind("--rate=", 0) == 0) {
+            ok = parse_number(option.substr(7), options.rate);
+        } else if (option.rfind("--records=", 0) == 0) {
+            ok = parse_number(option.substr(10), options.records);
+        } else if (option.rfind("--churn=", 0) == 0) {
+            ok = parse_share(option.substr(8), options.churn);
+        } else if (option.rfind("--malformed=", 0) == 0) {
+            ok = parse_share(option.substr(12), options.malformed);
+        } else if (option == "--straddle") {
+            options.straddle = true;
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            std::clog << "Bad option " << option << std::endl;
+            std::clog << "Usage: " << argv[0] << " [--port=<n>] [--objects=<n>] [--rate=<n>] [--records=<n>]";
+            std::clog << " [--churn=<0-1>] [--malformed=<0-1>] [--straddle]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (!init_sockets())  return 1;
+    const socket_t listener = listen_on_port(options.port.c_str());
+    if (listener == NO_SOCKET) {
+        cleanup_sockets();
+        return 1;
+    }
+    std::cout << "Listening on port " << options.port << std::endl;
+    std::thread(print_statistics).detach();
+
+    for (unsigned index = 0;; index++) {
+        const socket_t sock = accept(listener, nullptr, nullptr);
+        if (sock == NO_SOCKET) {
+            std::clog << "accept() failed with the error code " << last_socket_error() << std::endl;
+            break;
+        }
+        open_connections++;
+        std::thread(serve_connection, sock, options, index).detach();
+    }
+
+    close_socket(listener);
+    cleanup_sockets();
+    return 1;
+}
@@ -1,15 +1,210 @@
 #include "client.h"
+#include "color.h"
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <fstream>
 #include <iostream>
+#include <string>
 
 /*
- * Takes the server IP and port as arguments and starts the client
+ * Parse the whole text as a positive number. Returns false if it isn't one.
+ */
+bool parse_count(const std::string& text, unsigned& count) {
+    const char *last = text.c_str() + text.length();
+    const auto result = std::from_chars(text.c_str(), last, count);
+    return result.ec == std::errc() && result.ptr == last && count > 0;
+}
+
+/*
+ * Parse the whole text as a positive factor, which may have decimals.
+ * Returns false if it isn't one.
+ */
+bool parse_factor(const std::string& text, double& factor) {
+    const char *last = text.c_str() + text.length();
+    const auto result = std::from_chars(text.c_str(), last, factor);
+    return result.ec == std::errc() && result.ptr == last && std::isfinite(factor) && factor > 0;
+}
+
+/*
+ * Parse the whole text as a number of milliseconds, which may be zero.
+ * Returns false if it isn't one.
+ */
+bool parse_milliseconds(const std::string& text, std::chrono::milliseconds& duration) {
+    const char *last = text.c_str() + text.length();
+    unsigned milliseconds = 0;
+    const auto result = std::from_chars(text.c_str(), last, milliseconds);
+    duration = std::chrono::milliseconds(milliseconds);
+    return result.ec == std::errc() && result.ptr == last;
+}
+
+/*
+ * Takes the IP and port of one or more servers as arguments and starts
+ * the client, which gathers the objects from all of them. Options may
+ * be given before them:
+ *
+ *     --format=hex     Print relay frames as hex digits (default)
+ *     --format=binary  Print relay frames as little-endian integers
+ *     --delta=<n>      Relay only what changed, with a full frame every n relays
+ *     --threads=<n>    Parse on at most n threads (default: one per core)
+ *     --zones=<file>   Read the zone rules from the file (default: server.properties)
+ *     --ttl=<ms>       Remove objects not updated for this many milliseconds (default: never)
+ *     --predict=<ms>   Predict the colors objects get within this many milliseconds from how they
+ *                      move, and relay them in frames with predictions (default: never)
+ *     --capture=<file> Record everything received in the file
+ *     --replay=<file>  Replay a capture instead of connecting to servers, which are then not given
+ *     --speed=<n>|max  Replay n times as fast as the capture was received, e.g. 0.5 or 2.5
+ *                      (default: 1)
+ *     --stats=<ms>     Print counters and stage timings to std::clog this often (default: never)
+ *     --output=<file>  Write relay frames to the file or named pipe instead of stdout
+ *     --output=tcp:<ip>:<port>  Write relay frames to a TCP connection instead of stdout
+ *     --output=shm:<path>  Publish relay frames in shared memory at the path, e.g. in /dev/shm,
+ *                      for readers on the same host (see shm.h). Readers that only read the
+ *                      latest frame need every frame to be a keyframe, i.e. no --delta.
+ *     --slow-output=block|drop-oldest|latest
+ *                      When the output falls behind, hold up relays until it catches up (default),
+ *                      drop the oldest frames waiting for it, or only keep the latest frame
+ *     --subscribe=<path>  Let local consumers subscribe on a UNIX-domain socket at the path to
+ *                      frames with only the objects they ask for (see subscribe.h)
+ *
+ * and options for when relays are published, in milliseconds:
+ *
+ *     --coalesce=<ms>      Relay changes together that are this close (default: 50)
+ *     --max-latency=<ms>   Relay changes after at most this long (default: 250)
+ *     --min-interval=<ms>  Relay at most this often (default: 20)
+ *     --heartbeat=<ms>     Relay at least this often, even without changes (default: 1500)
+ *
+ * The zone rules are described at zone_rules_from(). Without any, the
+ * objects are colored by the default rules.
  */
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        std::clog << "Usage: " << argv[0] << " <ip> <port>" << std::endl;
+    ClientOptions options;
+    std::string zones_path;
+    std::string replay_path;
+    double speed = 1;
+
+    int arg = 1;
+    for (; arg < argc && std::string(argv[arg]).rfind("--", 0) == 0; arg++) {
+        const std::string option = argv[arg];
+        if (option == "--format=hex") {
+            options.format = FrameFormat::HEX;
+        } else if (option == "--format=binary") {
+            options.format = FrameFormat::BINARY;
+        } else if (option.rfind("--delta=", 0) == 0) {
+            if (!parse_count(option.substr(8), options.keyframe_interval)) {
+                std::clog << "The delta option needs a positive number of relays" << std::endl;
+                return 1;
+            }
+        } else if (option.rfind("--threads=", 0) == 0) {
+            if (!parse_count(option.substr(10), options.threads)) {
+                std::clog << "The threads option needs a positive number of threads" << std::endl;
+                return 1;
+            }
+        } else if (option.rfind("--zones=", 0) == 0) {
+            zones_path = option.substr(8);
+        } else if (option.rfind("--ttl=", 0) == 0) {
+            if (!parse_milliseconds(option.substr(6), options.ttl)) {
+                std::clog << "The ttl option needs a number of milliseconds" << std::endl;
+                return 1;
+            }
+        } else if (option.rfind("--predict=", 0) == 0) {
+            if (!parse_milliseconds(option.substr(10), options.prediction_horizon)) {
+                std::clog << "The predict option needs a number of milliseconds" << std::endl;
+                return 1;
+            }
+        } else if (option.rfind("--capture=", 0) == 0) {
+            options.capture_path = option.substr(10);
+        } else if (option.rfind("--replay=", 0) == 0) {
+            replay_path = option.substr(9);
+        } else if (option == "--speed=max") {
+            speed = 0;
+        } else if (option.rfind("--speed=", 0) == 0) {
+            if (!parse_factor(option.substr(8), speed)) {
+                std::clog << "The speed option needs a positive number or max" << std::endl;
+                return 1;
+            }
+        } else if (option.rfind("--stats=", 0) == 0) {
+            if (!parse_milliseconds(option.substr(8), options.stats_interval)) {
+                std::clog << "The stats option needs a number of milliseconds" << std::endl;
+                return 1;
+            }
+        } else if (option.rfind("--output=", 0) == 0) {
+            options.output = option.substr(9);
+            if (options.output.empty()) {
+                std::clog << "The output option needs a file, tcp:<ip>:<port> or shm:<path>" << std::endl;
+                return 1;
+            }
+        } else if (option == "--slow-output=block") {
+            options.slow_output = SlowOutputPolicy::BLOCK;
+        } else if (option == "--slow-output=drop-oldest") {
+            options.slow_output = SlowOutputPolicy::DROP_OLDEST;
+        } else if (option == "--slow-output=latest") {
+            options.slow_output = SlowOutputPolicy::LATEST;
+        } else if (option.rfind("--subscribe=", 0) == 0) {
+            options.subscribe_path = option.substr(12);
+            if (options.subscribe_path.empty()) {
+                std::clog << "The subscribe option needs a path" << std::endl;
+                return 1;
+            }
+        } else if (option.rfind("--coalesce=", 0) == 0) {
+            if (!parse_milliseconds(option.substr(11), options.timing.coalesce_window)) {
+                std::clog << "The coalesce option needs a number of milliseconds" << std::endl;
+                return 1;
+            }
+        } else if (option.rfind("--max-latency=", 0) == 0) {
+            if (!parse_milliseconds(option.substr(14), options.timing.max_latency)) {
+                std::clog << "The max-latency option needs a number of milliseconds" << std::endl;
+                return 1;
+            }
+        } else if (option.rfind("--min-interval=", 0) == 0) {
+            if (!parse_milliseconds(option.substr(15), options.timing.min_interval)) {
+                std::clog << "The min-interval option needs a number of milliseconds" << std::endl;
+                return 1;
+            }
+        } else if (option.rfind("--heartbeat=", 0) == 0) {
+            if (!parse_milliseconds(option.substr(12), options.timing.heartbeat) || options.timing.heartbeat.count() == 0) {
+                std::clog << "The heartbeat option needs a positive number of milliseconds" << std::endl;
+                return 1;
+            }
+        } else {
+            std::clog << "Unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    const bool servers_given = argc - arg >= 2 && (argc - arg) % 2 == 0;
+    if (replay_path.empty() ? !servers_given : argc != arg) {
+        std::clog << "Usage: " << argv[0] << " [--format=hex|binary] [--delta=<n>] [--threads=<n>] [--zones=<file>] [--ttl=<ms>] [--predict=<ms>] [--stats=<ms>]";
+        std::clog << " [--output=<file>|tcp:<ip>:<port>|shm:<path>] [--slow-output=block|drop-oldest|latest]";
+        std::clog << " [--subscribe=<path>]";
+        std::clog << " [--coalesce=<ms>] [--max-latency=<ms>] [--min-interval=<ms>] [--heartbeat=<ms>]";
+        std::clog << " [--capture=<file>] <ip> <port> [<ip> <port> ...]" << std::endl;
+        std::clog << "       " << argv[0] << " [options] --replay=<file> [--speed=<n>|max]" << std::endl;
         return 1;
     }
-    auto server_ip   = argv[1];
-    auto server_port = argv[2]; // TODO: Read this from server.properties
-    return start_client(server_ip, server_port);
+
+    // The server's properties may hold the rules, but they're optional there
+    if (zones_path.empty() && std::ifstream("server.properties")) {
+        zones_path = "server.properties";
+    }
+    if (!zones_path.empty()) {
+        ZoneRules rules = ZoneRules::defaults();
+        std::string error;
+        if (!load_zone_rules(zones_path, rules, error)) {
+            std::clog << "Could not load the zone rules: " << error << std::endl;
+            return 1;
+        }
+        set_zone_rules(rules);
+    }
+
+    if (!replay_path.empty()) {
+        return replay_client(replay_path, speed, options);
+    }
+
+    // TODO: Read the port from server.properties
+    std::vector<Endpoint> endpoints;
+    for (; arg < argc; arg += 2) {
+        endpoints.push_back(Endpoint{argv[arg], argv[arg+1]});
+    }
+    return start_client(endpoints, options);
 }
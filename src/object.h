@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <iostream>
+
+// Represents an object of interest
+struct Object {
+    int64_t  id;
+    int32_t  x;
+    int32_t  y;
+    uint32_t type;
+    uint32_t color;
+    uint32_t predicted    = 0; // The more severe color the object is heading for, or 0 if none
+    uint32_t time_to_zone = 0; // Milliseconds until it's predicted to get that color
+};
+
+inline bool operator==(const Object& lhs, const Object& rhs) {
+    return (lhs.id == rhs.id) && (lhs.x == rhs.x) && (lhs.y == rhs.y) && (lhs.type == rhs.type);
+}
+
+// Unlike ==, this also compares the colors and predictions
+inline bool identical(const Object& lhs, const Object& rhs) {
+    return (lhs == rhs) && (lhs.color == rhs.color) && (lhs.predicted == rhs.predicted)
+        && (lhs.time_to_zone == rhs.time_to_zone);
+}
+
+inline std::ostream& operator<<(std::ostream &os, const Object &o) {
+    return os << "Object{id=" << o.id << ", x=" << o.x << ", y=" << o.y << ", type=" << o.type << "}";
+}
@@ -0,0 +1,266 @@
+#include "output.h"
+#include "stats.h"
+#include <algorithm>
+#include <iostream>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// The most frames handed to one writev() call
+const int MAX_FRAMES_PER_WRITE = 64;
+
+FrameWriter::~FrameWriter() {
+    close();
+}
+
+bool FrameWriter::open(const std::string &target, std::string &error) {
+    close();
+    failed = false;
+    if (target.empty()) {
+        attach(1);
+        return true;
+    }
+
+    if (target.rfind("shm:", 0) == 0) {
+        shm.reset(new ShmPublisher());
+        if (!shm->create(target.substr(4), error)) {
+            shm.reset();
+            return false;
+        }
+        return true;
+    }
+
+    if (target.rfind("tcp:", 0) == 0) {
+        const std::size_t colon = target.rfind(':');
+        if (colon <= 4) {
+            error = "a TCP output is given as tcp:<ip>:<port>";
+            return false;
+        }
+        sock = connect_to_server(target.substr(4, colon - 4).c_str(), target.substr(colon + 1).c_str());
+        if (sock == NO_SOCKET) {
+            error = "could not connect to " + target.substr(4);
+            return false;
+        }
+        owned = true;
+        return true;
+    }
+
+#ifdef _WIN32
+    fd = ::_open(target.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    // A named pipe blocks here until something opens it for reading
+    fd = ::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd < 0) {
+        error = "could not create " + target;
+        return false;
+    }
+    owned = true;
+    return true;
+}
+
+void FrameWriter::attach(int fd) {
+    close();
+    failed = false;
+    this->fd = fd;
+}
+
+void FrameWriter::start(SlowOutputPolicy policy, std::size_t capacity) {
+    this->policy = policy;
+    slots.assign(std::max<std::size_t>(1, capacity), Frame());
+    limit = policy == SlowOutputPolicy::LATEST ? 1 : slots.size();
+    head = 0;
+    queued = 0;
+    dropped = 0;
+    closing = false;
+    need_keyframe = false;
+    thread = std::thread(&FrameWriter::write_frames, this);
+}
+
+bool FrameWriter::submit(std::string &frame, bool keyframe, uint64_t received_at) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!keyframe && need_keyframe)  return false;
+
+    if (queued == limit) {
+        if (policy == SlowOutputPolicy::BLOCK) {
+            space.wait(lock, [this] { return queued < limit; });
+        } else {
+            // The deltas after the oldest frame are dropped with it, up to
+            // the next keyframe, since they can't be applied without it
+            do {
+                drop_oldest();
+            } while (queued > 0 && !slots[head].keyframe);
+
+            // Nothing is left for a delta to follow
+            if (queued == 0 && !keyframe) {
+                need_keyframe = true;
+                return false;
+            }
+        }
+    }
+
+    Frame &slot = slots[(head + queued) % slots.size()];
+    slot.data.swap(frame);
+    slot.keyframe = keyframe;
+    slot.received_at = received_at;
+    queued++;
+    if (keyframe)  need_keyframe = false;
+    lock.unlock();
+    ready.notify_one();
+    return true;
+}
+
+std::size_t FrameWriter::queued_frames() {
+    mutex.lock();
+    const std::size_t count = queued;
+    mutex.unlock();
+    return count;
+}
+
+uint64_t FrameWriter::dropped_frames() {
+    mutex.lock();
+    const uint64_t count = dropped;
+    mutex.unlock();
+    return count;
+}
+
+bool FrameWriter::close() {
+    if (thread.joinable()) {
+        mutex.lock();
+        closing = true;
+        mutex.unlock();
+        ready.notify_one();
+        thread.join();
+    }
+
+    shm.reset();
+    if (owned && sock != NO_SOCKET)  close_socket(sock);
+#ifdef _WIN32
+    if (owned && fd >= 0)  failed = ::_close(fd) != 0 || failed;
+#else
+    if (owned && fd >= 0)  failed = ::close(fd) != 0 || failed;
+#endif
+    fd = -1;
+    sock = NO_SOCKET;
+    owned = false;
+    return !failed;
+}
+
+// Drop the oldest queued frame. The caller must hold the mutex.
+void FrameWriter::drop_oldest() {
+    head = (head + 1) % slots.size();
+    queued--;
+    dropped++;
+    ::count(thread_stats().dropped_frames);
+}
+
+/*
+ * Take every queued frame at once and write them, until the writer is
+ * closed and nothing is left. The frames are swapped into buffers of the
+ * writer's own, which then go back to the queue, so the queue is free
+ * for new frames while the writer waits for the output.
+ */
+void FrameWriter::write_frames() {
+    std::vector<Frame> batch(slots.size());
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        ready.wait(lock, [this] { return queued > 0 || closing; });
+        if (queued == 0)  break;
+
+        const std::size_t count = queued;
+        for (std::size_t i = 0; i < count; i++)  std::swap(batch[i], slots[(head + i) % slots.size()]);
+        head = (head + count) % slots.size();
+        queued = 0;
+        lock.unlock();
+        space.notify_one();
+
+        // After a failed write the frames are still taken, so that nothing waits for them
+        if (!failed) {
+            ThreadStats &stats = thread_stats();
+            const uint64_t start = stats_clock();
+            if (!write_batch(batch, count)) {
+                std::clog << "Could not write to the output, so no more frames are written" << std::endl;
+                failed = true;
+            }
+            const uint64_t written = stats_clock();
+            stats.stage(Stage::WRITE).record(written - start);
+            for (std::size_t i = 0; i < count; i++) {
+                if (batch[i].received_at != 0)  stats.stage(Stage::RECEIVE_TO_RELAY).record(written - batch[i].received_at);
+            }
+        }
+        lock.lock();
+    }
+}
+
+// Write the first count frames of the batch, however many calls it takes
+bool FrameWriter::write_batch(const std::vector<Frame> &batch, std::size_t count) {
+    if (shm) {
+        for (std::size_t i = 0; i < count; i++) {
+            if (!shm->publish(batch[i].data.data(), batch[i].data.size(), batch[i].keyframe))  return false;
+        }
+        return true;
+    }
+
+#ifdef _WIN32
+    for (std::size_t i = 0; i < count; i++) {
+        const char *data = batch[i].data.data();
+        std::size_t left = batch[i].data.size();
+        if (sock != NO_SOCKET) {
+            if (!send_all(sock, data, left))  return false;
+            continue;
+        }
+        while (left > 0) {
+            const int written = ::_write(fd, data, static_cast<unsigned>(std::min<std::size_t>(left, 1 << 30)));
+            if (written <= 0)  return false;
+            data += written;
+            left -= written;
+        }
+    }
+    return true;
+#else
+    std::size_t first = 0;  // The first frame that isn't all written
+    std::size_t offset = 0; // How much of it is written
+    while (first < count) {
+        iovec vectors[MAX_FRAMES_PER_WRITE];
+        int vector_count = 0;
+        for (std::size_t i = first; i < count && vector_count < MAX_FRAMES_PER_WRITE; i++) {
+            const std::size_t skip = i == first ? offset : 0;
+            vectors[vector_count].iov_base = const_cast<char *>(batch[i].data.data()) + skip;
+            vectors[vector_count].iov_len  = batch[i].data.size() - skip;
+            vector_count++;
+        }
+
+        ssize_t written;
+        if (sock != NO_SOCKET) {
+            // Like writev(), but a closed connection fails the call instead of raising SIGPIPE
+            msghdr message = {};
+            message.msg_iov = vectors;
+            message.msg_iovlen = vector_count;
+            written = ::sendmsg(sock, &message, MSG_NOSIGNAL);
+        } else {
+            written = ::writev(fd, vectors, vector_count);
+        }
+        if (written < 0) {
+            if (errno == EINTR)  continue;
+            return false;
+        }
+
+        std::size_t left = written;
+        while (first < count && left >= batch[first].data.size() - offset) {
+            left -= batch[first].data.size() - offset;
+            first++;
+            offset = 0;
+        }
+        offset += left;
+    }
+    return true;
+#endif
+}
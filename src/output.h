@@ -0,0 +1,107 @@
+#pragma once
+#include "shm.h"
+#include "transport.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// What a FrameWriter does with a new frame when the output has fallen so
+// far behind that its queue is full
+enum class SlowOutputPolicy {
+    BLOCK,       // Wait for the output to catch up, so that no frame is lost
+    DROP_OLDEST, // Drop the oldest queued frames
+    LATEST,      // Only ever queue the latest frame
+};
+
+/*
+ * Writes relay frames to stdout, a file, a pipe, a TCP connection or a
+ * shared-memory frame region on a thread of its own, so that a slow
+ * output never holds up the thread that serializes the frames. Frames are
+ * queued in a ring of buffers that are swapped with the caller's, so
+ * nothing is copied or allocated once the buffers have grown, and
+ * everything queued is written with one writev() call, or published in
+ * the region one frame after another.
+ *
+ * A delta frame is useless without the frames before it, so when frames
+ * are dropped, the deltas queued after them are dropped too. If a delta
+ * would then follow a dropped frame, it's refused and a keyframe is
+ * needed before any other delta is queued.
+ */
+class FrameWriter {
+public:
+    static const std::size_t DEFAULT_CAPACITY = 64;
+
+    FrameWriter() {}
+    ~FrameWriter();
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter &operator=(const FrameWriter&) = delete;
+
+    // Write to stdout if the target is empty, to a TCP connection if it's
+    // tcp:<ip>:<port>, to a shared-memory frame region if it's shm:<path>,
+    // and otherwise to the file or named pipe at the path, which is created
+    // or truncated
+    bool open(const std::string &target, std::string &error);
+
+    // Write to a descriptor that stays open after close(), e.g. one end of a pipe
+    void attach(int fd);
+
+    // Start the writer thread, with a queue of at most capacity frames
+    void start(SlowOutputPolicy policy, std::size_t capacity = DEFAULT_CAPACITY);
+
+    // Queue the frame, taking its bytes and leaving the caller another
+    // buffer to serialize the next frame into. The time its oldest change
+    // was received, from stats_clock(), is for timing how long it took to
+    // be written, unless it's 0. Returns false if it's a delta frame that
+    // can't be queued since frames before it were dropped, and the frame
+    // is then left as it was.
+    bool submit(std::string &frame, bool keyframe, uint64_t received_at = 0);
+
+    // Whether the next frame has to be a keyframe for submit() to take it
+    bool keyframe_needed() const { return need_keyframe.load(std::memory_order_relaxed); }
+
+    // Frames waiting to be written, not counting those being written
+    std::size_t queued_frames();
+
+    // Frames dropped since the writer was started
+    uint64_t dropped_frames();
+
+    // Write everything queued, stop the thread and close the output, once
+    // nothing more is submitted. Returns false if any write failed.
+    bool close();
+
+private:
+    struct Frame {
+        std::string data;
+        bool keyframe = false;
+        uint64_t received_at = 0;
+    };
+
+    int fd = -1;
+    socket_t sock = NO_SOCKET;
+    std::unique_ptr<ShmPublisher> shm;
+    bool owned = false; // Whether the output is closed by close()
+
+    std::mutex mutex;
+    std::condition_variable ready; // Notified when a frame is queued or the writer is closing
+    std::condition_variable space; // Notified when the writer takes the queued frames
+    std::vector<Frame> slots;
+    std::size_t head = 0;   // The oldest queued frame
+    std::size_t queued = 0;
+    std::size_t limit = 0;  // The most frames that may be queued
+    SlowOutputPolicy policy = SlowOutputPolicy::BLOCK;
+    uint64_t dropped = 0;
+    bool closing = false;
+    std::atomic<bool> need_keyframe{false};
+    std::atomic<bool> failed{false};
+    std::thread thread;
+
+    void drop_oldest();
+    void write_frames();
+    bool write_batch(const std::vector<Frame> &batch, std::size_t count);
+};
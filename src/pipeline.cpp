@@ -0,0 +1,357 @@
+#include "pipeline.h"
+#include "feed.h"
+#include "ring.h"
+#include "stats.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// The receive buffers of each parse worker, besides one per feed that
+// the receiver may hold while it waits for data
+const std::size_t BUFFERS_PER_WORKER = 32;
+
+// The batches of each parse worker, which is as many as can wait for the store owner
+const std::size_t BATCHES_PER_WORKER = 32;
+
+// The most batches the store owner adds to the global list with one lock,
+// so that the relay is never kept waiting for long
+const std::size_t MAX_BATCHES_PER_LOCK = 64;
+
+const uint32_t NO_BUFFER = UINT32_MAX;
+
+/*
+ * Wakes the one thread that waits on it. Waiting first spins for a while,
+ * since work usually comes quickly when there's a lot of it, and then
+ * sleeps. Ringing only takes the lock if the thread is asleep, so a busy
+ * pipeline passes work along without any locks or system calls.
+ */
+class IngestPipeline::Doorbell {
+public:
+    // Called after making the waiting thread's condition true
+    void ring() {
+        // Pairs with the fence in wait(): either the waiter sees the change,
+        // or this sees that the waiter has gone to sleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_relaxed)) {
+            mutex.lock();
+            mutex.unlock();
+            condition.notify_one();
+        }
+    }
+
+    // Block until ready() returns true
+    template <typename Ready>
+    void wait(Ready ready) {
+        for (int spin = 0; spin < 64; spin++) {
+            if (ready())  return;
+            std::this_thread::yield();
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        condition.wait(lock, ready);
+        sleeping.store(false, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<bool> sleeping{false};
+    std::mutex mutex;
+    std::condition_variable condition;
+};
+
+// Received bytes, or the end of a feed, on their way to a parse worker
+struct Chunk {
+    uint32_t feed;        // The number of the feed among the worker's feeds
+    uint32_t buffer;      // The worker's buffer that holds the bytes, if any
+    uint32_t length;
+    bool     closed;      // The feed has ended after these bytes
+    uint64_t received_at; // From stats_clock()
+};
+
+/*
+ * A parse worker, with the pools of buffers and batches that go round
+ * between it and the stages on either side of it.
+ */
+struct IngestPipeline::Worker {
+    explicit Worker(std::size_t feed_count)
+        : buffers((BUFFERS_PER_WORKER + feed_count) * RECEIVE_BUFFER_LENGTH),
+          chunks(BUFFERS_PER_WORKER + 2 * feed_count), free_buffers(BUFFERS_PER_WORKER + feed_count),
+          batches(BATCHES_PER_WORKER), full_batches(BATCHES_PER_WORKER), free_batches(BATCHES_PER_WORKER) {
+        // The rings are filled before the threads that use them start
+        for (uint32_t i = 0; i < BUFFERS_PER_WORKER + feed_count; i++)  free_buffers.push(i);
+        for (uint32_t i = 0; i < BATCHES_PER_WORKER; i++)  free_batches.push(i);
+    }
+
+    char *buffer(uint32_t index) { return buffers.data() + index * RECEIVE_BUFFER_LENGTH; }
+
+    struct Batch {
+        std::vector<Object> objects;
+        uint64_t received_at;
+    };
+
+    std::vector<char> buffers;
+    SpscRing<Chunk> chunks;          // From the receiver, which is woken by the worker's doorbell
+    SpscRing<uint32_t> free_buffers; // To the receiver
+    std::vector<Batch> batches;
+    SpscRing<uint32_t> full_batches; // To the store owner
+    SpscRing<uint32_t> free_batches; // From the store owner
+    std::vector<std::unique_ptr<FeedParser>> parsers; // One for each of the worker's feeds
+    Doorbell bell;                   // Rung when there's a chunk or a free batch for the worker
+    std::thread thread;
+    std::atomic<bool> done{false};   // Every batch has been passed on
+};
+
+/*
+ * Receives one feed into the buffers of its parse worker and passes them
+ * on, on the receiver thread.
+ */
+class IngestPipeline::ReceiveHandler : public StreamHandler {
+public:
+    ReceiveHandler(IngestPipeline &pipeline, const Endpoint &endpoint, uint32_t index)
+        : name(endpoint.ip + ":" + endpoint.port), pipeline(pipeline), index(index) {}
+
+    char *receive_buffer(std::size_t &length) override {
+        // Wait for the worker to return a buffer if it has fallen behind
+        while (buffer == NO_BUFFER && !worker->free_buffers.pop(buffer)) {
+            pipeline.receiver_bell->wait([this] { return !worker->free_buffers.empty(); });
+        }
+        length = RECEIVE_BUFFER_LENGTH;
+        receive_started = stats_clock();
+        return worker->buffer(buffer);
+    }
+
+    void received(std::size_t length) override {
+        const uint64_t received_at = stats_clock();
+        thread_stats().stage(Stage::RECEIVE).record(received_at - receive_started);
+        if (pipeline.capture)  pipeline.capture->record(index, worker->buffer(buffer), length);
+        pass_on(Chunk{feed, buffer, static_cast<uint32_t>(length), false, received_at});
+    }
+
+    void closed() override {
+        pass_on(Chunk{feed, buffer, 0, true, stats_clock()});
+    }
+
+    const std::string name; // The endpoint of the feed, for messages
+    Worker *worker = nullptr;
+    uint32_t feed = 0;      // The number of the feed among the worker's feeds
+
+private:
+    IngestPipeline &pipeline;
+    const uint32_t index;   // The number of the feed in the capture
+    uint32_t buffer = NO_BUFFER;
+    uint64_t receive_started = 0;
+
+    void pass_on(const Chunk &chunk) {
+        // There's room for every buffer and the end of every feed, so this
+        // doesn't fail, and the buffer now belongs to the worker
+        worker->chunks.push(chunk);
+        worker->bell.ring();
+        buffer = NO_BUFFER;
+    }
+};
+
+IngestPipeline::IngestPipeline(unsigned parse_threads, CaptureWriter *capture)
+    : parse_threads(std::max(1u, parse_threads)), capture(capture), loop(EventLoop::create()),
+      receiver_bell(new Doorbell()), store_bell(new Doorbell()) {}
+
+IngestPipeline::~IngestPipeline() {}
+
+bool IngestPipeline::add(socket_t sock, const Endpoint &endpoint) {
+    handlers.emplace_back(new ReceiveHandler(*this, endpoint, handlers.size()));
+    if (!loop->add(sock, handlers.back().get())) {
+        handlers.pop_back();
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Deal the feeds out to the parse workers and start the threads of every
+ * stage after the receiver.
+ */
+void IngestPipeline::start() {
+    // Never more workers than feeds, which are dealt out to them in turn
+    const std::size_t worker_count = std::max<std::size_t>(1, std::min<std::size_t>(parse_threads, handlers.size()));
+    for (std::size_t i = 0; i < worker_count; i++) {
+        const std::size_t feed_count = (handlers.size() + worker_count - 1 - i) / worker_count;
+        workers.emplace_back(new Worker(feed_count));
+    }
+    for (std::size_t i = 0; i < handlers.size(); i++) {
+        Worker &worker = *workers[i % worker_count];
+        handlers[i]->worker = &worker;
+        handlers[i]->feed   = worker.parsers.size();
+        worker.parsers.emplace_back(new FeedParser(handlers[i]->name));
+    }
+
+    receiving = true;
+    for (auto& worker : workers) {
+        worker->thread = std::thread(&IngestPipeline::parse, this, std::ref(*worker));
+    }
+    store_thread = std::thread(&IngestPipeline::store, this);
+}
+
+// Once every feed has closed, let the other stages finish what they have
+void IngestPipeline::finish() {
+    receiving.store(false, std::memory_order_release);
+    for (auto& worker : workers) {
+        worker->bell.ring();
+        worker->thread.join();
+    }
+    store_thread.join();
+}
+
+bool IngestPipeline::run() {
+    start();
+    // Receive on this thread until every feed has closed
+    const bool ok = loop->run();
+    finish();
+    return ok;
+}
+
+std::size_t IngestPipeline::replay(CaptureReader &capture, double speed) {
+    // Every feed needs its handler before the workers start
+    CaptureRecord record;
+    capture.rewind();
+    while (capture.next(record)) {
+        while (handlers.size() <= record.feed) {
+            const uint32_t index = handlers.size();
+            handlers.emplace_back(new ReceiveHandler(*this, Endpoint{"replay", std::to_string(index)}, index));
+        }
+    }
+    capture.rewind();
+    start();
+
+    const auto start_time = std::chrono::steady_clock::now();
+    std::size_t chunks = 0;
+    while (capture.next(record)) {
+        if (speed > 0) {
+            const auto due = start_time + std::chrono::nanoseconds(static_cast<int64_t>(record.time / speed));
+            std::this_thread::sleep_until(due);
+        }
+
+        // Hand the chunk over in pieces as large as the receive buffers
+        ReceiveHandler &handler = *handlers[record.feed];
+        for (std::size_t offset = 0; offset < record.length;) {
+            std::size_t length;
+            char *buffer = handler.receive_buffer(length);
+            length = std::min<std::size_t>(length, record.length - offset);
+            std::memcpy(buffer, record.data + offset, length);
+            handler.received(length);
+            offset += length;
+        }
+        chunks++;
+    }
+
+    for (auto& handler : handlers) {
+        handler->closed();
+    }
+    finish();
+    return chunks;
+}
+
+/*
+ * Parse the chunks of the worker's feeds as they come, until all of them
+ * have closed or there are no more, and pass the objects on in batches.
+ */
+void IngestPipeline::parse(Worker &worker) {
+    uint32_t batch = NO_BUFFER;
+    Chunk chunk;
+    std::size_t open_feeds = worker.parsers.size();
+    while (open_feeds > 0) {
+        if (!worker.chunks.pop(chunk)) {
+            // The receiver passes everything on before it stops receiving
+            if (!receiving.load(std::memory_order_acquire) && worker.chunks.empty())  break;
+            worker.bell.wait([&] { return !worker.chunks.empty() || !receiving.load(std::memory_order_acquire); });
+            continue;
+        }
+
+        FeedParser &parser = *worker.parsers[chunk.feed];
+        if (chunk.length > 0) {
+            while (batch == NO_BUFFER && !worker.free_batches.pop(batch)) {
+                worker.bell.wait([&] { return !worker.free_batches.empty(); });
+            }
+            std::memcpy(parser.prepare(chunk.length), worker.buffer(chunk.buffer), chunk.length);
+            parser.parse(chunk.length, worker.batches[batch].objects);
+        }
+
+        // The bytes have been copied to the feed's framer, so the buffer can be reused
+        if (chunk.buffer != NO_BUFFER) {
+            worker.free_buffers.push(chunk.buffer);
+            receiver_bell->ring();
+        }
+
+        if (batch != NO_BUFFER && !worker.batches[batch].objects.empty()) {
+            worker.batches[batch].received_at = chunk.received_at;
+            worker.full_batches.push(batch);
+            store_bell->ring();
+            batch = NO_BUFFER;
+        }
+        if (chunk.closed) {
+            parser.closed();
+            open_feeds--;
+        }
+    }
+
+    worker.done.store(true, std::memory_order_release);
+    store_bell->ring();
+}
+
+/*
+ * Add the batches of every worker to the global list as they come, until
+ * every worker is done, and give the batches back.
+ */
+void IngestPipeline::store() {
+    std::vector<ObjectBatch> round;
+    std::vector<std::pair<Worker *, uint32_t>> taken;
+    // A batch to add, or every worker done. One worker being done isn't
+    // enough, since the store owner would spin while the others still run.
+    const auto any_batch = [this] {
+        std::size_t done = 0;
+        for (const auto& worker : workers) {
+            if (!worker->full_batches.empty())  return true;
+            if (worker->done.load(std::memory_order_acquire))  done++;
+        }
+        return done == workers.size();
+    };
+
+    // The worker that's looked at first takes turns, so that none waits
+    // behind the others when there are more batches than one lock takes
+    std::size_t first = 0;
+    while (true) {
+        bool all_done = true;
+        for (std::size_t i = 0; i < workers.size(); i++) {
+            Worker *worker = workers[(first + i) % workers.size()].get();
+            // Checked first, since a worker that's done has passed on all its batches by then
+            const bool done = worker->done.load(std::memory_order_acquire);
+            uint32_t batch;
+            while (taken.size() < MAX_BATCHES_PER_LOCK && worker->full_batches.pop(batch)) {
+                const Worker::Batch &objects = worker->batches[batch];
+                round.push_back(ObjectBatch{objects.objects.data(), objects.objects.size(), objects.received_at});
+                taken.emplace_back(worker, batch);
+            }
+            all_done = all_done && done && worker->full_batches.empty();
+        }
+        first++;
+
+        if (round.empty()) {
+            if (all_done)  break;
+            store_bell->wait(any_batch);
+            continue;
+        }
+
+        const uint64_t start = stats_clock();
+        add_or_update_batches(round.data(), round.size());
+        thread_stats().stage(Stage::STORE).record(stats_clock() - start);
+        for (const auto& batch : taken) {
+            batch.first->free_batches.push(batch.second);
+            batch.first->bell.ring();
+        }
+        round.clear();
+        taken.clear();
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "capture.h"
+#include "client.h"
+#include "transport.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/*
+ * Receives from many feeds in stages, each on threads of its own, that
+ * hand their work to the next stage through lock-free SPSC rings:
+ *
+ *     receiver ---> parse workers ---> store owner
+ *
+ * The receiver thread only reads the sockets into buffers and passes them
+ * on. Each feed belongs to one parse worker, which frames, parses and
+ * colors its chunks in the order they were received, and passes the
+ * objects on in batches. The store owner is the only thread that adds
+ * objects to the global list, so it takes the lock for many batches at a
+ * time and no ingest thread ever waits for another one to release it.
+ * The objects of a feed reach the global list in the order they were
+ * received, so the updates of an ID from one feed are never reordered.
+ *
+ * Buffers and batches are taken from pools that the next stage returns
+ * them to, so nothing is allocated per chunk, and a stage that falls
+ * behind holds back the stages before it rather than letting them queue
+ * up memory. A thread that has nothing to do sleeps until it's woken by
+ * the stage before it.
+ */
+class IngestPipeline {
+public:
+    // Parse on at most this many threads. If there's a capture, every
+    // chunk is recorded there by the receiver.
+    IngestPipeline(unsigned parse_threads, CaptureWriter *capture = nullptr);
+    ~IngestPipeline();
+
+    // Receive from the connected socket, before run(). The feeds are
+    // numbered in the order they're added, for the capture.
+    bool add(socket_t sock, const Endpoint &endpoint);
+
+    // Receive from every feed until all of them have closed and everything
+    // received has been added to the global list. If an error occurs, it's
+    // printed to std::clog and false is returned.
+    bool run();
+
+    // Instead of receiving, hand the chunks of the capture to the receive
+    // stage from its first record on, with their captured timing scaled
+    // by the speed, or as fast as possible at a speed of 0. Each captured
+    // feed is a feed of its own. Returns once everything replayed has been
+    // added to the global list, with the number of chunks replayed.
+    std::size_t replay(CaptureReader &capture, double speed);
+
+private:
+    class Doorbell;
+    class ReceiveHandler;
+    struct Worker;
+
+    unsigned parse_threads;
+    CaptureWriter *capture;
+    std::unique_ptr<EventLoop> loop;
+    std::vector<std::unique_ptr<ReceiveHandler>> handlers;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::unique_ptr<Doorbell> receiver_bell; // Rung when a buffer is returned to the receiver
+    std::unique_ptr<Doorbell> store_bell;    // Rung when a batch is passed to the store owner
+    std::atomic<bool> receiving{false};
+    std::thread store_thread;
+
+    void start();
+    void finish();
+    void parse(Worker &worker);
+    void store();
+};
@@ -0,0 +1,68 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/*
+ * A bounded queue between exactly one producer thread and one consumer
+ * thread, without locks. The producer only writes the tail and the
+ * consumer only writes the head, each on a cache line of its own, and
+ * each side keeps a copy of the other's index so that it only reads the
+ * other's cache line when the copy says the ring is full or empty.
+ */
+template <typename T>
+class SpscRing {
+public:
+    // The capacity is rounded up to a power of two
+    explicit SpscRing(std::size_t capacity) {
+        std::size_t size = 1;
+        while (size < capacity)  size *= 2;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing &operator=(const SpscRing&) = delete;
+
+    std::size_t capacity() const { return slots.size(); }
+
+    // Called by the producer. Returns false if the ring is full.
+    bool push(const T &value) {
+        const std::size_t position = tail.load(std::memory_order_relaxed);
+        if (position - head_copy == slots.size()) {
+            head_copy = head.load(std::memory_order_acquire);
+            if (position - head_copy == slots.size())  return false;
+        }
+        slots[position & mask] = value;
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Called by the consumer. Returns false if the ring is empty.
+    bool pop(T &value) {
+        const std::size_t position = head.load(std::memory_order_relaxed);
+        if (position == tail_copy) {
+            tail_copy = tail.load(std::memory_order_acquire);
+            if (position == tail_copy)  return false;
+        }
+        value = slots[position & mask];
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // May be called by either side, but is only sure to stay true for the
+    // producer and to stay false for the consumer
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> slots;
+    std::size_t mask;
+
+    alignas(64) std::atomic<std::size_t> head{0}; // The next slot to pop
+    std::size_t tail_copy = 0;                    // The consumer's copy of the tail
+    alignas(64) std::atomic<std::size_t> tail{0}; // The next slot to push
+    std::size_t head_copy = 0;                    // The producer's copy of the head
+    char padding[64 - sizeof(std::size_t) * 2];   // Keeps the tail from sharing a line with what follows
+};
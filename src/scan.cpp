@@ -0,0 +1,121 @@
+#include "scan.h"
+
+/*
+ * Scan one byte at a time from start to the end of the data. This is
+ * the fallback for CPUs without SIMD and for the tails of the buffers
+ * that the SIMD implementations can't fill a whole register with.
+ */
+std::size_t scan_separators_from(const char *data, std::size_t start, std::size_t length,
+                                 uint32_t *offsets, std::size_t count) {
+    for (std::size_t i = start; i < length; i++) {
+        if (data[i] == '\n' || data[i] == ';')  offsets[count++] = i;
+    }
+    return count;
+}
+
+#ifdef SIMD_X86
+
+/*
+ * Append the offset of every set bit in the mask, where bit 0 corresponds to base.
+ */
+inline std::size_t append_mask_offsets(uint32_t mask, std::size_t base, uint32_t *offsets, std::size_t count) {
+    while (mask) {
+        offsets[count++] = base + __builtin_ctz(mask);
+        mask &= mask - 1; // Clear the lowest set bit
+    }
+    return count;
+}
+
+/*
+ * Compare 16 bytes at a time against both separators.
+ */
+__attribute__((target("sse2")))
+std::size_t scan_separators_sse2(const char *data, std::size_t length, uint32_t *offsets) {
+    const __m128i newlines   = _mm_set1_epi8('\n');
+    const __m128i semicolons = _mm_set1_epi8(';');
+
+    std::size_t count = 0;
+    std::size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        const __m128i hits  = _mm_or_si128(_mm_cmpeq_epi8(block, newlines), _mm_cmpeq_epi8(block, semicolons));
+        count = append_mask_offsets(_mm_movemask_epi8(hits), i, offsets, count);
+    }
+    return scan_separators_from(data, i, length, offsets, count);
+}
+
+/*
+ * Compare 32 bytes at a time against both separators.
+ */
+__attribute__((target("avx2")))
+std::size_t scan_separators_avx2(const char *data, std::size_t length, uint32_t *offsets) {
+    const __m256i newlines   = _mm256_set1_epi8('\n');
+    const __m256i semicolons = _mm256_set1_epi8(';');
+
+    std::size_t count = 0;
+    std::size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        const __m256i hits  = _mm256_or_si256(_mm256_cmpeq_epi8(block, newlines), _mm256_cmpeq_epi8(block, semicolons));
+        count = append_mask_offsets(_mm256_movemask_epi8(hits), i, offsets, count);
+    }
+    return scan_separators_from(data, i, length, offsets, count);
+}
+
+#endif
+
+std::size_t scan_separators(const char *data, std::size_t length, uint32_t *offsets, SimdLevel level) {
+    switch (level) {
+#ifdef SIMD_X86
+        case SimdLevel::SSE2: return scan_separators_sse2(data, length, offsets);
+        case SimdLevel::AVX2: return scan_separators_avx2(data, length, offsets);
+#endif
+        default:              return scan_separators_from(data, 0, length, offsets, 0);
+    }
+}
+
+std::size_t scan_separators(const char *data, std::size_t length, uint32_t *offsets) {
+    return scan_separators(data, length, offsets, best_simd_level());
+}
+
+std::size_t RecordScanner::parse(std::string_view buffer, std::vector<ParsedRecord> &records) {
+    records.clear();
+    if (offsets.size() < buffer.length())  offsets.resize(buffer.length());
+    const std::size_t offset_count = scan_separators(buffer.data(), buffer.length(), offsets.data());
+
+    std::size_t line_start  = 0; // Index of the start of the current line
+    std::size_t field_start = 0; // Index of the start of the current field
+    std::size_t field_count = 0; // Number of semicolons seen on the current line
+    std::string_view fields[4];
+
+    for (std::size_t i = 0; i < offset_count; i++) {
+        const std::size_t offset = offsets[i];
+
+        if (buffer[offset] == ';') {
+            if (field_count < 3)  fields[field_count] = buffer.substr(field_start, offset - field_start);
+            field_count++;
+            field_start = offset + 1; // Add one to skip the separator
+            continue;
+        }
+
+        // A newline ends the line, and a '\r' before it is not part of the line
+        std::size_t line_end = offset;
+        if (line_end > line_start && buffer[line_end-1] == '\r')  line_end--;
+
+        if (line_end > line_start) { // Skip empty lines, like the receive loop always has
+            ParsedRecord record;
+            record.line = buffer.substr(line_start, line_end - line_start);
+            if (field_count == 3) {
+                fields[3] = buffer.substr(field_start, line_end - field_start);
+                record.error = parse_fields(fields, record.object);
+            } else {
+                record.error = ParseError::FIELD_COUNT;
+            }
+            records.push_back(record);
+        }
+
+        line_start = field_start = offset + 1;
+        field_count = 0;
+    }
+    return line_start;
+}
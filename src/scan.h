@@ -0,0 +1,43 @@
+#pragma once
+#include "client.h"
+#include "simd.h"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+/*
+ * Find every '\n' and ';' in the data in one pass and write their offsets
+ * to offsets in ascending order. The number of offsets is returned, and
+ * offsets must have room for length entries. The fastest implementation
+ * the CPU supports is picked at runtime.
+ */
+std::size_t scan_separators(const char *data, std::size_t length, uint32_t *offsets);
+
+// Scan with the implementation for the given level, e.g. for testing
+std::size_t scan_separators(const char *data, std::size_t length, uint32_t *offsets, SimdLevel level);
+
+// The outcome of parsing one line of a batch
+struct ParsedRecord {
+    std::string_view line;
+    Object object;
+    ParseError error;
+};
+
+/*
+ * Parses batches of lines, e.g. everything that one large recv() call
+ * received. All separators in the batch are found with one call to
+ * scan_separators(), after which every line is already split into its
+ * fields and only the values are left to decode. The results are the
+ * same as calling parse_object() for every line.
+ */
+class RecordScanner {
+public:
+    // Parse every complete line in the buffer into records, skipping empty
+    // lines. The number of bytes up to and including the last newline is
+    // returned, i.e., where the first incomplete line starts.
+    std::size_t parse(std::string_view buffer, std::vector<ParsedRecord> &records);
+
+private:
+    std::vector<uint32_t> offsets; // Reused between batches to avoid allocations
+};
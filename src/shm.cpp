@@ -0,0 +1,234 @@
+#include "shm.h"
+#include <cstring>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The header takes a cache line of its own, and so does each slot's ShmSlot
+const std::size_t SHM_HEADER_LENGTH = 64;
+static_assert(sizeof(ShmHeader) <= SHM_HEADER_LENGTH, "the header must fit before the first slot");
+static_assert(sizeof(ShmSlot) == 64, "the bytes of a frame must start on a cache line");
+
+// The bytes from one slot to the next
+std::size_t slot_stride(uint64_t slot_length) {
+    return sizeof(ShmSlot) + (slot_length + 63) / 64 * 64;
+}
+
+std::size_t region_size(uint32_t slot_count, uint64_t slot_length) {
+    return SHM_HEADER_LENGTH + slot_count * slot_stride(slot_length);
+}
+
+// The slot that the frame with the number is published in
+ShmSlot *slot_of(char *region, uint64_t number) {
+    const ShmHeader &header = *reinterpret_cast<const ShmHeader *>(region);
+    const std::size_t offset = SHM_HEADER_LENGTH + number % header.slot_count * slot_stride(header.slot_length);
+    return reinterpret_cast<ShmSlot *>(region + offset);
+}
+
+/*
+ * Map the region at the path, if it's a whole one, and set size to its
+ * size. Returns nullptr if it isn't.
+ */
+char *map_region(const std::string &path, bool writable, std::size_t &size) {
+#ifdef _WIN32
+    return nullptr;
+#else
+    const int fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+    if (fd < 0)  return nullptr;
+    struct stat status;
+    char *region = nullptr;
+    if (fstat(fd, &status) == 0 && static_cast<std::size_t>(status.st_size) >= SHM_HEADER_LENGTH) {
+        size = status.st_size;
+        void *view = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        if (view != MAP_FAILED)  region = static_cast<char *>(view);
+    }
+    ::close(fd);
+
+    const ShmHeader *header = reinterpret_cast<const ShmHeader *>(region);
+    if (region != nullptr && (std::memcmp(header->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) != 0 || header->slot_count == 0
+                              || size < region_size(header->slot_count, header->slot_length))) {
+        munmap(region, size);
+        region = nullptr;
+    }
+    return region;
+#endif
+}
+
+void unmap_region(char *region, std::size_t size) {
+#ifndef _WIN32
+    if (region != nullptr)  munmap(region, size);
+#endif
+}
+
+ShmPublisher::~ShmPublisher() {
+    close();
+}
+
+bool ShmPublisher::create(const std::string &path, std::string &error) {
+    close();
+    this->path = path;
+    frames = 0;
+
+    // An earlier region is mapped so that it's retired when the new one replaces it
+    region = map_region(path, true, size);
+    return map_new(MIN_SLOT_LENGTH, error);
+}
+
+/*
+ * Make a new region with slots of the length and put it in place of the
+ * current one, if any, which is then retired. The new region is made
+ * under another name first, so that readers never find half of it.
+ */
+bool ShmPublisher::map_new(uint64_t slot_length, std::string &error) {
+#ifdef _WIN32
+    error = "shared memory outputs are only supported on POSIX systems";
+    return false;
+#else
+    const std::string temporary = path + ".new";
+    const int fd = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        error = "could not create " + temporary;
+        return false;
+    }
+    const std::size_t new_size = region_size(SHM_SLOTS, slot_length);
+    void *view = ftruncate(fd, new_size) == 0 ? mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (view == MAP_FAILED) {
+        unlink(temporary.c_str());
+        error = "could not map " + temporary;
+        return false;
+    }
+
+    // The file starts out zeroed, so only the constants need to be set
+    ShmHeader &header = *static_cast<ShmHeader *>(view);
+    std::memcpy(header.magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+    header.slot_count  = SHM_SLOTS;
+    header.slot_length = slot_length;
+    if (rename(temporary.c_str(), path.c_str()) != 0) {
+        munmap(view, new_size);
+        unlink(temporary.c_str());
+        error = "could not create " + path;
+        return false;
+    }
+
+    if (region != nullptr) {
+        reinterpret_cast<ShmHeader *>(region)->retired.store(1, std::memory_order_release);
+        munmap(region, size);
+    }
+    region = static_cast<char *>(view);
+    size = new_size;
+    return true;
+#endif
+}
+
+bool ShmPublisher::publish(const char *data, std::size_t length, bool keyframe) {
+    if (region == nullptr)  return false;
+    ShmHeader &header = *reinterpret_cast<ShmHeader *>(region);
+    if (length > header.slot_length) {
+        uint64_t slot_length = header.slot_length * 2;
+        while (slot_length < length)  slot_length *= 2;
+        std::string error;
+        if (!map_new(slot_length, error))  return false;
+    }
+
+    const uint64_t number = frames + 1;
+    ShmSlot &slot = *slot_of(region, number);
+    const uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+
+    // Readers that see the odd counter, or the new bytes, know the slot is being written
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.frame.store(number, std::memory_order_relaxed);
+    slot.length.store(length, std::memory_order_relaxed);
+    slot.keyframe.store(keyframe, std::memory_order_relaxed);
+    std::memcpy(reinterpret_cast<char *>(&slot + 1), data, length);
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+
+    reinterpret_cast<ShmHeader *>(region)->latest.store(number, std::memory_order_release);
+    frames = number;
+    return true;
+}
+
+void ShmPublisher::close() {
+    unmap_region(region, size);
+    region = nullptr;
+    size = 0;
+}
+
+ShmReader::~ShmReader() {
+    close();
+}
+
+bool ShmReader::open(const std::string &path, std::string &error) {
+    close();
+    this->path = path;
+    region = map_region(path, false, size);
+    if (region == nullptr) {
+        error = "could not map a frame region at " + path;
+        return false;
+    }
+    mapped++;
+    return true;
+}
+
+uint64_t ShmReader::latest() {
+    if (!reopen_if_retired())  return 0;
+    return header().latest.load(std::memory_order_acquire);
+}
+
+bool ShmReader::read(ShmFrame &frame, uint64_t number) {
+    if (!reopen_if_retired())  return false;
+    const uint64_t latest = header().latest.load(std::memory_order_acquire);
+    if (number == 0)  number = latest;
+    if (number == 0 || number > latest)  return false;
+
+    const ShmSlot *slot = slot_of(region, number);
+    const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+    const uint64_t length = slot->length.load(std::memory_order_relaxed);
+    if (sequence % 2 != 0 || slot->frame.load(std::memory_order_relaxed) != number || length > header().slot_length) {
+        return false;
+    }
+
+    frame.data     = reinterpret_cast<const char *>(slot + 1);
+    frame.length   = length;
+    frame.number   = number;
+    frame.keyframe = slot->keyframe.load(std::memory_order_relaxed) != 0;
+    frame.slot     = slot;
+    frame.sequence = sequence;
+    return still_valid(frame);
+}
+
+bool ShmReader::still_valid(const ShmFrame &frame) const {
+    // Keeps the reads of the frame from moving past the check
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return frame.slot != nullptr && frame.slot->sequence.load(std::memory_order_relaxed) == frame.sequence;
+}
+
+bool ShmReader::copy(std::string &data, ShmFrame &frame, uint64_t number) {
+    if (!read(frame, number))  return false;
+    data.assign(frame.data, frame.length);
+    return still_valid(frame);
+}
+
+void ShmReader::close() {
+    unmap_region(region, size);
+    region = nullptr;
+    size = 0;
+}
+
+/*
+ * Map the path again if the publisher has replaced the region, or if
+ * there was none when it was last tried. Returns false if there's no
+ * region to read from.
+ */
+bool ShmReader::reopen_if_retired() {
+    if (region != nullptr && header().retired.load(std::memory_order_acquire) == 0)  return true;
+    unmap_region(region, size);
+    region = map_region(path, false, size);
+    if (region == nullptr)  return false;
+    mapped++;
+    return true;
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+ * A shared-memory frame region is a file, e.g. in /dev/shm, that one
+ * process publishes relay frames in and any number of processes on the
+ * same host map and read them from in place, without a pipe in between
+ * and without ever holding up the publisher.
+ *
+ * It starts with a ShmHeader, which is followed by SHM_SLOTS slots of
+ * equal size. Each slot is a ShmSlot followed by the bytes of a frame.
+ * Frame n is published in slot n % SHM_SLOTS, so the latest frame stays
+ * readable until that many more are published. Each slot is guarded by a
+ * sequence counter, which is odd while the publisher writes the slot:
+ * a reader notes the counter, reads the slot, and checks that the counter
+ * is still the same before it trusts what it read. The integers are in
+ * the byte order of the machine.
+ *
+ * When a frame doesn't fit in a slot, the publisher replaces the region
+ * with one with larger slots under the same path, and marks the old one
+ * retired, which tells readers to map the path again.
+ */
+const char SHM_MAGIC[8] = {'R', 'E', 'L', 'A', 'Y', 'S', 'H', 'M'};
+const uint32_t SHM_SLOTS = 8;
+
+struct ShmHeader {
+    char magic[8];
+    uint32_t slot_count;
+    uint32_t reserved;
+    uint64_t slot_length;          // The most bytes of a frame that a slot holds
+    std::atomic<uint64_t> latest;  // The number of the latest frame, from 1, or 0 before the first
+    std::atomic<uint32_t> retired; // Not 0 once the region has been replaced
+};
+
+struct alignas(64) ShmSlot {
+    std::atomic<uint64_t> sequence; // Odd while the slot is being written
+    std::atomic<uint64_t> frame;    // The number of the frame in the slot
+    std::atomic<uint64_t> length;
+    std::atomic<uint32_t> keyframe;
+};
+
+/*
+ * Publishes frames in a shared-memory frame region. Only one thread may
+ * publish at a time.
+ */
+class ShmPublisher {
+public:
+    static const uint64_t MIN_SLOT_LENGTH = 1 << 20;
+
+    ShmPublisher() {}
+    ~ShmPublisher();
+    ShmPublisher(const ShmPublisher&) = delete;
+    ShmPublisher &operator=(const ShmPublisher&) = delete;
+
+    // Create the region at the path. A region already there is retired,
+    // so that readers left on it from an earlier run move to the new one.
+    bool create(const std::string &path, std::string &error);
+
+    // Copy the frame into the next slot and make it the latest. Returns
+    // false if the region couldn't be made large enough for it.
+    bool publish(const char *data, std::size_t length, bool keyframe);
+
+    // Unmap the region. The file is left for readers to finish with.
+    void close();
+
+private:
+    std::string path;
+    char *region = nullptr;
+    std::size_t size = 0;
+    uint64_t frames = 0; // The number of the latest frame
+
+    bool map_new(uint64_t slot_length, std::string &error);
+};
+
+// A frame in a mapped region, as ShmReader hands it out
+struct ShmFrame {
+    const char *data = nullptr;
+    std::size_t length = 0;
+    uint64_t number = 0;
+    bool keyframe = false;
+    const ShmSlot *slot = nullptr;
+    uint64_t sequence = 0; // The slot's sequence counter when the frame was read
+};
+
+/*
+ * Reads frames from a shared-memory frame region that another process
+ * publishes in. Frames are read in place, so the publisher may overwrite
+ * one while it's read: whatever is taken from its bytes must be thrown
+ * away unless still_valid() says afterwards that it wasn't. A copy can be
+ * taken with copy() instead, which checks that for itself. A frame may
+ * only be used until the reader is called again, since the region is
+ * mapped again when the publisher has replaced it.
+ */
+class ShmReader {
+public:
+    ShmReader() {}
+    ~ShmReader();
+    ShmReader(const ShmReader&) = delete;
+    ShmReader &operator=(const ShmReader&) = delete;
+
+    bool open(const std::string &path, std::string &error);
+
+    // The number of the latest frame, or 0 if nothing has been published
+    uint64_t latest();
+
+    // Get the latest frame, or the frame with the number if it's not 0.
+    // Returns false if there's no such frame, or if it has been overwritten
+    // by a newer one.
+    bool read(ShmFrame &frame, uint64_t number = 0);
+
+    // Whether the frame wasn't overwritten before this was called
+    bool still_valid(const ShmFrame &frame) const;
+
+    // Copy the frame into data, as read() finds it, and only if it wasn't
+    // overwritten while being copied
+    bool copy(std::string &data, ShmFrame &frame, uint64_t number = 0);
+
+    // Unmap the region. Frames read from it may no longer be used.
+    void close();
+
+    // How many times a region has been mapped, which goes up when the
+    // reader follows the publisher to a new one. Frame numbers may then
+    // start over, and frames before the new region's first aren't in it.
+    uint64_t mappings() const { return mapped; }
+
+private:
+    std::string path;
+    char *region = nullptr;
+    std::size_t size = 0;
+    uint64_t mapped = 0;
+
+    const ShmHeader &header() const { return *reinterpret_cast<const ShmHeader *>(region); }
+    bool reopen_if_retired();
+};
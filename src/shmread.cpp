@@ -0,0 +1,125 @@
+#include "shm.h"
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+
+struct ReadOptions {
+    std::string path;
+    uint64_t frames = 0; // Stop after reading this many frames, or 0 for never
+    bool every = false;  // Read every frame in order rather than only the latest
+    bool dump = false;   // Write the frames read to stdout
+};
+
+template <typename T>
+bool parse_number(const std::string &text, T &value) {
+    const char *last = text.c_str() + text.length();
+    const auto result = std::from_chars(text.c_str(), last, value);
+    return result.ec == std::errc() && result.ptr == last;
+}
+
+/*
+ * Reads the relay frames that the client publishes with
+ * --output=shm:<path>, as a consumer on the same host would, and prints
+ * how many it read each second. Frames are read in place and only
+ * counted if they weren't overwritten while they were read. Options:
+ *
+ *     --frames=<n>  Stop after reading this many frames (default: never)
+ *     --every       Read every frame in order, counting those overwritten before they
+ *                   were reached as missed, rather than only the latest (default)
+ *     --dump        Write the frames read to stdout, and the counts to std::clog
+ */
+int main(int argc, char *argv[]) {
+    ReadOptions options;
+    for (int arg = 1; arg < argc; arg++) {
+        const std::string option = argv[arg];
+        bool ok = true;
+        if (option.rfind("--frames=", 0) == 0) {
+            ok = parse_number(option.substr(9), options.frames);
+        } else if (option == "--every") {
+            options.every = true;
+        } else if (option == "--dump") {
+            options.dump = true;
+        } else if (option.rfind("--", 0) != 0 && options.path.empty()) {
+            options.path = option;
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            std::clog << "Bad option " << option << std::endl;
+            options.path.clear();
+            break;
+        }
+    }
+    if (options.path.empty()) {
+        std::clog << "Usage: " << argv[0] << " [--frames=<n>] [--every] [--dump] <path>" << std::endl;
+        return 1;
+    }
+    std::ostream &report = options.dump ? std::clog : std::cout;
+
+    // The client may not have published anything yet
+    ShmReader reader;
+    std::string error;
+    while (!reader.open(options.path, error)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    uint64_t read = 0;    // Frames read whole
+    uint64_t missed = 0;  // Frames overwritten before they were read, with --every
+    uint64_t retries = 0; // Reads that were overwritten while they were read
+    uint64_t bytes = 0;
+    uint64_t last = options.every ? reader.latest() : 0; // The number of the last frame read
+    uint64_t mappings = reader.mappings();
+    auto report_due = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    ShmFrame frame;
+    std::string copy; // Frames to dump are copied, so that no torn frame is written
+
+    while (options.frames == 0 || read < options.frames) {
+        const uint64_t latest = reader.latest();
+        if (reader.mappings() != mappings) {
+            // The publisher replaced the region, which only holds the frames
+            // published since, so carry on from its latest
+            mappings = reader.mappings();
+            const uint64_t head = latest > 0 ? latest - 1 : 0;
+            if (options.every && head > last)  missed += head - last;
+            last = head;
+        }
+        if (latest <= last) {
+            // Nothing new, so give the publisher the core
+            std::this_thread::yield();
+        } else {
+            const uint64_t number = options.every ? last + 1 : latest;
+            if (options.dump ? reader.copy(copy, frame, number) : reader.read(frame, number)) {
+                // Otherwise the frame is used where it lies, and only counted
+                // if it turns out that it wasn't overwritten meanwhile
+                if (reader.still_valid(frame)) {
+                    if (options.dump)  std::cout.write(copy.data(), copy.length());
+                    read++;
+                    bytes += frame.length;
+                    last = number;
+                } else {
+                    retries++;
+                }
+            } else if (options.every && latest - last > SHM_SLOTS) {
+                // The frame has been overwritten, so skip to the oldest that's left
+                missed += latest - SHM_SLOTS + 1 - (last + 1);
+                last = latest - SHM_SLOTS;
+            } else {
+                retries++;
+            }
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= report_due) {
+            report << "Read " << read << " frames, " << bytes << " bytes, latest " << last;
+            report << ", " << missed << " missed, " << retries << " retries" << std::endl;
+            report_due = now + std::chrono::seconds(1);
+        }
+    }
+    report << "Read " << read << " frames, " << bytes << " bytes, latest " << last;
+    report << ", " << missed << " missed, " << retries << " retries" << std::endl;
+    return 0;
+}
@@ -0,0 +1,20 @@
+#include "simd.h"
+
+bool simd_supports(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::SCALAR: return true;
+#ifdef SIMD_X86
+        case SimdLevel::SSE2:   return __builtin_cpu_supports("sse2");
+        case SimdLevel::AVX2:   return __builtin_cpu_supports("avx2");
+#endif
+        default:                return false;
+    }
+}
+
+SimdLevel best_simd_level() {
+    // Check the CPU once, the first time we're called
+    static const SimdLevel level = simd_supports(SimdLevel::AVX2) ? SimdLevel::AVX2
+                                 : simd_supports(SimdLevel::SSE2) ? SimdLevel::SSE2
+                                 : SimdLevel::SCALAR;
+    return level;
+}
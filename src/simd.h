@@ -0,0 +1,16 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#endif
+
+// The instruction sets that the SIMD kernels have implementations for.
+// The SIMD ones are only available on x86, and an implementation may
+// only be called if simd_supports() says that the CPU supports it.
+enum class SimdLevel { SCALAR, SSE2, AVX2 };
+
+bool simd_supports(SimdLevel level);
+
+// The best level the CPU supports, which the kernels use by default
+SimdLevel best_simd_level();
@@ -0,0 +1,65 @@
+#include "snapshot.h"
+
+void ObjectChanges::update(const Object &object) {
+    updated.upsert(object);
+}
+
+/*
+ * Record that the object was removed. An earlier update of it is moot,
+ * and any later update adds it again, so updates stay after removals.
+ */
+void ObjectChanges::remove(int64_t id) {
+    updated.erase(id);
+    removed.push_back(id);
+}
+
+/*
+ * Record that the list was cleared, which makes all earlier updates moot.
+ */
+void ObjectChanges::clear_all() {
+    cleared = true;
+    removed.clear();
+    updated.clear();
+}
+
+/*
+ * Forget all changes, e.g. after they have been applied.
+ */
+void ObjectChanges::reset() {
+    cleared = false;
+    removed.clear();
+    if (!updated.empty())  updated.clear();
+}
+
+void ObjectSnapshot::apply(const ObjectChanges &changes) {
+    last_cleared = changes.cleared;
+    last_changed.clear();
+    last_removed.clear();
+    if (changes.cleared)  snapshot.clear();
+
+    // Objects that the snapshot never had, e.g. ones added and removed
+    // between two relays, aren't reported
+    for (const int64_t id : changes.removed) {
+        if (snapshot.erase(id))  last_removed.push_back(id);
+    }
+
+    // New objects are appended in the order they were added to the list,
+    // so the copy keeps the same order as the list, except that removals
+    // may move objects differently in the two
+    for (const auto &object : changes.updated) {
+        const std::size_t index = snapshot.find(object.id);
+        if (index != ObjectStore::NOT_FOUND && identical(snapshot[index], object))  continue;
+
+        snapshot.upsert(object);
+        last_changed.push_back(object);
+    }
+
+    // An object that was removed and added again was only changed
+    if (!last_removed.empty() && !last_changed.empty()) {
+        std::size_t kept = 0;
+        for (const int64_t id : last_removed) {
+            if (snapshot.find(id) == ObjectStore::NOT_FOUND)  last_removed[kept++] = id;
+        }
+        last_removed.resize(kept);
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "store.h"
+#include <vector>
+
+/*
+ * The changes made to the object list since they were last taken by
+ * the relay. Only the latest version of each object is kept, so the
+ * size is bounded by the number of objects rather than by the number
+ * of updates between two relays.
+ */
+struct ObjectChanges {
+    bool cleared = false;         // The list was cleared before the changes below
+    std::vector<int64_t> removed; // IDs of removed objects, before the updates below
+    ObjectStore updated;          // Added or updated objects, in the order they were first changed
+
+    void update(const Object &object);
+    void remove(int64_t id);
+    void clear_all();
+    void reset();
+};
+
+/*
+ * The relay's own copy of the object list, which is brought up to date by
+ * applying the changes taken from the thread that receives objects. Since
+ * the copy is only touched by the relay, it can be read and printed for
+ * as long as it takes without blocking the receiving thread, and it always
+ * matches the list as it was at the moment the changes were taken.
+ *
+ * The snapshot also remembers what the last applied changes did, so that
+ * the relay can print only what changed since the last relay.
+ */
+class ObjectSnapshot {
+public:
+    void apply(const ObjectChanges &changes);
+    const ObjectStore &objects() const { return snapshot; }
+
+    // Whether the last applied changes started by clearing the list
+    bool cleared() const { return last_cleared; }
+
+    // The objects that the last applied changes added or changed. Objects
+    // that were updated with the same members they already had are not
+    // included, e.g. those that haven't moved.
+    const std::vector<Object> &changed() const { return last_changed; }
+
+    // The IDs of the objects that the last applied changes removed. An
+    // object that was removed and then added again is only in changed().
+    const std::vector<int64_t> &removed() const { return last_removed; }
+
+private:
+    ObjectStore snapshot;
+    bool last_cleared = false;
+    std::vector<Object> last_changed;
+    std::vector<int64_t> last_removed;
+};
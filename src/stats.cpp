@@ -0,0 +1,151 @@
+#include "stats.h"
+#include <iomanip>
+#include <memory>
+#include <vector>
+
+unsigned LatencyHistogram::bucket(uint64_t value) {
+    if (value < SUB_BUCKETS)  return value;
+    const unsigned top_bit = 63 - __builtin_clzll(value);
+    const unsigned sub_bucket = (value >> (top_bit - SUB_BITS)) & (SUB_BUCKETS - 1);
+    return (top_bit - SUB_BITS + 1) * SUB_BUCKETS + sub_bucket;
+}
+
+uint64_t LatencyHistogram::bucket_floor(unsigned bucket) {
+    if (bucket < SUB_BUCKETS)  return bucket;
+    const unsigned top_bit = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    return uint64_t(SUB_BUCKETS + bucket % SUB_BUCKETS) << (top_bit - SUB_BITS);
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    ::count(counts[bucket(value)]);
+    ::count(total);
+    if (value > maximum.load(std::memory_order_relaxed))  maximum.store(value, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::add_to(LatencyHistogram &sum) const {
+    for (unsigned i = 0; i < BUCKETS; i++) {
+        const uint64_t bucket_count = counts[i].load(std::memory_order_relaxed);
+        if (bucket_count > 0)  ::count(sum.counts[i], bucket_count);
+    }
+    ::count(sum.total, count());
+    if (max() > sum.max())  sum.maximum.store(max(), std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(double share) const {
+    // The total may be ahead of the buckets while another thread records,
+    // so the buckets are added up and the total isn't used
+    uint64_t bucket_total = 0;
+    for (unsigned i = 0; i < BUCKETS; i++)  bucket_total += counts[i].load(std::memory_order_relaxed);
+    if (bucket_total == 0)  return 0;
+
+    const uint64_t rank = std::max<uint64_t>(1, share * bucket_total + 0.5);
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < BUCKETS; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            const uint64_t ceiling = i + 1 < BUCKETS ? bucket_floor(i + 1) - 1 : UINT64_MAX;
+            return std::min(ceiling, max());
+        }
+    }
+    return max();
+}
+
+const char *stage_name(Stage stage) {
+    switch (stage) {
+        case Stage::RECEIVE:          return "receive";
+        case Stage::PARSE:            return "parse";
+        case Stage::COLOR:            return "color";
+        case Stage::STORE:            return "store";
+        case Stage::SNAPSHOT:         return "snapshot";
+        case Stage::SERIALIZE:        return "serialize";
+        case Stage::WRITE:            return "write";
+        case Stage::RECEIVE_TO_RELAY: return "receive to relay";
+    }
+    return "unknown";
+}
+
+// The stats of every thread that has recorded any. They're kept after
+// their threads exit so that nothing they counted is lost.
+std::mutex registered_mutex;
+std::vector<std::unique_ptr<ThreadStats>> registered_stats;
+
+ThreadStats &thread_stats() {
+    thread_local ThreadStats *stats = nullptr;
+    if (stats == nullptr) {
+        registered_mutex.lock();
+        registered_stats.emplace_back(new ThreadStats());
+        stats = registered_stats.back().get();
+        registered_mutex.unlock();
+    }
+    return *stats;
+}
+
+void collect_stats(ThreadStats &total) {
+    registered_mutex.lock();
+    for (const auto& stats : registered_stats) {
+        count(total.bytes,   stats->bytes);
+        count(total.lines,   stats->lines);
+        count(total.inserts, stats->inserts);
+        count(total.updates, stats->updates);
+        count(total.relays,  stats->relays);
+        count(total.dropped_frames, stats->dropped_frames);
+        for (std::size_t i = 0; i < PARSE_ERROR_COUNT; i++)  count(total.parse_errors[i], stats->parse_errors[i]);
+        for (std::size_t i = 0; i < STAGE_COUNT; i++)  stats->stages[i].add_to(total.stages[i]);
+    }
+    registered_mutex.unlock();
+}
+
+void print_stats(std::ostream &os, const ThreadStats &total) {
+    os << "Stats: " << total.bytes << " bytes, " << total.lines << " lines, " << total.inserts << " inserts, ";
+    os << total.updates << " updates, " << total.relays << " relays";
+    if (total.dropped_frames > 0)  os << ", " << total.dropped_frames << " dropped frames";
+    os << std::endl;
+    for (std::size_t i = 1; i < PARSE_ERROR_COUNT; i++) {
+        if (total.parse_errors[i] == 0)  continue;
+        os << "  " << total.parse_errors[i] << " parse errors: " << parse_error_string(static_cast<ParseError>(i)) << std::endl;
+    }
+
+    os << "  " << std::left << std::setw(18) << "stage (us)" << std::right << std::setw(12) << "count";
+    for (const char *column : {"p50", "p90", "p99", "max"})  os << std::setw(12) << column;
+    os << std::endl;
+    os << std::fixed << std::setprecision(1);
+    for (std::size_t i = 0; i < STAGE_COUNT; i++) {
+        const LatencyHistogram &histogram = total.stages[i];
+        if (histogram.count() == 0)  continue;
+        os << "  " << std::left << std::setw(18) << stage_name(static_cast<Stage>(i)) << std::right;
+        os << std::setw(12) << histogram.count();
+        for (const double share : {0.5, 0.9, 0.99})  os << std::setw(12) << histogram.percentile(share) / 1000.0;
+        os << std::setw(12) << histogram.max() / 1000.0 << std::endl;
+    }
+    os << std::defaultfloat;
+}
+
+StatsReporter::~StatsReporter() {
+    stop();
+}
+
+void StatsReporter::start(std::ostream &os, std::chrono::milliseconds interval) {
+    if (interval.count() == 0)  return;
+    stopped = false;
+    thread = std::thread(&StatsReporter::report, this, std::ref(os), interval);
+}
+
+void StatsReporter::stop() {
+    if (!thread.joinable())  return;
+    mutex.lock();
+    stopped = true;
+    mutex.unlock();
+    condition.notify_one();
+    thread.join();
+}
+
+void StatsReporter::report(std::ostream &os, std::chrono::milliseconds interval) {
+    std::unique_lock<std::mutex> lock(mutex);
+    bool last = false;
+    while (!last) {
+        last = condition.wait_for(lock, interval, [this] { return stopped; });
+        ThreadStats total;
+        collect_stats(total);
+        print_stats(os, total);
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include "client.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+/*
+ * Counts how many values fall in each bucket, where the buckets are
+ * log-linear: every power of two is split into SUB_BUCKETS equally wide
+ * buckets, so any value is placed within 1/SUB_BUCKETS of itself, from
+ * nanoseconds to years, with a fixed number of buckets.
+ *
+ * Only one thread may record values, but any thread may read them at the
+ * same time. Recording is then a plain load and store with no lock or
+ * locked instruction.
+ */
+class LatencyHistogram {
+public:
+    static const unsigned SUB_BITS    = 3;
+    static const unsigned SUB_BUCKETS = 1 << SUB_BITS;
+    static const unsigned BUCKETS     = (65 - SUB_BITS) * SUB_BUCKETS;
+
+    // The bucket of the value, and the smallest value in the bucket
+    static unsigned bucket(uint64_t value);
+    static uint64_t bucket_floor(unsigned bucket);
+
+    void record(uint64_t value);
+
+    // Add the counts to another histogram, which only this thread records to
+    void add_to(LatencyHistogram &total) const;
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t max() const { return maximum.load(std::memory_order_relaxed); }
+
+    // The largest value in the bucket where the share of the values (0-1) is
+    // reached, so the true percentile is at most that, or 0 if there are no values
+    uint64_t percentile(double share) const;
+
+private:
+    std::atomic<uint64_t> counts[BUCKETS] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> maximum{0};
+};
+
+// The stages of the client that are timed, in nanoseconds
+enum class Stage {
+    RECEIVE,          // recv() calls that returned data
+    PARSE,            // Finding and parsing the lines of a received chunk
+    COLOR,            // Coloring the objects of a chunk
+    STORE,            // Adding the objects of a chunk to the global list
+    SNAPSHOT,         // Bringing the relay's copy of the list up to date
+    SERIALIZE,        // Serializing a frame
+    WRITE,            // Writing frames to the output
+    RECEIVE_TO_RELAY, // From receiving the oldest change of a relay until it was written
+};
+const std::size_t STAGE_COUNT = 8;
+const char *stage_name(Stage stage);
+
+// One for every ParseError, including NONE
+const std::size_t PARSE_ERROR_COUNT = 9;
+
+/*
+ * The counters and timings of one thread. Each thread records to its own,
+ * from thread_stats(), so recording never takes a lock, and the stats of
+ * all threads are added up when they're read.
+ */
+struct ThreadStats {
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> lines{0};
+    std::atomic<uint64_t> inserts{0};  // Objects that weren't in the global list
+    std::atomic<uint64_t> updates{0};  // Objects that replaced one with the same ID
+    std::atomic<uint64_t> relays{0};
+    std::atomic<uint64_t> dropped_frames{0}; // Relay frames dropped since the output was too slow
+    std::atomic<uint64_t> parse_errors[PARSE_ERROR_COUNT] = {};
+    LatencyHistogram stages[STAGE_COUNT];
+
+    LatencyHistogram &stage(Stage stage) { return stages[static_cast<std::size_t>(stage)]; }
+    const LatencyHistogram &stage(Stage stage) const { return stages[static_cast<std::size_t>(stage)]; }
+};
+
+// Add to a counter that only this thread writes to, without a locked instruction
+inline void count(std::atomic<uint64_t> &counter, uint64_t amount = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+// Nanoseconds on the steady clock, for timing stages
+inline uint64_t stats_clock() {
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+// The stats of the calling thread. The first call on a thread registers them.
+ThreadStats &thread_stats();
+
+// Add up the stats of every thread that has recorded any, into total
+void collect_stats(ThreadStats &total);
+
+// Print the counters and the percentiles of every stage that has been timed
+void print_stats(std::ostream &os, const ThreadStats &total);
+
+/*
+ * Prints the stats of all threads at an interval on a thread of its own,
+ * and once more when stopped.
+ */
+class StatsReporter {
+public:
+    StatsReporter() {}
+    ~StatsReporter();
+
+    // Start printing to the stream, unless the interval is 0
+    void start(std::ostream &os, std::chrono::milliseconds interval);
+    void stop();
+
+private:
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::thread thread;
+    bool stopped = false;
+
+    void report(std::ostream &os, std::chrono::milliseconds interval);
+};
@@ -0,0 +1,115 @@
+#include "store.h"
+
+// The number of slots an empty store starts with
+const std::size_t INITIAL_SLOT_COUNT = 16;
+
+ObjectStore::ObjectStore() {
+    rehash(INITIAL_SLOT_COUNT);
+}
+
+/*
+ * The slot where the search for the ID starts. IDs tend to share their
+ * low bits, e.g. when they are timestamps, so they are mixed with a
+ * multiplicative (Fibonacci) hash and the high bits of the product are used.
+ */
+std::size_t ObjectStore::home_slot(int64_t id) const {
+    return (static_cast<uint64_t>(id) * 0x9E3779B97F4A7C15ull) >> shift;
+}
+
+/*
+ * The slot that holds the ID, or the empty slot where it would be added.
+ */
+std::size_t ObjectStore::find_slot(int64_t id) const {
+    const std::size_t mask = slots.size() - 1;
+    std::size_t slot = home_slot(id);
+    while (slots[slot].index != EMPTY && slots[slot].id != id) {
+        slot = (slot + 1) & mask; // Linear probing
+    }
+    return slot;
+}
+
+std::size_t ObjectStore::find(int64_t id) const {
+    const Slot &slot = slots[find_slot(id)];
+    return slot.index == EMPTY ? NOT_FOUND : slot.index;
+}
+
+bool ObjectStore::upsert(const Object &object) {
+    std::size_t slot = find_slot(object.id);
+    if (slots[slot].index != EMPTY) {
+        records[slots[slot].index] = object; // Update object
+        return false;
+    }
+
+    // Keep the index at most half full so that probe sequences stay short
+    if ((records.size() + 1) * 2 > slots.size()) {
+        rehash(slots.size() * 2);
+        slot = find_slot(object.id);
+    }
+
+    slots[slot].id    = object.id;
+    slots[slot].index = records.size();
+    records.push_back(object); // Add object
+    return true;
+}
+
+bool ObjectStore::erase(int64_t id) {
+    const std::size_t mask = slots.size() - 1;
+    std::size_t slot = find_slot(id);
+    const std::size_t index = slots[slot].index;
+    if (index == EMPTY)  return false;
+
+    // Fill the hole in the dense array with the last object
+    const std::size_t last = records.size() - 1;
+    if (index != last) {
+        records[index] = records[last];
+        slots[find_slot(records[index].id)].index = index;
+    }
+    records.pop_back();
+
+    // Shift the following entries of the probe sequence back into the
+    // freed slot when it's on their way from their home slot, so that
+    // no tombstones are needed
+    std::size_t next = slot;
+    while (true) {
+        next = (next + 1) & mask;
+        if (slots[next].index == EMPTY)  break;
+
+        const std::size_t home = home_slot(slots[next].id);
+        const bool stays = (slot <= next) ? (slot < home && home <= next)
+                                          : (slot < home || home <= next);
+        if (!stays) {
+            slots[slot] = slots[next];
+            slot = next;
+        }
+    }
+    slots[slot].index = EMPTY;
+
+    // Shrink the index when most objects are gone, e.g. after expiring
+    // a burst of them, so that it doesn't keep its largest size forever
+    if (records.size() * 8 < slots.size() && slots.size() > INITIAL_SLOT_COUNT) {
+        rehash(slots.size() / 2);
+    }
+    return true;
+}
+
+void ObjectStore::clear() {
+    records.clear();
+    for (auto &slot : slots)  slot.index = EMPTY;
+}
+
+/*
+ * Rebuild the hash index with the given number of slots, which must be a power of two.
+ */
+void ObjectStore::rehash(std::size_t slot_count) {
+    slots.assign(slot_count, Slot{0, EMPTY});
+    shift = 64;
+    for (std::size_t n = slot_count; n > 1; n >>= 1)  shift--;
+
+    const std::size_t mask = slot_count - 1;
+    for (std::size_t i = 0; i < records.size(); i++) {
+        std::size_t slot = home_slot(records[i].id);
+        while (slots[slot].index != EMPTY)  slot = (slot + 1) & mask;
+        slots[slot].id    = records[i].id;
+        slots[slot].index = i;
+    }
+}
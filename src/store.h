@@ -0,0 +1,63 @@
+#pragma once
+#include "object.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * A table of objects keyed by their IDs. The objects are kept in a dense
+ * array in the order they were added, which is the order they are relayed
+ * in, and an open-addressing hash index maps IDs to positions in that
+ * array. Adding, updating, finding, and removing an object are all O(1)
+ * regardless of how many objects there are.
+ *
+ * Removing an object moves the last object into its place, so the dense
+ * array stays compact without any tombstones, and insertion order is kept
+ * for every object except the one that is moved. The hash index shrinks
+ * again when most objects have been removed.
+ */
+class ObjectStore {
+public:
+    // Returned by find() if there's no object with the ID
+    static const std::size_t NOT_FOUND = SIZE_MAX;
+
+    ObjectStore();
+
+    std::size_t size() const { return records.size(); }
+    bool empty() const { return records.empty(); }
+    const Object &operator[](std::size_t index) const { return records[index]; }
+    const Object *data() const { return records.data(); }
+    std::vector<Object>::const_iterator begin() const { return records.begin(); }
+    std::vector<Object>::const_iterator end() const { return records.end(); }
+
+    // Returns the index of the object with the ID, or NOT_FOUND
+    std::size_t find(int64_t id) const;
+
+    // Adds the object, or replaces the object with the same ID.
+    // Returns true if the object was added.
+    bool upsert(const Object &object);
+
+    // Removes the object with the ID. Returns false if there was none.
+    bool erase(int64_t id);
+
+    void clear();
+
+private:
+    // Marks a slot in the hash index as unused
+    static const uint32_t EMPTY = UINT32_MAX;
+
+    // The ID is stored next to the index so that probing doesn't have
+    // to look in the dense array until the right slot is found
+    struct Slot {
+        int64_t  id;
+        uint32_t index;
+    };
+
+    std::vector<Object> records; // The objects in insertion order
+    std::vector<Slot> slots;     // The hash index, its size is a power of two
+    unsigned shift;              // Turns a 64-bit hash into a slot number
+
+    std::size_t home_slot(int64_t id) const;
+    std::size_t find_slot(int64_t id) const;
+    void rehash(std::size_t slot_count);
+};
@@ -0,0 +1,362 @@
+#include "subscribe.h"
+#include "zones.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+bool SubscriptionFilter::matches(const Object &object) const {
+    if (!types.empty() && std::find(types.begin(), types.end(), object.type) == types.end())  return false;
+    if (!colors.empty() && std::find(colors.begin(), colors.end(), object.color) == colors.end())  return false;
+    if (!ids.empty() && !std::binary_search(ids.begin(), ids.end(), object.id))  return false;
+    if (has_region && (object.x < min_x || object.x > max_x || object.y < min_y || object.y > max_y))  return false;
+    return true;
+}
+
+bool operator==(const SubscriptionFilter &lhs, const SubscriptionFilter &rhs) {
+    return lhs.types == rhs.types && lhs.colors == rhs.colors && lhs.ids == rhs.ids
+        && lhs.has_region == rhs.has_region && lhs.min_x == rhs.min_x && lhs.min_y == rhs.min_y
+        && lhs.max_x == rhs.max_x && lhs.max_y == rhs.max_y;
+}
+
+// Parse the whole text as an integer. Returns false if it isn't one.
+template <typename Integer>
+bool parse_value(std::string_view text, Integer &value) {
+    const char *last = text.data() + text.length();
+    const auto result = std::from_chars(text.data(), last, value);
+    return result.ec == std::errc() && result.ptr == last;
+}
+
+// Split the text at commas into values parsed by parse. Returns false if
+// any of them can't be parsed.
+template <typename T, typename Parse>
+bool parse_list(std::string_view text, std::vector<T> &values, Parse parse) {
+    values.clear();
+    while (true) {
+        const std::size_t comma = text.find(',');
+        T value;
+        if (!parse(text.substr(0, comma), value))  return false;
+        values.push_back(value);
+        if (comma == std::string_view::npos)  return true;
+        text.remove_prefix(comma + 1);
+    }
+}
+
+bool parse_subscription(std::string_view line, SubscriptionRequest &request, std::string &error) {
+    request = SubscriptionRequest();
+    SubscriptionFilter &filter = request.filter;
+    const auto parse_integer = [](std::string_view text, auto &value) { return parse_value(text, value); };
+
+    while (!line.empty()) {
+        const std::size_t space = line.find(' ');
+        const std::string_view option = line.substr(0, space);
+        line.remove_prefix(space == std::string_view::npos ? line.length() : space + 1);
+        if (option.empty())  continue;
+
+        const std::size_t equals = option.find('=');
+        const std::string_view key = option.substr(0, equals);
+        const std::string_view value = equals == std::string_view::npos ? std::string_view() : option.substr(equals + 1);
+        if (key == "types") {
+            if (!parse_list(value, filter.types, parse_integer)) {
+                error = "types must be integers separated by commas";
+                return false;
+            }
+        } else if (key == "colors") {
+            const auto parse_color = [](std::string_view name, uint32_t &color) {
+                uint8_t level;
+                if (!parse_level(name, level))  return false;
+                color = level_color(level);
+                return true;
+            };
+            if (!parse_list(value, filter.colors, parse_color)) {
+                error = "colors must be GREEN, YELLOW or RED separated by commas";
+                return false;
+            }
+        } else if (key == "ids") {
+            if (!parse_list(value, filter.ids, parse_integer)) {
+                error = "ids must be integers separated by commas";
+                return false;
+            }
+        } else if (key == "region") {
+            std::vector<int32_t> corners;
+            if (!parse_list(value, corners, parse_integer) || corners.size() != 4) {
+                error = "region must be <x1>,<y1>,<x2>,<y2>";
+                return false;
+            }
+            filter.has_region = true;
+            filter.min_x = std::min(corners[0], corners[2]);
+            filter.max_x = std::max(corners[0], corners[2]);
+            filter.min_y = std::min(corners[1], corners[3]);
+            filter.max_y = std::max(corners[1], corners[3]);
+        } else if (key == "rate") {
+            if (!parse_value(value, request.rate)) {
+                error = "rate must be a number of frames per second";
+                return false;
+            }
+        } else if (key == "format" && value == "hex") {
+            request.format = FrameFormat::HEX;
+        } else if (key == "format" && value == "binary") {
+            request.format = FrameFormat::BINARY;
+        } else {
+            error = "unknown option " + std::string(option);
+            return false;
+        }
+    }
+
+    // Sorted lists make filters that only differ in order equal, so that they share frames
+    std::sort(filter.types.begin(), filter.types.end());
+    filter.types.erase(std::unique(filter.types.begin(), filter.types.end()), filter.types.end());
+    std::sort(filter.colors.begin(), filter.colors.end());
+    filter.colors.erase(std::unique(filter.colors.begin(), filter.colors.end()), filter.colors.end());
+    std::sort(filter.ids.begin(), filter.ids.end());
+    filter.ids.erase(std::unique(filter.ids.begin(), filter.ids.end()), filter.ids.end());
+    return true;
+}
+
+SubscriptionServer::~SubscriptionServer() {
+    close();
+}
+
+bool SubscriptionServer::listen(const std::string &path, std::string &error) {
+    close();
+#ifdef _WIN32
+    error = "subscriptions are only supported on POSIX systems";
+    return false;
+#else
+    listener = listen_on_path(path.c_str());
+    if (listener == NO_SOCKET) {
+        error = "could not listen on " + path;
+        return false;
+    }
+
+    // Connections are picked up between relays, which must never wait for them
+    fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+    this->path = path;
+    return true;
+#endif
+}
+
+std::size_t SubscriptionServer::subscribers() const {
+    return std::count_if(subscriber_list.begin(), subscriber_list.end(),
+                         [](const Subscriber &subscriber) { return subscriber.subscribed; });
+}
+
+void SubscriptionServer::close() {
+    for (const auto &subscriber : subscriber_list) {
+        close_socket(subscriber.sock);
+    }
+    subscriber_list.clear();
+
+    if (listener != NO_SOCKET) {
+        close_socket(listener);
+        listener = NO_SOCKET;
+#ifndef _WIN32
+        unlink(path.c_str());
+#endif
+    }
+}
+
+void SubscriptionServer::publish(const ObjectStore &objects, bool predictions) {
+    if (listener == NO_SOCKET)  return;
+#ifndef _WIN32
+    accept_subscribers();
+
+    // Subscribers still sending their request, or still taking the last
+    // frame, or asking for a lower rate, skip this relay. Those that are
+    // gone are removed.
+    for (auto &subscriber : subscriber_list) {
+        if (subscriber.subscribed) {
+            subscriber.gone = !still_connected(subscriber) || !send_pending(subscriber);
+        } else {
+            subscriber.gone = !receive_request(subscriber);
+        }
+    }
+    remove_gone();
+    const Clock::time_point now = Clock::now();
+    due.clear();
+    for (std::size_t i = 0; i < subscriber_list.size(); i++) {
+        const Subscriber &subscriber = subscriber_list[i];
+        if (subscriber.subscribed && subscriber.pending.empty() && now >= subscriber.due)  due.push_back(i);
+    }
+
+    // Records serialized for earlier relays are stale
+    tick++;
+    for (std::size_t first = 0; first < due.size(); first++) {
+        if (due[first] == SIZE_MAX)  continue;
+        const SubscriptionFilter &filter = subscriber_list[due[first]].subscription.filter;
+        match(filter, objects);
+
+        // Every due subscriber with the same filter is sent a frame of the
+        // same objects, and those that also want the same format the same frame
+        for (const FrameFormat format : {FrameFormat::HEX, FrameFormat::BINARY}) {
+            bool built = false;
+            for (std::size_t other = first; other < due.size(); other++) {
+                if (due[other] == SIZE_MAX)  continue;
+                Subscriber &subscriber = subscriber_list[due[other]];
+                if (subscriber.subscription.format != format || !(subscriber.subscription.filter == filter))  continue;
+
+                if (!built)  build_frame(format, objects, predictions);
+                built = true;
+                subscriber.pending = frame;
+                subscriber.gone = !send_pending(subscriber);
+                if (subscriber.subscription.rate > 0) {
+                    subscriber.due = now + std::chrono::duration_cast<Clock::duration>(
+                        std::chrono::duration<double>(1.0 / subscriber.subscription.rate));
+                }
+                due[other] = SIZE_MAX;
+            }
+        }
+    }
+    remove_gone();
+#endif
+}
+
+// Disconnect the subscribers that are gone
+void SubscriptionServer::remove_gone() {
+    for (std::size_t i = 0; i < subscriber_list.size();) {
+        if (subscriber_list[i].gone) {
+            close_socket(subscriber_list[i].sock);
+            subscriber_list[i] = std::move(subscriber_list.back());
+            subscriber_list.pop_back();
+        } else {
+            i++;
+        }
+    }
+}
+
+#ifndef _WIN32
+
+// Accept every connection waiting on the listener
+void SubscriptionServer::accept_subscribers() {
+    while (true) {
+        const socket_t sock = accept(listener, nullptr, nullptr);
+        if (sock == NO_SOCKET)  break;
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+        Subscriber subscriber;
+        subscriber.sock = sock;
+        subscriber_list.push_back(std::move(subscriber));
+    }
+}
+
+/*
+ * Read what has arrived of the subscriber's request, and subscribe it
+ * once the whole line is there. Returns false if the subscriber is gone,
+ * or was sent an error because its request isn't one.
+ */
+bool SubscriptionServer::receive_request(Subscriber &subscriber) {
+    char buffer[512];
+    while (subscriber.request.find('\n') == std::string::npos) {
+        const ssize_t received = recv(subscriber.sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (received < 0 && errno == EINTR)  continue;
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))  return true;
+        if (received <= 0)  return false;
+        subscriber.request.append(buffer, received);
+        if (subscriber.request.length() > MAX_REQUEST_LENGTH)  break;
+    }
+
+    std::string_view line(subscriber.request);
+    line = line.substr(0, line.find('\n'));
+    if (!line.empty() && line.back() == '\r')  line.remove_suffix(1);
+
+    std::string error;
+    if (subscriber.request.length() > MAX_REQUEST_LENGTH) {
+        error = "the request is too long";
+    } else if (parse_subscription(line, subscriber.subscription, error)) {
+        subscriber.subscribed = true;
+        subscriber.request.clear();
+        subscriber.request.shrink_to_fit();
+        subscriber.due = Clock::now();
+        return true;
+    }
+    const std::string reply = "error: " + error + "\n";
+    send(subscriber.sock, reply.data(), reply.length(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    return false;
+}
+
+/*
+ * Whether the subscriber hasn't closed its connection, which is noticed
+ * even while it isn't sent anything. Anything it sends after its request
+ * is thrown away, at most one buffer per relay, so that a subscriber that
+ * never stops sending can't hold up the relay.
+ */
+bool SubscriptionServer::still_connected(Subscriber &subscriber) {
+    char buffer[512];
+    ssize_t received;
+    do {
+        received = recv(subscriber.sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+    } while (received < 0 && errno == EINTR);
+    return received > 0 || (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+/*
+ * Send as much of the subscriber's pending frame as the socket takes.
+ * Returns false if the subscriber is gone.
+ */
+bool SubscriptionServer::send_pending(Subscriber &subscriber) {
+    std::size_t sent = 0;
+    while (sent < subscriber.pending.length()) {
+        const ssize_t result = send(subscriber.sock, subscriber.pending.data() + sent,
+                                    subscriber.pending.length() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (result < 0 && errno == EINTR)  continue;
+        if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))  break;
+        if (result < 0)  return false;
+        sent += result;
+    }
+    subscriber.pending.erase(0, sent);
+    return true;
+}
+
+#endif
+
+/*
+ * Find the indices of the objects that match the filter, in the order of
+ * the objects. With IDs, only those objects are looked up instead of
+ * going through every object.
+ */
+void SubscriptionServer::match(const SubscriptionFilter &filter, const ObjectStore &objects) {
+    matched.clear();
+    if (!filter.ids.empty()) {
+        for (const int64_t id : filter.ids) {
+            const std::size_t index = objects.find(id);
+            if (index != ObjectStore::NOT_FOUND && filter.matches(objects[index]))  matched.push_back(index);
+        }
+        std::sort(matched.begin(), matched.end());
+        return;
+    }
+    for (std::size_t i = 0; i < objects.size(); i++) {
+        if (filter.matches(objects[i]))  matched.push_back(i);
+    }
+}
+
+/*
+ * Put together a full frame of the matched objects. The record of each
+ * object is serialized the first time any frame of this relay needs it,
+ * and copied from there after that.
+ */
+void SubscriptionServer::build_frame(FrameFormat format, const ObjectStore &objects, bool predictions) {
+    const std::size_t length = object_record_length(format, predictions);
+    std::string &cache = records[format == FrameFormat::BINARY];
+    std::vector<uint64_t> &stamped = stamps[format == FrameFormat::BINARY];
+    if (cache.length() < objects.size() * length)  cache.resize(objects.size() * length);
+    if (stamped.size() < objects.size())  stamped.resize(objects.size(), 0);
+
+    frame.clear();
+    append_frame_header(frame, format, matched.size(), predictions);
+    std::size_t offset = frame.length();
+    frame.resize(offset + matched.size() * length);
+    for (const std::size_t index : matched) {
+        char *record = &cache[index * length];
+        if (stamped[index] != tick) {
+            write_object_record(record, format, objects[index], predictions);
+            stamped[index] = tick;
+        }
+        std::memcpy(&frame[offset], record, length);
+        offset += length;
+    }
+    if (format == FrameFormat::HEX)  frame += '\n';
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include "frame.h"
+#include "object.h"
+#include "store.h"
+#include "transport.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Which objects a subscriber is sent. An object matches if it matches
+ * every part of the filter that's given, and an empty filter matches
+ * every object.
+ */
+struct SubscriptionFilter {
+    std::vector<uint32_t> types;  // Any of these types, or any type if empty
+    std::vector<uint32_t> colors; // Any of these colors, or any color if empty
+    std::vector<int64_t> ids;     // Any of these IDs, sorted, or any ID if empty
+    bool has_region = false;      // Whether the object must be within the region
+    int32_t min_x = 0, min_y = 0; // The corners of the region, which are within it
+    int32_t max_x = 0, max_y = 0;
+
+    bool matches(const Object &object) const;
+};
+
+bool operator==(const SubscriptionFilter &lhs, const SubscriptionFilter &rhs);
+
+// What a subscriber asks for
+struct SubscriptionRequest {
+    SubscriptionFilter filter;
+    FrameFormat format = FrameFormat::HEX;
+    unsigned rate = 0; // The most frames per second, or 0 for one every relay
+};
+
+/*
+ * Parse a subscription request, which is one line of space-separated
+ * options, all of which are optional:
+ *
+ *     types=<type>,...         Only objects of these types
+ *     colors=<color>,...       Only objects of these colors, GREEN, YELLOW or RED
+ *     region=<x1>,<y1>,<x2>,<y2>  Only objects within the box with these corners
+ *     ids=<id>,...             Only the objects with these IDs
+ *     rate=<n>                 At most n frames per second (default: one every relay)
+ *     format=hex|binary        The format of the frames (default: hex)
+ *
+ * Returns false and describes the problem in error if the line isn't one.
+ */
+bool parse_subscription(std::string_view line, SubscriptionRequest &request, std::string &error);
+
+/*
+ * Serves relays to local consumers that only want some of the objects.
+ * Consumers connect to a UNIX-domain socket, send a subscription request
+ * ending with '\n', and from then on are sent full frames, in the format
+ * they asked for, with only the objects that match their filter. Hex
+ * frames end with '\n' like on the relay output. A request that can't be
+ * parsed is answered with "error: <problem>\n" and the connection closed.
+ *
+ * Everything happens on the thread that publishes, between relays, so
+ * nothing is locked: new connections and their requests are picked up,
+ * each filter is evaluated once against the objects, and each object
+ * that some subscriber gets is serialized once per format, with the same
+ * record copied into every frame it's in. Subscribers with the same
+ * filter and format share one frame. Sockets are never waited on: a
+ * subscriber that can't take all of a frame is sent the rest of it first
+ * and skips relays until it has, which loses nothing since every frame
+ * is a full frame.
+ *
+ * UNIX-domain sockets are only supported on POSIX systems.
+ */
+class SubscriptionServer {
+public:
+    // The longest subscription request accepted
+    static const std::size_t MAX_REQUEST_LENGTH = 4096;
+
+    SubscriptionServer() {}
+    ~SubscriptionServer();
+    SubscriptionServer(const SubscriptionServer&) = delete;
+    SubscriptionServer &operator=(const SubscriptionServer&) = delete;
+
+    // Listen for subscribers on a socket at the path. A socket left there by
+    // an earlier run is replaced, but nothing else that's there.
+    bool listen(const std::string &path, std::string &error);
+    bool is_open() const { return listener != NO_SOCKET; }
+
+    // Pick up new subscribers, and send every subscriber that's due the
+    // objects that match its filter, with predictions if asked for
+    void publish(const ObjectStore &objects, bool predictions);
+
+    // The number of subscribers that have sent their request
+    std::size_t subscribers() const;
+
+    // Disconnect every subscriber and remove the socket
+    void close();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Subscriber {
+        socket_t sock = NO_SOCKET;
+        bool subscribed = false;   // Whether the request has been received
+        bool gone = false;         // Whether it disconnected or failed, so it's to be removed
+        std::string request;       // The request received so far
+        SubscriptionRequest subscription;
+        Clock::time_point due;     // When the rate allows the next frame
+        std::string pending;       // The part of the last frame not yet sent
+    };
+
+    socket_t listener = NO_SOCKET;
+    std::string path;
+    std::vector<Subscriber> subscriber_list;
+
+    // The serialized records of the objects in the last relay, at the
+    // indices of the objects, by format. Only those stamped with the
+    // relay's tick were serialized for it.
+    std::string records[2];
+    std::vector<uint64_t> stamps[2];
+    uint64_t tick = 0;
+
+    std::vector<std::size_t> due;     // The subscribers sent the current relay
+    std::vector<std::size_t> matched; // The objects in the current frame
+    std::string frame;
+
+    void accept_subscribers();
+    void remove_gone();
+    bool receive_request(Subscriber &subscriber);
+    bool still_connected(Subscriber &subscriber);
+    bool send_pending(Subscriber &subscriber);
+    void match(const SubscriptionFilter &filter, const ObjectStore &objects);
+    void build_frame(FrameFormat format, const ObjectStore &objects, bool predictions);
+};
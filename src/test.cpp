@@ -1,8 +1,48 @@
+#include "alloc.h"
 #include "client.h"
+#include "capture.h"
+#include "expiry.h"
+#include "feed.h"
+#include "color.h"
+#include "frame.h"
+#include "framer.h"
+#include "grid.h"
+#include "output.h"
+#include "pipeline.h"
+#include "ring.h"
+#include "scan.h"
+#include "shm.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "subscribe.h"
+#include "track.h"
+#include "transport.h"
+#include "trigger.h"
 #include <stdio.h>
+#include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <iomanip>
 #include <limits>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <ws2tcpip.h>
+#else
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
 
 int assert_count = 0;
 int failed_assert_count = 0;
@@ -94,6 +134,370 @@ void test_split_string() {
     }
 }
 
+// Copy the string into the framer as if it was received in one recv() call
+void receive(LineFramer& framer, const std::string& data) {
+    char *buffer = framer.prepare(data.length());
+    std::memcpy(buffer, data.data(), data.length());
+    framer.commit(data.length());
+}
+
+void test_line_framer() {
+    std::cout << "LineFramer" << std::endl;
+
+    LineFramer framer(16);
+    std::string_view line;
+
+    std::cout << "\tTest case: nothing received" << std::endl;
+    assert(!framer.next_line(line), "got a line from an empty framer");
+
+    std::cout << "\tTest case: many lines in one chunk" << std::endl;
+    framer.clear();
+    receive(framer, "one\ntwo\n\nthree\n");
+    assert(framer.next_line(line) && line ==   "one", "bad first line");
+    assert(framer.next_line(line) && line ==   "two", "bad second line");
+    assert(framer.next_line(line) && line ==      "", "bad third line");
+    assert(framer.next_line(line) && line == "three", "bad fourth line");
+    assert(!framer.next_line(line), "got a line that was never received");
+    assert(framer.pending().empty(), "bytes left after the last line");
+
+    std::cout << "\tTest case: line cut by chunk boundaries" << std::endl;
+    framer.clear();
+    receive(framer, "ID=123;X=");
+    assert(!framer.next_line(line), "got a partial line");
+    assert(framer.pending() == "ID=123;X=", "bad pending bytes");
+    receive(framer, "1;Y=2;T");
+    assert(!framer.next_line(line), "got a partial line");
+    receive(framer, "YPE=3\nID=4");
+    assert(framer.next_line(line) && line == "ID=123;X=1;Y=2;TYPE=3", "bad reassembled line");
+    assert(!framer.next_line(line), "got a partial line");
+    assert(framer.pending() == "ID=4", "bad pending bytes");
+
+    std::cout << "\tTest case: CRLF line endings" << std::endl;
+    framer.clear();
+    receive(framer, "first\r\nsecond\r");
+    assert(framer.next_line(line) && line == "first", "bad first line");
+    assert(!framer.next_line(line), "got a partial line");
+    receive(framer, "\n\r\n");
+    assert(framer.next_line(line) && line == "second", "bad second line");
+    assert(framer.next_line(line) && line ==       "", "bad third line");
+
+    std::cout << "\tTest case: line longer than the capacity" << std::endl;
+    framer.clear();
+    std::string long_line(100, 'x');
+    for (std::size_t i = 0; i < long_line.length(); i += 7) {
+        receive(framer, long_line.substr(i, 7));
+    }
+    receive(framer, "\n");
+    assert(framer.next_line(line) && line == long_line, "bad long line");
+
+    std::cout << "\tTest case: line longer than the maximum" << std::endl;
+    LineFramer capped(16, 32);
+    receive(capped, "ok\n" + std::string(20, 'x'));
+    for (int i = 0; i < 10; i++)  receive(capped, std::string(20, 'x')); // Never more than the maximum is kept
+    assert(capped.next_line(line) && line == "ok", "should keep the lines before a long line");
+    assert(!capped.next_line(line) && capped.dropped_lines() == 1, "should drop the long line");
+    receive(capped, "xxx\nnext\nID=");
+    assert(capped.next_line(line) && line == "next", "should carry on after the end of the long line");
+    assert(capped.pending() == "ID=" && capped.dropped_lines() == 1, "should keep the next partial line");
+    receive(capped, std::string(40, 'y'));
+    receive(capped, "\nlast\n");
+    const bool ok = capped.next_line(line) && line == "last" && capped.dropped_lines() == 2;
+    assert(ok, "should drop a partial line that a chunk makes too long");
+}
+
+// Collects everything an event loop receives on one connection
+class CollectingHandler : public StreamHandler {
+public:
+    std::string data;
+    int close_count = 0;
+
+    char *receive_buffer(std::size_t &length) override {
+        length = sizeof(buffer); // Small so that the loop has to read many times
+        return buffer;
+    }
+    void received(std::size_t length) override {
+        data.append(buffer, length);
+    }
+    void closed() override {
+        close_count++;
+    }
+
+private:
+    char buffer[7];
+};
+
+void test_event_loop() {
+    std::cout << "EventLoop" << std::endl;
+
+    if (!init_sockets()) {
+        assert(false, "failed to init sockets");
+        return;
+    }
+
+    // Listen on a free port on the loopback interface
+    socket_t listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    struct sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family      = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port        = 0;
+    socklen_t address_length = sizeof(address);
+    bool ok = listener != NO_SOCKET
+           && bind(listener, (struct sockaddr *)&address, sizeof(address)) == 0
+           && listen(listener, 4) == 0
+           && getsockname(listener, (struct sockaddr *)&address, &address_length) == 0;
+    if (!ok) {
+        assert(false, "failed to listen");
+        cleanup_sockets();
+        return;
+    }
+    const std::string port = std::to_string(ntohs(address.sin_port));
+
+    std::cout << "\tTest case: receive from many connections until they close" << std::endl;
+    const int CONNECTION_COUNT = 3;
+    socket_t clients[CONNECTION_COUNT];
+    socket_t servers[CONNECTION_COUNT];
+    CollectingHandler handlers[CONNECTION_COUNT];
+    auto loop = EventLoop::create();
+    for (int i = 0; i < CONNECTION_COUNT; i++) {
+        clients[i] = connect_to_server("127.0.0.1", port.c_str());
+        servers[i] = accept(listener, nullptr, nullptr);
+        ok = ok && clients[i] != NO_SOCKET && servers[i] != NO_SOCKET && loop->add(clients[i], &handlers[i]);
+    }
+    assert(ok, "failed to connect");
+
+    // Send from another thread while the loop runs, then close
+    std::string sent[CONNECTION_COUNT];
+    for (int i = 0; i < CONNECTION_COUNT; i++) {
+        for (int j = 0; j < 1000; j++)  sent[i] += "ID=" + std::to_string(i*1000 + j) + ";X=1;Y=2;TYPE=3\n";
+    }
+    std::thread sender([&]() {
+        for (int i = 0; i < CONNECTION_COUNT; i++) {
+            for (std::size_t offset = 0; offset < sent[i].length(); offset += 1000) {
+                const std::size_t length = std::min<std::size_t>(1000, sent[i].length() - offset);
+                send(servers[i], sent[i].data() + offset, (int)length, 0);
+            }
+            close_socket(servers[i]);
+        }
+    });
+    assert(loop->run(), "event loop failed");
+    sender.join();
+
+    for (int i = 0; i < CONNECTION_COUNT; i++) {
+        assert(handlers[i].data == sent[i], "bad received data");
+        assert(handlers[i].close_count == 1, "closed() not called once");
+        close_socket(clients[i]);
+    }
+
+    close_socket(listener);
+    cleanup_sockets();
+}
+
+void test_listen_on_port() {
+    std::cout << "listen_on_port" << std::endl;
+
+    if (!init_sockets()) {
+        assert(false, "failed to init sockets");
+        return;
+    }
+
+    std::cout << "\tTest case: send a lot to a connection on a free port" << std::endl;
+    const socket_t listener = listen_on_port("0");
+    struct sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    bool ok = listener != NO_SOCKET && getsockname(listener, (struct sockaddr *)&address, &address_length) == 0;
+    assert(ok, "failed to listen on a free port");
+    if (!ok) {
+        cleanup_sockets();
+        return;
+    }
+
+    const socket_t client = connect_to_server("127.0.0.1", std::to_string(ntohs(address.sin_port)).c_str());
+    const socket_t server = accept(listener, nullptr, nullptr);
+    assert(client != NO_SOCKET && server != NO_SOCKET, "failed to connect");
+
+    // More than the socket buffers hold, so send() can't take it all at once
+    std::string sent(8 << 20, 'x');
+    for (std::size_t i = 0; i < sent.length(); i += 4096)  sent[i] = '0' + i % 10;
+    std::thread sender([&]() {
+        ok = send_all(server, sent.data(), sent.length());
+        close_socket(server);
+    });
+    std::string received;
+    char buffer[65536];
+    int length;
+    while ((length = recv(client, buffer, sizeof(buffer), 0)) > 0)  received.append(buffer, length);
+    sender.join();
+    assert(ok && received == sent, "bad received data");
+
+    std::cout << "\tTest case: send to a closed connection" << std::endl;
+    close_socket(client);
+    const socket_t other = connect_to_server("127.0.0.1", std::to_string(ntohs(address.sin_port)).c_str());
+    const socket_t closed = accept(listener, nullptr, nullptr);
+    close_socket(other);
+    ok = true;
+    for (int i = 0; i < 100 && ok; i++)  ok = send_all(closed, sent.data(), 65536);
+    assert(!ok, "sending to a closed connection should fail");
+    close_socket(closed);
+
+    close_socket(listener);
+    cleanup_sockets();
+}
+
+void test_spsc_ring() {
+    std::cout << "SpscRing" << std::endl;
+
+    std::cout << "\tTest case: fill and empty" << std::endl;
+    SpscRing<int> ring(5);
+    assert(ring.capacity() == 8, "the capacity should be rounded up to a power of two");
+    bool ok = ring.empty();
+    for (int i = 0; i < 8; i++)  ok = ok && ring.push(i);
+    ok = ok && !ring.push(8) && !ring.empty();
+    assert(ok, "should take exactly as many values as the capacity");
+    int value = -1;
+    for (int i = 0; i < 8; i++)  ok = ok && ring.pop(value) && value == i;
+    ok = ok && !ring.pop(value) && ring.empty();
+    assert(ok, "should pop the values in order and then nothing");
+
+    std::cout << "\tTest case: wrap around many times" << std::endl;
+    ok = true;
+    for (int i = 0; i < 100; i++) {
+        ok = ok && ring.push(i) && ring.push(i + 1) && ring.pop(value) && value == i && ring.pop(value) && value == i + 1;
+    }
+    assert(ok && ring.empty(), "the values were mixed up when wrapping");
+
+    std::cout << "\tTest case: between two threads" << std::endl;
+    const uint64_t COUNT = 1000000;
+    SpscRing<uint64_t> shared(64);
+    std::thread producer([&]() {
+        for (uint64_t i = 0; i < COUNT; i++) {
+            while (!shared.push(i))  std::this_thread::yield();
+        }
+    });
+    uint64_t expected = 0;
+    ok = true;
+    while (expected < COUNT) {
+        uint64_t received;
+        if (!shared.pop(received)) {
+            std::this_thread::yield();
+            continue;
+        }
+        ok = ok && received == expected;
+        expected++;
+    }
+    producer.join();
+    assert(ok && shared.empty(), "the consumer didn't get every value in order");
+}
+
+void test_ingest_pipeline() {
+    std::cout << "IngestPipeline" << std::endl;
+
+    if (!init_sockets()) {
+        assert(false, "failed to init sockets");
+        return;
+    }
+    const socket_t listener = listen_on_port("0");
+    struct sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    if (listener == NO_SOCKET || getsockname(listener, (struct sockaddr *)&address, &address_length) != 0) {
+        assert(false, "failed to listen");
+        cleanup_sockets();
+        return;
+    }
+    const std::string port = std::to_string(ntohs(address.sin_port));
+
+    std::cout << "\tTest case: many feeds on fewer threads, in order per feed" << std::endl;
+    clear_objects();
+    const int FEED_COUNT = 5;
+    const int OBJECTS_PER_FEED = 100;
+    const int UPDATES = 200;
+    IngestPipeline pipeline(2);
+    socket_t clients[FEED_COUNT];
+    socket_t servers[FEED_COUNT];
+    bool ok = true;
+    for (int i = 0; i < FEED_COUNT; i++) {
+        clients[i] = connect_to_server("127.0.0.1", port.c_str());
+        servers[i] = accept(listener, nullptr, nullptr);
+        ok = ok && clients[i] != NO_SOCKET && servers[i] != NO_SOCKET && pipeline.add(clients[i], Endpoint{"feed", std::to_string(i)});
+    }
+    assert(ok, "failed to connect");
+
+    // Each feed moves its objects along X, so the last update of each must win.
+    // The data is sent in pieces that cut lines, and the feeds share one object.
+    std::vector<std::thread> senders;
+    for (int i = 0; i < FEED_COUNT; i++) {
+        senders.emplace_back([&servers, i]() {
+            std::string data;
+            for (int update = 1; update <= UPDATES; update++) {
+                for (int j = 0; j < OBJECTS_PER_FEED; j++) {
+                    const int id = j == 0 ? 0 : i * OBJECTS_PER_FEED + j;
+                    data += "ID=" + std::to_string(id) + ";X=" + std::to_string(update) + ";Y=" + std::to_string(i) + ";TYPE=1\n";
+                }
+            }
+            for (std::size_t offset = 0; offset < data.length(); offset += 777) {
+                send_all(servers[i], data.data() + offset, std::min<std::size_t>(777, data.length() - offset));
+            }
+            close_socket(servers[i]);
+        });
+    }
+    std::stringstream log;
+    std::streambuf *log_buffer = std::clog.rdbuf(log.rdbuf()); // Hide the closing messages
+    ok = pipeline.run();
+    std::clog.rdbuf(log_buffer);
+    for (auto& sender : senders)  sender.join();
+    assert(ok, "the pipeline failed");
+
+    ok = objects.size() == FEED_COUNT * (OBJECTS_PER_FEED - 1) + 1;
+    for (int i = 0; i < FEED_COUNT; i++) {
+        for (int j = 1; j < OBJECTS_PER_FEED; j++) {
+            const std::size_t index = objects.find(i * OBJECTS_PER_FEED + j);
+            ok = ok && index != ObjectStore::NOT_FOUND && objects[index].x == UPDATES && objects[index].y == i;
+        }
+    }
+    assert(ok, "an object is missing or its updates were reordered");
+    const std::size_t shared = objects.find(0);
+    assert(shared != ObjectStore::NOT_FOUND && objects[shared].x == UPDATES, "the shared object should have its last update");
+    assert(log.str().find("parse errors") != std::string::npos && log.str().find("incomplete") == std::string::npos,
+           "every feed should close without a cut line");
+    for (const socket_t client : clients)  close_socket(client);
+
+#ifndef _WIN32
+    std::cout << "\tTest case: nothing spins while a feed is idle after another closed" << std::endl;
+    clear_objects();
+    IngestPipeline waiting(2);
+    socket_t idle[2];
+    socket_t feeding[2];
+    ok = true;
+    for (int i = 0; i < 2; i++) {
+        idle[i] = connect_to_server("127.0.0.1", port.c_str());
+        feeding[i] = accept(listener, nullptr, nullptr);
+        ok = ok && idle[i] != NO_SOCKET && feeding[i] != NO_SOCKET && waiting.add(idle[i], Endpoint{"feed", std::to_string(i)});
+    }
+    assert(ok, "failed to connect");
+    log.str("");
+    log_buffer = std::clog.rdbuf(log.rdbuf());
+    std::thread running([&]() { ok = waiting.run(); });
+    close_socket(feeding[0]);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100)); // For the first feed's worker to finish
+
+    // The process's CPU time, of every thread, while the open feed sends nothing
+    const std::clock_t cpu_before = std::clock();
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    const double cpu_ms = 1000.0 * (std::clock() - cpu_before) / CLOCKS_PER_SEC;
+    send_all(feeding[1], "ID=1;X=2;Y=3;TYPE=1\n", 20);
+    close_socket(feeding[1]);
+    running.join();
+    std::clog.rdbuf(log_buffer);
+    assert(cpu_ms < 100, "the pipeline used " + std::to_string(cpu_ms) + " ms of CPU in 300 ms while idle");
+    assert(ok && objects.find(1) != ObjectStore::NOT_FOUND, "the open feed's object should still be stored");
+    for (const socket_t client : idle)  close_socket(client);
+#endif
+
+    clear_objects(); // Remove side effects
+    close_socket(listener);
+    cleanup_sockets();
+}
+
 void test_parse_object() {
     std::cout << "parse_object()" << std::endl;
 
@@ -203,6 +607,122 @@ void test_parse_object() {
     line = "ID=123;X=1;Y=2;TYPE=4";
     ok = parse_object(line, object, placeholder);
     assert(!ok, "successfully parsed invalid line");
+
+    std::cout << "\tTest case: trailing characters after a value" << std::endl;
+    line = "ID=123;X=1;Y=2abc;TYPE=3";
+    ok = parse_object(line, object, placeholder);
+    assert(!ok, "successfully parsed invalid line");
+
+    std::cout << "\tTest case: error reasons" << std::endl;
+    assert(parse_object(std::string_view("ID=1;X=2;Y=3;TYPE=1"), object) == ParseError::NONE, "bad reason");
+    assert(parse_object(std::string_view("ID=1;X=2;Y=3"), object) == ParseError::FIELD_COUNT, "bad reason");
+    assert(parse_object(std::string_view("ID=1;X=2;Y=3;TYPE=1;"), object) == ParseError::FIELD_COUNT, "bad reason");
+    assert(parse_object(std::string_view("XD=1;X=2;Y=3;TYPE=1"), object) == ParseError::ID_FIELD, "bad reason");
+    assert(parse_object(std::string_view("ID=1;Y=2;X=3;TYPE=1"), object) == ParseError::X_FIELD, "bad reason");
+    assert(parse_object(std::string_view("ID=1;X=2;X=3;TYPE=1"), object) == ParseError::Y_FIELD, "bad reason");
+    assert(parse_object(std::string_view("ID=1;X=2;Y=3;KIND=1"), object) == ParseError::TYPE_FIELD, "bad reason");
+    assert(parse_object(std::string_view("ID=;X=2;Y=3;TYPE=1"), object) == ParseError::VALUE, "bad reason");
+    assert(parse_object(std::string_view("ID=1;X=2;Y=3;TYPE=-1"), object) == ParseError::VALUE, "bad reason");
+    assert(parse_object(std::string_view("ID=1;X=2;Y=3;TYPE=7"), object) == ParseError::TYPE, "bad reason");
+}
+
+void test_scan_separators() {
+    std::cout << "scan_separators()" << std::endl;
+
+    // Lines of various lengths so that separators land on every position
+    // of the SIMD registers, followed by a tail shorter than a register
+    std::string data;
+    for (int i = 0; i < 50; i++) {
+        data += "ID=" + std::to_string(i * 7919) + ";X=" + std::to_string(i) + ";Y=-3;TYPE=1\n";
+    }
+    data += "ID=1;X";
+
+    std::vector<uint32_t> expected;
+    for (std::size_t i = 0; i < data.length(); i++) {
+        if (data[i] == '\n' || data[i] == ';')  expected.push_back(i);
+    }
+
+    std::vector<uint32_t> offsets(data.length());
+    const SimdLevel levels[] = {SimdLevel::SCALAR, SimdLevel::SSE2, SimdLevel::AVX2};
+    const char *names[] = {"scalar", "SSE2", "AVX2"};
+    for (int i = 0; i < 3; i++) {
+        if (!simd_supports(levels[i]))  continue;
+        std::cout << "\tTest case: " << names[i] << " scan" << std::endl;
+
+        // Scan from every start offset within a register to cover unaligned data
+        for (std::size_t start = 0; start < 32; start++) {
+            const std::size_t count = scan_separators(data.data() + start, data.length() - start,
+                                                      offsets.data(), levels[i]);
+            std::size_t first = 0;
+            while (expected[first] < start)  first++;
+            bool same = (count == expected.size() - first);
+            for (std::size_t j = 0; same && j < count; j++) {
+                same = (offsets[j] + start == expected[first + j]);
+            }
+            assert(same, "bad offsets");
+        }
+    }
+
+    std::cout << "\tTest case: no separators" << std::endl;
+    assert(scan_separators("no separators in here at all, not one", 37, offsets.data()) == 0, "found a separator");
+}
+
+void test_record_scanner() {
+    std::cout << "RecordScanner" << std::endl;
+
+    RecordScanner scanner;
+    std::vector<ParsedRecord> records;
+    std::string buffer;
+    std::size_t parsed_length;
+
+    std::cout << "\tTest case: empty buffer" << std::endl;
+    parsed_length = scanner.parse("", records);
+    assert(parsed_length == 0 && records.empty(), "parsed something from nothing");
+
+    std::cout << "\tTest case: valid and invalid lines" << std::endl;
+    buffer = "ID=123;X=1;Y=2;TYPE=3\n"
+             "\n"
+             "ID=1;X=2;Y=3\n"
+             "ID=4;X=5;Y=6;TYPE=7\r\n"
+             "ID=8;X=9;Y=10;TYPE=2\r\n"
+             "ID=11;X=12;Y=1";
+    parsed_length = scanner.parse(buffer, records);
+    assert(parsed_length == buffer.find("ID=11"), "bad parsed length");
+    if (records.size() == 4) {
+        assert(records[0].error == ParseError::NONE, "bad first error");
+        assert(records[0].object.id == 123 && records[0].object.type == 3, "bad first object");
+        assert(records[1].error == ParseError::FIELD_COUNT, "bad second error");
+        assert(records[1].line == "ID=1;X=2;Y=3", "bad second line");
+        assert(records[2].error == ParseError::TYPE, "bad third error");
+        assert(records[3].error == ParseError::NONE, "bad fourth error");
+        assert(records[3].line == "ID=8;X=9;Y=10;TYPE=2", "bad fourth line");
+        assert(records[3].object.y == 10 && records[3].object.type == 2, "bad fourth object");
+    } else {
+        assert(false, "incorrect number of records");
+    }
+
+    std::cout << "\tTest case: same results as parse_object()" << std::endl;
+    const std::string lines[] = {
+        "ID=-9223372036854775808;X=-2147483648;Y=2147483647;TYPE=1",
+        "ID=9223372036854775808;X=1;Y=2;TYPE=1",
+        "ID=123;X=1;;Y=2;TYPE=3",
+        "ID=123;X=1;Y=2;OTHER=10;TYPE=3",
+        "ID=123;X=1;Y=xyz;TYPE=3",
+        "ID=123;X=1;Y=2;TYPE=",
+        "ID=123;X=1;Y=2;",
+        "\t \r    ",
+    };
+    for (const auto& line : lines) {
+        scanner.parse(line + "\n", records);
+        Object object;
+        const ParseError error = parse_object(std::string_view(line), object);
+        if (records.size() == 1) {
+            assert(records[0].error == error, "different error than parse_object()");
+            if (error == ParseError::NONE)  assert(records[0].object == object, "different object than parse_object()");
+        } else {
+            assert(false, "incorrect number of records");
+        }
+    }
 }
 
 void test_color_object() {
@@ -323,6 +843,680 @@ void test_color_object() {
     assert(object.color == GREEN, "bad color");
 }
 
+void test_color_objects() {
+    std::cout << "color_objects()" << std::endl;
+
+    // Every coordinate around the zones for every type, so that the zone
+    // boundaries are covered exactly, and a few objects far away
+    std::vector<Object> objects;
+    Object object;
+    object.id = object.color = 0;
+    for (uint32_t type = 0; type <= 4; type++) {
+        for (int32_t x = DESIGNATED_X - 110; x <= DESIGNATED_X + 110; x++) {
+            for (int32_t y = DESIGNATED_Y - 110; y <= DESIGNATED_Y + 110; y++) {
+                object.x = x;
+                object.y = y;
+                object.type = type;
+                objects.push_back(object);
+            }
+        }
+        const int32_t extremes[] = {std::numeric_limits<int32_t>::min(), -1, 0, std::numeric_limits<int32_t>::max()};
+        for (int32_t x : extremes) {
+            for (int32_t y : extremes) {
+                object.x = x;
+                object.y = y;
+                object.type = type;
+                objects.push_back(object);
+            }
+        }
+    }
+    // Leave a tail shorter than a SIMD register
+    objects.resize(objects.size() - 3);
+
+    std::vector<Object> expected = objects;
+    for (auto& object : expected)  color_object(object);
+
+    std::vector<int32_t> x, y;
+    std::vector<uint32_t> type;
+    for (const auto& object : objects) {
+        x.push_back(object.x);
+        y.push_back(object.y);
+        type.push_back(object.type);
+    }
+
+    const SimdLevel levels[] = {SimdLevel::SCALAR, SimdLevel::SSE2, SimdLevel::AVX2};
+    const char *names[] = {"scalar", "SSE2", "AVX2"};
+    for (int i = 0; i < 3; i++) {
+        if (!simd_supports(levels[i]))  continue;
+        std::cout << "\tTest case: " << names[i] << " coloring" << std::endl;
+
+        std::vector<uint32_t> color(objects.size(), 0);
+        color_objects(ObjectColumns{x.data(), y.data(), type.data(), color.data(), objects.size()}, levels[i]);
+        std::size_t mismatches = 0;
+        for (std::size_t j = 0; j < objects.size(); j++) {
+            if (color[j] != expected[j].color)  mismatches++;
+        }
+        assert(mismatches == 0, std::to_string(mismatches) + " colors differ from color_object()");
+    }
+
+    std::cout << "\tTest case: color an array of objects" << std::endl;
+    color_objects(objects.data(), objects.size());
+    bool same = true;
+    for (std::size_t j = 0; j < objects.size(); j++) {
+        same = same && objects[j].color == expected[j].color && objects[j].x == expected[j].x;
+    }
+    assert(same, "colors differ from color_object()");
+}
+
+// Parse zone rules from properties text, starting from the default rules
+bool parse_zone_rules(const std::string& text, ZoneRules& rules, std::string& error) {
+    std::istringstream stream(text);
+    Properties properties;
+    rules = ZoneRules::defaults();
+    return read_properties(stream, properties, error) && zone_rules_from(properties, rules, error);
+}
+
+void test_zone_rules() {
+    std::cout << "ZoneRules" << std::endl;
+
+    ZoneRules rules;
+    std::string error;
+    Object object;
+    object.id = object.color = 0;
+
+    std::cout << "\tTest case: the default rules written out" << std::endl;
+    bool parsed = parse_zone_rules("# The original rules\n"
+                                   "ZONES=150,150\n"
+                                   "ZONE_TYPE_1 = GREEN YELLOW<75 RED<50\n"
+                                   "ZONE_TYPE_2 = GREEN YELLOW<50\n"
+                                   "ZONE_TYPE_3 = YELLOW RED<100\n", rules, error);
+    assert(parsed, "could not parse the rules: " + error);
+    assert(rules.is_default(), "the rules should be the default ones");
+
+    std::cout << "\tTest case: other keys are ignored" << std::endl;
+    parsed = parse_zone_rules("SERVERPORT=5463\nMAP=map.gif\n", rules, error);
+    assert(parsed && rules.is_default(), "the rules should be the default ones");
+
+    std::cout << "\tTest case: the raster of the default rules" << std::endl;
+    ColorRaster default_raster(ZoneRules::defaults());
+    bool same = true;
+    for (uint32_t type = 0; type <= 4; type++) {
+        for (object.x = -20; object.x < 320; object.x++) {
+            for (object.y = -20; object.y < 320; object.y++) {
+                object.type = type;
+                color_object(object);
+                same = same && default_raster.color(object.x, object.y, type) == object.color;
+            }
+        }
+    }
+    assert(same, "the raster should color like color_object()");
+
+    std::cout << "\tTest case: several designated coordinates" << std::endl;
+    parsed = parse_zone_rules("ZONES=40,40 260,200 150,-30\n"
+                              "ZONE_TYPE_1=GREEN YELLOW<30 RED<10\n"
+                              "ZONE_TYPE_3=YELLOW GREEN<20\n"
+                              "ZONE_TYPE_OTHER=GREEN RED<60\n", rules, error);
+    assert(parsed, "could not parse the rules: " + error);
+    assert(!rules.is_default(), "the rules should not be the default ones");
+    assert(rules.evaluate(45, 45, 1) == RED_LEVEL, "should be red near the first coordinate");
+    assert(rules.evaluate(260, 175, 1) == YELLOW_LEVEL, "should be yellow near the second coordinate");
+    assert(rules.evaluate(150, 150, 1) == GREEN_LEVEL, "should be green away from every coordinate");
+    assert(rules.evaluate(40, 40, 3) == YELLOW_LEVEL, "a less severe ring should not lower the color");
+    assert(rules.evaluate(150, 20, 2) == RED_LEVEL, "should be red near the coordinate off the map");
+    assert(rules.evaluate(150, 31, 2) == GREEN_LEVEL, "should be green exactly at the radius");
+
+    ColorRaster raster(rules);
+    same = true;
+    for (uint32_t type = 0; type <= 8; type++) {
+        for (int32_t x = -70; x < 370; x++) {
+            for (int32_t y = -70; y < 370; y++) {
+                same = same && raster.color(x, y, type) == level_color(rules.evaluate(x, y, type));
+            }
+        }
+    }
+    assert(same, "the raster should color like the exact rules");
+    assert(raster.color(std::numeric_limits<int32_t>::min(), 0, 1) == GREEN, "bad color far off the map");
+    const int32_t low = std::numeric_limits<int32_t>::min(), high = std::numeric_limits<int32_t>::max();
+    assert(distance_squared(low, 0, high, 0) == 0xffffffffull * 0xffffffffull, "bad distance across the int32 range");
+    assert(distance_squared(low, low, high, high) == UINT64_MAX, "the distance should saturate");
+
+    std::cout << "\tTest case: coloring by the rules" << std::endl;
+    set_zone_rules(rules);
+    object.x = 45; object.y = 45; object.type = 1;
+    color_object(object);
+    assert(object.color == RED, "color_object() should use the rules");
+    std::vector<Object> batch(100, object);
+    batch[99].x = 150;
+    color_objects(batch.data(), batch.size());
+    assert(batch[0].color == RED && batch[99].color == GREEN, "color_objects() should use the rules");
+    set_zone_rules(ZoneRules::defaults());
+    color_object(object);
+    assert(object.color == GREEN, "color_object() should use the default rules again");
+
+    std::cout << "\tTest case: malformed rules" << std::endl;
+    assert(!parse_zone_rules("ZONES\n", rules, error), "a line without = should be rejected");
+    assert(!parse_zone_rules("ZONES=150\n", rules, error), "a coordinate without y should be rejected");
+    assert(!parse_zone_rules("ZONES=\n", rules, error), "no coordinates should be rejected");
+    assert(!parse_zone_rules("ZONE_TYPE_1=BLUE\n", rules, error), "an unknown color should be rejected");
+    assert(!parse_zone_rules("ZONE_TYPE_1=GREEN RED<0\n", rules, error), "a zero radius should be rejected");
+    assert(!parse_zone_rules("ZONE_TYPE_1=GREEN RED50\n", rules, error), "a ring without < should be rejected");
+    assert(!parse_zone_rules("ZONE_TYPE_X=GREEN\n", rules, error), "a bad type should be rejected");
+    assert(!parse_zone_rules("ZONE_TYPE_0=GREEN\n", rules, error), "a type below 1 should be rejected");
+    assert(!parse_zone_rules("ZONE_TYPE_4294967295=GREEN\n", rules, error), "a type above 3 should be rejected");
+
+    std::cout << "\tTest case: map size" << std::endl;
+    uint32_t width = 0, height = 0;
+    std::istringstream gif(std::string("GIF89a\x2c\x01\x90\x01", 10));
+    assert(read_gif_size(gif, width, height) && width == 300 && height == 400, "bad GIF size");
+    std::istringstream png(std::string("\x89PNG\r\n\x1a\n\0\0", 10));
+    assert(!read_gif_size(png, width, height), "should only read GIF images");
+    std::istringstream huge(std::string("GIF89a\xff\xff\xff\xff", 10));
+    bool ok = !read_gif_size(huge, width, height) && width == 300 && height == 400;
+    assert(ok, "should not take the size of a map too large to rasterize");
+
+    std::cout << "\tTest case: server.properties" << std::endl;
+    rules = ZoneRules::defaults();
+    rules.map_width = rules.map_height = 0;
+    const bool loaded = load_zone_rules("server.properties", rules, error);
+    assert(loaded, "could not load server.properties: " + error);
+    assert(rules.is_default() && rules.map_width == 300 && rules.map_height == 300, "bad rules from server.properties");
+
+    std::cout << "\tTest case: a map that can't be read" << std::endl;
+    const std::string properties_path = "out/test_zones.properties";
+    std::ofstream(properties_path) << "ZONE_TYPE_1=GREEN RED<10\nMAP=no such map.gif\n";
+    rules = ZoneRules::defaults();
+    ok = load_zone_rules(properties_path, rules, error);
+    ok = ok && rules.map_width == MAP_WIDTH && rules.map_height == MAP_HEIGHT && !rules.is_default();
+    assert(ok, "should load the rules with the default map size: " + error);
+    std::filesystem::remove(properties_path);
+}
+
+void test_object_store() {
+    std::cout << "ObjectStore" << std::endl;
+
+    ObjectStore store;
+    Object object;
+    object.x = object.y = object.type = object.color = 0;
+
+    std::cout << "\tTest case: empty store" << std::endl;
+    assert(store.empty() && store.find(123) == ObjectStore::NOT_FOUND, "found an object in an empty store");
+    assert(!store.erase(123), "erased an object from an empty store");
+
+    std::cout << "\tTest case: many objects keep their order" << std::endl;
+    bool added = true;
+    for (int64_t i = 0; i < 10000; i++) {
+        object.id = i << 32; // IDs that only differ in their high bits
+        object.x  = i;
+        added = store.upsert(object) && added;
+    }
+    assert(added, "updated an object that was never added");
+    bool ordered = (store.size() == 10000);
+    for (std::size_t i = 0; ordered && i < store.size(); i++) {
+        ordered = (store[i].x == (int32_t)i) && (store.find(store[i].id) == i);
+    }
+    assert(ordered, "objects out of order or not found");
+
+    std::cout << "\tTest case: updating keeps the position" << std::endl;
+    object.id = 5000ll << 32;
+    object.x  = -1;
+    assert(!store.upsert(object), "added an object that already existed");
+    assert(store.size() == 10000 && store[5000].x == -1, "update moved the object");
+
+    std::cout << "\tTest case: erasing moves the last object into the hole" << std::endl;
+    assert(store.erase(10ll << 32), "failed to erase an object");
+    assert(store.size() == 9999, "bad size after erase");
+    assert(store.find(10ll << 32) == ObjectStore::NOT_FOUND, "found an erased object");
+    assert(store[10].id == 9999ll << 32 && store.find(9999ll << 32) == 10, "last object not moved into the hole");
+    assert(store[9].id == 9ll << 32 && store[11].id == 11ll << 32, "erase moved other objects");
+
+    std::cout << "\tTest case: random operations" << std::endl;
+    // Compare against std::map with IDs from a small range so that the
+    // same IDs are added, updated, and erased many times
+    store.clear();
+    std::map<int64_t, int32_t> reference;
+    uint32_t random = 12345;
+    bool same = true;
+    for (int i = 0; same && i < 200000; i++) {
+        random = random * 1103515245 + 12345;
+        object.id = (random >> 8) % 3000;
+        object.x  = i;
+        if ((random >> 4) % 3 == 0) {
+            same = (store.erase(object.id) == (reference.erase(object.id) == 1));
+        } else {
+            same = (store.upsert(object) == (reference.count(object.id) == 0));
+            reference[object.id] = object.x;
+        }
+    }
+    same = same && (store.size() == reference.size());
+    for (const auto& entry : reference) {
+        const std::size_t index = store.find(entry.first);
+        same = same && index != ObjectStore::NOT_FOUND && store[index].x == entry.second;
+    }
+    assert(same, "store differs from the reference");
+
+    std::cout << "\tTest case: removing most objects" << std::endl;
+    store.clear();
+    for (int64_t id = 0; id < 10000; id++) {
+        object.id = id;
+        store.upsert(object);
+    }
+    for (int64_t id = 0; id < 9990; id++)  store.erase(id);
+    same = store.size() == 10;
+    for (int64_t id = 9990; id < 10000; id++)  same = same && store.find(id) != ObjectStore::NOT_FOUND;
+    assert(same && store.find(0) == ObjectStore::NOT_FOUND, "objects lost while the index shrank");
+
+    std::cout << "\tTest case: clear" << std::endl;
+    store.clear();
+    assert(store.empty() && store.find(0) == ObjectStore::NOT_FOUND, "found an object after clear");
+}
+
+void test_object_snapshot() {
+    std::cout << "ObjectSnapshot" << std::endl;
+
+    ObjectSnapshot snapshot;
+    ObjectChanges changes;
+    Object o1, o2, o3;
+    o1.id = 1;  o1.x = 10;  o1.y = 0;  o1.type = 1;  o1.color = 0;
+    o2.id = 2;  o2.x = 20;  o2.y = 0;  o2.type = 2;  o2.color = 0;
+    o3.id = 3;  o3.x = 30;  o3.y = 0;  o3.type = 3;  o3.color = 0;
+
+    std::cout << "\tTest case: no changes" << std::endl;
+    snapshot.apply(changes);
+    assert(snapshot.objects().empty(), "objects appeared from nowhere");
+
+    std::cout << "\tTest case: updates are coalesced" << std::endl;
+    changes.update(o1);
+    changes.update(o2);
+    o1.x = 11;
+    changes.update(o1);
+    assert(changes.updated.size() == 2, "an update was not coalesced");
+    snapshot.apply(changes);
+    changes.reset();
+    if (snapshot.objects().size() == 2) {
+        assert(snapshot.objects()[0] == o1, "wrong first object");
+        assert(snapshot.objects()[1] == o2, "wrong second object");
+    } else {
+        assert(false, "unexpected list length");
+    }
+
+    std::cout << "\tTest case: new objects are appended in order" << std::endl;
+    changes.update(o3);
+    o2.x = 21;
+    changes.update(o2);
+    snapshot.apply(changes);
+    changes.reset();
+    if (snapshot.objects().size() == 3) {
+        assert(snapshot.objects()[0] == o1, "wrong first object");
+        assert(snapshot.objects()[1] == o2, "wrong second object");
+        assert(snapshot.objects()[2] == o3, "wrong third object");
+    } else {
+        assert(false, "unexpected list length");
+    }
+
+    std::cout << "\tTest case: only actual changes are recorded" << std::endl;
+    changes.update(o1); // Same as before
+    o2.color = 1;
+    changes.update(o2); // New color
+    o3.y = 31;
+    changes.update(o3); // New position
+    snapshot.apply(changes);
+    changes.reset();
+    if (snapshot.changed().size() == 2) {
+        assert(identical(snapshot.changed()[0], o2), "wrong first change");
+        assert(identical(snapshot.changed()[1], o3), "wrong second change");
+    } else {
+        assert(false, "unexpected number of changes");
+    }
+    assert(!snapshot.cleared(), "cleared without clearing");
+
+    std::cout << "\tTest case: clearing drops earlier objects" << std::endl;
+    changes.update(o1);
+    changes.clear_all();
+    changes.update(o3);
+    snapshot.apply(changes);
+    changes.reset();
+    assert(snapshot.objects().size() == 1 && snapshot.objects()[0] == o3, "objects left after clearing");
+    assert(snapshot.cleared(), "clearing not recorded");
+
+    std::cout << "\tTest case: removals" << std::endl;
+    changes.update(o1);
+    changes.update(o2);
+    snapshot.apply(changes);
+    changes.reset();
+    changes.update(o2);
+    changes.remove(o2.id); // Drops the update
+    changes.remove(o3.id);
+    changes.remove(99);    // Never seen
+    assert(changes.updated.empty(), "an update of a removed object was kept");
+    snapshot.apply(changes);
+    changes.reset();
+    assert(snapshot.removed() == std::vector<int64_t>({2, 3}), "wrong removals");
+    assert(snapshot.objects().size() == 1 && snapshot.objects()[0] == o1, "wrong objects after removals");
+
+    std::cout << "\tTest case: removed and added again" << std::endl;
+    changes.remove(o1.id);
+    changes.update(o1);
+    o3.x = 33;
+    changes.update(o3);
+    changes.remove(o3.id);
+    snapshot.apply(changes);
+    changes.reset();
+    assert(snapshot.removed().empty(), "an object added again should not be removed");
+    assert(snapshot.changed().size() == 1 && identical(snapshot.changed()[0], o1), "wrong changes");
+    assert(snapshot.objects().size() == 1, "wrong objects");
+}
+
+void test_timer_wheel() {
+    std::cout << "TimerWheel" << std::endl;
+
+    TimerWheel wheel(100);
+    std::vector<int64_t> due;
+
+    std::cout << "\tTest case: timers fire at their deadlines" << std::endl;
+    wheel.schedule(1, 105);
+    wheel.schedule(2, 100 + 64 * 64 + 3); // Two levels up
+    wheel.schedule(3, 50);                // Already passed
+    wheel.advance(104, due);
+    assert(due == std::vector<int64_t>({3}), "only the passed timer should fire");
+    due.clear();
+    wheel.advance(105, due);
+    assert(due == std::vector<int64_t>({1}), "the timer should fire at its deadline");
+    due.clear();
+    wheel.advance(100 + 64 * 64 + 2, due);
+    assert(due.empty() && wheel.size() == 1, "a timer fired early");
+    wheel.advance(100 + 64 * 64 + 3, due);
+    assert(due == std::vector<int64_t>({2}) && wheel.size() == 0, "a timer from a higher level did not fire");
+
+    std::cout << "\tTest case: random deadlines" << std::endl;
+    // Compare against sorting, including deadlines past the top level
+    TimerWheel random_wheel(0);
+    std::multimap<uint64_t, int64_t> reference;
+    uint64_t random = 88172645463325252ull;
+    for (int64_t id = 0; id < 5000; id++) {
+        random ^= random << 13;  random ^= random >> 7;  random ^= random << 17;
+        const uint64_t deadline = id % 100 == 0 ? (1ull << 25) + random % 1000 : random % 300000;
+        random_wheel.schedule(id, deadline);
+        reference.emplace(deadline, id);
+    }
+    // Advance in ever larger steps, ending right after the last deadline
+    bool on_time = true;
+    const uint64_t end = (1ull << 25) + 1000;
+    for (uint64_t now = 0; now <= end; now = (now == end) ? end + 1 : std::min(end, now + 1 + now / 64)) {
+        due.clear();
+        random_wheel.advance(now, due);
+        for (const int64_t id : due) {
+            const auto first = reference.begin();
+            on_time = on_time && first->first <= now && first->second == id;
+            reference.erase(first);
+        }
+        on_time = on_time && (reference.empty() || reference.begin()->first > now);
+    }
+    due.clear();
+    random_wheel.advance(1ull << 26, due);
+    assert(on_time && due.empty() && reference.empty() && random_wheel.size() == 0, "timers fired out of order");
+}
+
+void test_object_expiry() {
+    std::cout << "ObjectExpiry" << std::endl;
+
+    ObjectExpiry expiry(1000, 5000);
+    std::vector<int64_t> expired;
+
+    std::cout << "\tTest case: objects expire after the time to live" << std::endl;
+    expiry.seen(1, 5000);
+    expiry.seen(2, 5500);
+    expiry.expire(5999, expired);
+    assert(expired.empty(), "expired early");
+    expiry.expire(6000 + ObjectExpiry::TICK, expired);
+    assert(expired == std::vector<int64_t>({1}), "the first object should have expired");
+
+    std::cout << "\tTest case: seeing an object postpones its expiry" << std::endl;
+    expired.clear();
+    expiry.seen(2, 6300);
+    expiry.expire(7000, expired);
+    assert(expired.empty(), "expired although it was seen again");
+    expiry.expire(7300 + ObjectExpiry::TICK, expired);
+    assert(expired == std::vector<int64_t>({2}), "the second object should have expired");
+
+    std::cout << "\tTest case: no time to live" << std::endl;
+    expired.clear();
+    expiry.set_ttl(0, 10000);
+    expiry.seen(5, 10000);
+    expiry.expire(1000000, expired);
+    assert(expired.empty(), "expired without a time to live");
+}
+
+// Brute-force answers to compare SpatialGrid's with
+std::vector<int64_t> brute_within(const std::map<int64_t, Object>& all, int32_t x, int32_t y, int64_t radius) {
+    std::vector<int64_t> ids;
+    for (const auto& [id, object] : all) {
+        if (distance_squared(object.x, object.y, x, y) < static_cast<uint64_t>(radius * radius))  ids.push_back(id);
+    }
+    return ids;
+}
+
+std::vector<int64_t> brute_nearest(const std::map<int64_t, Object>& all, int32_t x, int32_t y, std::size_t k) {
+    std::vector<std::pair<uint64_t, int64_t>> sorted;
+    for (const auto& [id, object] : all)  sorted.emplace_back(distance_squared(object.x, object.y, x, y), id);
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<int64_t> ids;
+    for (std::size_t i = 0; i < k && i < sorted.size(); i++)  ids.push_back(sorted[i].second);
+    return ids;
+}
+
+void test_spatial_grid() {
+    std::cout << "SpatialGrid" << std::endl;
+
+    SpatialGrid grid(10);
+    std::vector<int64_t> ids;
+    Object object;
+    object.color = 0;
+
+    std::cout << "\tTest case: empty grid" << std::endl;
+    grid.within(0, 0, 100, ids);
+    assert(ids.empty(), "should find nothing within a radius");
+    grid.nearest(0, 0, 5, ids);
+    assert(ids.empty(), "should find nothing nearest");
+    assert(!grid.erase(1), "should not erase a missing object");
+
+    std::cout << "\tTest case: objects on both sides of 0" << std::endl;
+    object.type = 1;
+    object.id = 1; object.x = -1; object.y = -1;
+    grid.update(object);
+    object.id = 2; object.x = 1;  object.y = 1;
+    grid.update(object);
+    object.id = 3; object.x = 12; object.y = 0;
+    grid.update(object);
+    grid.within(0, 0, 2, ids);
+    std::sort(ids.begin(), ids.end());
+    assert(ids == std::vector<int64_t>({1, 2}), "should find the objects next to 0");
+    grid.within(0, 0, 12, ids);
+    assert(ids.size() == 2, "should not find an object exactly at the radius");
+    grid.nearest(11, 0, 2, ids);
+    assert(ids == std::vector<int64_t>({3, 2}), "bad nearest objects");
+
+    std::cout << "\tTest case: moving and removing objects" << std::endl;
+    object.id = 3; object.x = -500; object.y = 700;
+    grid.update(object);
+    grid.nearest(-490, 690, 1, ids);
+    assert(ids == std::vector<int64_t>({3}), "the object should have moved");
+    grid.within(12, 0, 5, ids);
+    assert(ids.empty(), "the object should have left its old cell");
+    assert(grid.erase(1) && grid.size() == 2, "should erase the object");
+    grid.within(0, 0, 5, ids);
+    assert(ids == std::vector<int64_t>({2}), "the erased object should be gone");
+
+    std::cout << "\tTest case: random objects and queries" << std::endl;
+    grid.clear();
+    std::map<int64_t, Object> all;
+    uint32_t random = 777;
+    const auto next = [&]() { random = random * 1103515245 + 12345; return random >> 8; };
+    bool same = true;
+    for (int i = 0; i < 20000; i++) {
+        object.id   = next() % 2000;
+        object.x    = static_cast<int32_t>(next() % 400) - 50;
+        object.y    = static_cast<int32_t>(next() % 400) - 50;
+        object.type = next() % 4;
+        if (next() % 10 == 0) {
+            grid.erase(object.id);
+            all.erase(object.id);
+        } else {
+            grid.update(object);
+            all[object.id] = object;
+        }
+
+        if (i % 500 == 0) {
+            const int32_t x = static_cast<int32_t>(next() % 600) - 150;
+            const int32_t y = static_cast<int32_t>(next() % 600) - 150;
+            const int64_t radius = next() % 120;
+            grid.within(x, y, radius, ids);
+            std::sort(ids.begin(), ids.end());
+            same = same && ids == brute_within(all, x, y, radius);
+            const std::size_t k = 1 + next() % 20;
+            grid.nearest(x, y, k, ids);
+            same = same && ids == brute_nearest(all, x, y, k);
+        }
+    }
+    assert(same && grid.size() == all.size(), "the grid should agree with a brute-force scan");
+
+    grid.nearest(INT32_MAX, INT32_MIN, 3, ids);
+    assert(ids == brute_nearest(all, INT32_MAX, INT32_MIN, 3), "bad nearest objects far off the map");
+    grid.within(0, 0, INT64_MAX, ids);
+    assert(ids.size() == all.size(), "a huge radius should find every object");
+
+    std::cout << "\tTest case: coloring per zone" << std::endl;
+    for (const ZoneRules& rules : {ZoneRules::defaults(), [] {
+        ZoneRules rules = ZoneRules::defaults();
+        rules.points = {ZonePoint{0, 0}, ZonePoint{300, 300}, ZonePoint{150, 100}};
+        rules.other.rings = {ZoneRing{YELLOW_LEVEL, 40 * 40}};
+        return rules;
+    }()}) {
+        std::vector<std::pair<int64_t, uint8_t>> raised, expected;
+        grid.zone_levels(rules, raised);
+        std::sort(raised.begin(), raised.end());
+        for (const auto& [id, object] : all) {
+            const uint8_t level = rules.evaluate(object.x, object.y, object.type);
+            if (level > rules.rules_for(object.type).base)  expected.emplace_back(id, level);
+        }
+        assert(!expected.empty() && raised == expected, "should raise the same objects as the rules");
+    }
+
+    std::cout << "\tTest case: queries on the global list" << std::endl;
+    clear_objects();
+    object.id = 10; object.x = 150; object.y = 150;
+    add_or_update_object(object);
+    object.id = 11; object.x = 160; object.y = 150;
+    add_or_update_object(object);
+    object.id = 10; object.x = 400;
+    add_or_update_object(object);
+    const std::vector<Object> within = objects_within(150, 150, 20);
+    assert(within.size() == 1 && within[0].id == 11, "bad objects within a radius");
+    const std::vector<Object> nearest = nearest_objects(390, 150, 2);
+    assert(nearest.size() == 2 && nearest[0].id == 10 && nearest[1].id == 11, "bad nearest objects");
+    clear_objects();
+    assert(objects_within(150, 150, 1000).empty(), "the index should be cleared with the list");
+}
+
+void test_track_history() {
+    std::cout << "TrackHistory" << std::endl;
+
+    TrackHistory tracks;
+    double vx, vy;
+    const uint64_t SECOND = 1000000000;
+
+    std::cout << "\tTest case: too few samples" << std::endl;
+    tracks.record(0, SECOND, 10, 10);
+    assert(tracks.size() == 1 && tracks.samples(0) == 1, "should add a track");
+    assert(!tracks.velocity(0, vx, vy), "should not estimate a velocity from one sample");
+    tracks.record(0, SECOND, 12, 10);
+    assert(!tracks.velocity(0, vx, vy), "should not estimate a velocity from samples at the same time");
+
+    std::cout << "\tTest case: steady motion" << std::endl;
+    tracks.reset(0);
+    for (int i = 0; i < 5; i++)  tracks.record(0, SECOND + i * SECOND / 10, 100 + 3 * i, 50 - i);
+    bool ok = tracks.velocity(0, vx, vy) && std::abs(vx - 30) < 1e-6 && std::abs(vy + 10) < 1e-6;
+    assert(ok, "should find the velocity of a straight line");
+
+    std::cout << "\tTest case: only the last samples are kept" << std::endl;
+    // A turn that's older than the ring doesn't count
+    for (int i = 0; i < 20; i++)  tracks.record(0, 2 * SECOND + i * SECOND / 10, 200, 200 + 5 * i);
+    ok = tracks.samples(0) == TrackHistory::SAMPLES && tracks.velocity(0, vx, vy);
+    ok = ok && std::abs(vx) < 1e-6 && std::abs(vy - 50) < 1e-6;
+    assert(ok, "should forget the oldest samples");
+
+    std::cout << "\tTest case: noisy motion" << std::endl;
+    tracks.record(1, SECOND, 0, 0);
+    tracks.record(1, 2 * SECOND, 11, 0);
+    tracks.record(1, 3 * SECOND, 19, 0);
+    tracks.record(1, 4 * SECOND, 30, 0);
+    ok = tracks.velocity(1, vx, vy) && std::abs(vx - 9.8) < 1e-6 && vy == 0;
+    assert(ok, "should fit a line through noisy samples");
+
+    std::cout << "\tTest case: removing moves the last track" << std::endl;
+    tracks.record(2, SECOND, 5, 5);
+    tracks.remove(0);
+    ok = tracks.size() == 2 && tracks.samples(0) == 1 && tracks.samples(1) == 4;
+    tracks.remove(1);
+    ok = ok && tracks.size() == 1 && tracks.samples(0) == 1;
+    assert(ok, "should keep the tracks at the same indices as an ObjectStore");
+}
+
+void test_predict_color() {
+    std::cout << "predict_color()" << std::endl;
+
+    const ZoneRules rules = ZoneRules::defaults();
+    double seconds;
+
+    std::cout << "\tTest case: heading straight for the designated coordinate" << std::endl;
+    // 100 away at 50 per second, so type 1 is 75 away in 0.5 s and 50 away in 1 s
+    assert(rules.predict(250, 150, 1, GREEN_LEVEL, -50, 0, 2, seconds) == RED_LEVEL && std::abs(seconds - 1) < 1e-9,
+           "should predict red when it's within the horizon");
+    assert(rules.predict(250, 150, 1, GREEN_LEVEL, -50, 0, 0.7, seconds) == YELLOW_LEVEL && std::abs(seconds - 0.5) < 1e-9,
+           "should predict yellow when red is beyond the horizon");
+    assert(rules.predict(250, 150, 1, GREEN_LEVEL, -50, 0, 0.2, seconds) == GREEN_LEVEL,
+           "should predict nothing when no zone is within the horizon");
+
+    std::cout << "\tTest case: heading away or passing by" << std::endl;
+    assert(rules.predict(250, 150, 1, GREEN_LEVEL, 50, 0, 100, seconds) == GREEN_LEVEL, "should not predict a zone behind it");
+    assert(rules.predict(250, 230, 1, GREEN_LEVEL, -50, 0, 100, seconds) == GREEN_LEVEL, "should not predict a zone it misses");
+    assert(rules.predict(250, 150, 1, GREEN_LEVEL, 0, 0, 100, seconds) == GREEN_LEVEL, "should not predict for a still object");
+    assert(rules.predict(250, 150, 2, YELLOW_LEVEL, -50, 0, 100, seconds) == YELLOW_LEVEL,
+           "should not predict a color that isn't more severe");
+
+    std::cout << "\tTest case: the color and time are set on the object" << std::endl;
+    Object object = {1, 250, 150, 3, YELLOW};
+    predict_color(object, -100, 0, 1);
+    assert(object.predicted == RED && object.time_to_zone == 0, "should predict red at the edge of its zone");
+    object.x = 260;
+    predict_color(object, -100, 0, 1);
+    assert(object.predicted == RED && object.time_to_zone == 100, "should predict red in 100 ms");
+    predict_color(object, 100, 0, 1);
+    assert(object.predicted == 0 && object.time_to_zone == 0, "should clear the prediction");
+
+    std::cout << "\tTest case: colors predicted from the tracks in the global list" << std::endl;
+    clear_objects();
+    set_prediction_horizon(std::chrono::milliseconds(2000));
+    const uint64_t start = stats_clock();
+    for (int i = 0; i < 4; i++) {
+        // Object 1 heads for the designated coordinate at 40 per second, object 2 stands still
+        const Object batch[] = {{1, 300 - 4 * i, 150, 1, GREEN}, {2, 10, 10, 1, GREEN}};
+        add_or_update_objects(batch, 2, start + i * 100000000);
+    }
+    // 138 away, so it's 75 away in 1575 ms and 50 away in 2200 ms
+    std::vector<Object> found = objects_within(288, 150, 1);
+    bool ok = found.size() == 1 && found[0].predicted == YELLOW && found[0].time_to_zone == 1575;
+    assert(ok, "should predict yellow, as red is beyond the horizon");
+    found = objects_within(10, 10, 1);
+    assert(found.size() == 1 && found[0].predicted == 0, "should predict nothing for a still object");
+
+    std::stringstream frame;
+    relay_info_once(frame, FrameFormat::HEX, true);
+    assert(frame.str().rfind("0000fefe00000002", 0) == 0, "should relay the predictions");
+
+    set_prediction_horizon(std::chrono::milliseconds(0));
+    clear_objects(); // Remove side effects
+}
+
 void test_add_or_update_object() {
     std::cout << "add_or_update_object()" << std::endl;
 
@@ -353,7 +1547,7 @@ void test_add_or_update_object() {
     o4.type = 1;
 
     std::cout << "\tTest case: adding unique objects" << std::endl;
-    objects.clear();
+    clear_objects();
     add_or_update_object(o1);
     add_or_update_object(o2);
     add_or_update_object(o3);
@@ -366,7 +1560,7 @@ void test_add_or_update_object() {
     }
 
     std::cout << "\tTest case: updating same objects" << std::endl;
-    objects.clear();
+    clear_objects();
     add_or_update_object(o1);
     add_or_update_object(o2);
     add_or_update_object(o3);
@@ -380,7 +1574,935 @@ void test_add_or_update_object() {
         assert(false, "unexpected list length");
     }
 
-    objects.clear(); // Remove side effects
+    std::cout << "\tTest case: batches from many threads" << std::endl;
+    clear_objects();
+    std::vector<std::thread> feeds;
+    for (int feed = 0; feed < 4; feed++) {
+        feeds.emplace_back([feed]() {
+            std::vector<Object> batch(10);
+            for (int round = 0; round < 100; round++) {
+                for (int i = 0; i < 10; i++) {
+                    batch[i].id   = feed * 1000 + round * 10 + i;
+                    batch[i].x    = round;
+                    batch[i].y    = 0;
+                    batch[i].type = 1;
+                }
+                add_or_update_objects(batch.data(), batch.size());
+            }
+        });
+    }
+    for (auto& feed : feeds)  feed.join();
+    bool all_found = (objects.size() == 4000);
+    for (int64_t id = 0; all_found && id < 4000; id++) {
+        all_found = objects.find(id) != ObjectStore::NOT_FOUND;
+    }
+    assert(all_found, "objects missing after concurrent batches");
+
+    clear_objects(); // Remove side effects
+}
+
+void test_append_hex_frame() {
+    std::cout << "append_hex_frame()" << std::endl;
+
+    std::string frame;
+    std::stringstream ss;
+
+    std::cout << "\tTest case: same output as stream manipulators" << std::endl;
+    // Format random objects, including negative values, the way
+    // relay_info_once() used to with std::setw and std::hex
+    std::vector<Object> many(100);
+    uint64_t random = 88172645463325252ull;
+    for (auto& object : many) {
+        random ^= random << 13;  random ^= random >> 7;  random ^= random << 17;
+        object.id    = random;
+        object.x     = random >> 3;
+        object.y     = random >> 17;
+        object.type  = random >> 29;
+        object.color = random >> 31;
+    }
+    ss << std::hex << std::setfill('0');
+    ss << std::setw(8) << 0xfeff << std::setw(8) << many.size();
+    for (const auto& object : many) {
+        ss << std::setw(16) << object.id << std::setw(8) << object.x << std::setw(8) << object.y;
+        ss << std::setw(8) << object.type << std::setw(8) << object.color;
+    }
+    frame.clear();
+    append_hex_frame(frame, many.data(), many.size());
+    assert(frame == ss.str(), "bad output");
+
+    std::cout << "\tTest case: appending to an earlier frame" << std::endl;
+    frame = "earlier";
+    append_hex_frame(frame, nullptr, 0);
+    assert(frame == "earlier0000feff00000000", "bad output");
+}
+
+void test_append_binary_frame() {
+    std::cout << "append_binary_frame()" << std::endl;
+
+    std::string frame;
+    Object object;
+    object.id    = 0x0102030405060708;
+    object.x     = -2; // 0xfffffffe
+    object.y     = 0x11223344;
+    object.type  = 0x00000003;
+    object.color = 0xa1b2c3d4;
+
+    std::cout << "\tTest case: relay zero objects" << std::endl;
+    append_binary_frame(frame, nullptr, 0);
+    assert(frame == std::string("\xff\xfe\x00\x00\x00\x00\x00\x00", 8), "bad output");
+
+    std::cout << "\tTest case: relay one object" << std::endl;
+    frame.clear();
+    append_binary_frame(frame, &object, 1);
+    std::string expected_string("\xff\xfe\x00\x00", 4);      // Preamble
+    expected_string += std::string("\x01\x00\x00\x00", 4);   // Count
+    expected_string += "\x08\x07\x06\x05\x04\x03\x02\x01"; // ID
+    expected_string += "\xfe\xff\xff\xff";                 // X
+    expected_string += "\x44\x33\x22\x11";                 // Y
+    expected_string += std::string("\x03\x00\x00\x00", 4);   // Type
+    expected_string += "\xd4\xc3\xb2\xa1";                 // Color
+    assert(frame == expected_string, "bad output");
+    assert(frame.length() == 8 + 24, "bad length");
+
+    std::cout << "\tTest case: relay a delta frame" << std::endl;
+    frame.clear();
+    const int64_t removed = -2;
+    append_delta_frame(frame, FrameFormat::BINARY, &object, 1, &removed, 1);
+    expected_string[0] = '\xfd'; // Delta preamble, otherwise the same start as the full frame
+    expected_string += std::string("\x01\x00\x00\x00", 4);   // Removed count
+    expected_string += "\xfe\xff\xff\xff\xff\xff\xff\xff"; // Removed ID
+    assert(frame == expected_string, "bad output");
+
+    std::cout << "\tTest case: relay predictions" << std::endl;
+    object.predicted    = 0x1b5b316d;
+    object.time_to_zone = 1500;
+    frame.clear();
+    append_frame(frame, FrameFormat::BINARY, &object, 1, true);
+    expected_string = std::string("\xfe\xfe\x00\x00", 4);  // Predicted preamble
+    expected_string += std::string("\x01\x00\x00\x00", 4); // Count
+    expected_string += "\x08\x07\x06\x05\x04\x03\x02\x01\xfe\xff\xff\xff\x44\x33\x22\x11";
+    expected_string += std::string("\x03\x00\x00\x00", 4);
+    expected_string += "\xd4\xc3\xb2\xa1";
+    expected_string += "\x6d\x31\x5b\x1b";                 // Predicted color
+    expected_string += std::string("\xdc\x05\x00\x00", 4); // Time to zone
+    assert(frame == expected_string && frame.length() == 8 + 32, "bad output");
+
+    frame.clear();
+    append_delta_frame(frame, FrameFormat::HEX, &object, 1, &removed, 1, true);
+    assert(frame.rfind("0000fefc00000001", 0) == 0, "should start with the predicted delta preamble");
+    assert(frame.length() == 2 * (8 + 32 + 4 + 8), "bad length");
+}
+
+// Milliseconds that the trigger takes to let wait() return
+long long wait_milliseconds(RelayTrigger& trigger, bool& relayed) {
+    const auto start = std::chrono::steady_clock::now();
+    relayed = trigger.wait();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+}
+
+// Write a capture file by hand, with the chunks at the given times
+void write_capture(const std::string& path, const std::vector<std::pair<uint64_t, std::string>>& chunks,
+                   const std::vector<uint32_t>& feeds) {
+    std::ofstream file(path, std::ios::binary);
+    file.write(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    for (std::size_t i = 0; i < chunks.size(); i++) {
+        const CaptureHeader header = {chunks[i].first, feeds[i], static_cast<uint32_t>(chunks[i].second.length())};
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(chunks[i].second.data(), chunks[i].second.length());
+    }
+}
+
+// Milliseconds that replaying the capture takes
+long long replay_milliseconds(CaptureReader& capture, double speed) {
+    const auto start = std::chrono::steady_clock::now();
+    replay_capture(capture, speed);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+}
+
+void test_capture() {
+    std::cout << "Capture" << std::endl;
+
+    const std::string path = "out/test_capture.bin";
+    std::string error;
+    CaptureRecord record;
+
+    std::cout << "\tTest case: write and read chunks" << std::endl;
+    CaptureWriter writer;
+    bool ok = writer.open(path, error);
+    assert(ok, "could not create the capture: " + error);
+    if (ok) {
+        writer.record(0, "ID=1;X=", 7);
+        writer.record(1, "", 0);
+        writer.record(1, "ID=2;X=5;Y=6;TYPE=2\n", 20);
+    }
+    ok = writer.close() && ok;
+    assert(ok, "could not write the capture");
+
+    CaptureReader reader;
+    ok = reader.open(path, error);
+    assert(ok, "could not read the capture: " + error);
+    ok = reader.next(record) && record.feed == 0 && std::string(record.data, record.length) == "ID=1;X=";
+    const uint64_t first_time = record.time;
+    ok = ok && reader.next(record) && record.feed == 1 && record.length == 0;
+    ok = ok && reader.next(record) && record.feed == 1 && std::string(record.data, record.length) == "ID=2;X=5;Y=6;TYPE=2\n";
+    ok = ok && record.time >= first_time && !reader.next(record) && !reader.truncated();
+    assert(ok, "the chunks read differ from those written");
+
+    std::cout << "\tTest case: reopen after a failed capture" << std::endl;
+    if (std::filesystem::exists("/dev/full") && writer.open("/dev/full", error)) {
+        writer.record(0, "ID=1;X=", 7);
+        assert(!writer.close(), "writing to a full device should fail");
+    }
+    ok = writer.open(path, error) && writer.close();
+    assert(ok, "a reopened capture should not report an earlier failure");
+
+    std::cout << "\tTest case: record without a file" << std::endl;
+    CaptureWriter unopened;
+    unopened.record(0, "ID=1;X=", 7);
+    assert(!unopened.close(), "recording without a file should fail");
+
+    std::cout << "\tTest case: a truncated capture" << std::endl;
+    write_capture(path, {{0, "ID=1;X=1;Y=1;TYPE=1\n"}, {1, "ID=2;X=1;Y=1;TYPE=1\n"}}, {0, 0});
+    std::error_code missing; // The capture may not have been written, which the asserts report
+    const auto size = std::filesystem::file_size(path, missing);
+    if (!missing)  std::filesystem::resize_file(path, size - 5, missing);
+    ok = reader.open(path, error) && reader.next(record) && !reader.next(record) && reader.truncated();
+    assert(ok, "should read the whole chunks and stop at the cut one");
+
+    std::cout << "\tTest case: not a capture" << std::endl;
+    std::ofstream(path) << "ID=1;X=1;Y=1;TYPE=1\n";
+    assert(!reader.open(path, error), "should not read a file without the magic");
+    std::ofstream(path).close();
+    assert(!reader.open(path, error), "should not read an empty file");
+    assert(!reader.open("out/no such capture", error), "should not read a missing file");
+
+    std::cout << "\tTest case: replay lines cut across chunks and feeds" << std::endl;
+    clear_objects();
+    write_capture(path, {{0, "ID=1;X=10;"}, {0, "ID=2;X=20;Y=0;TY"}, {0, "Y=0;TYPE=1\nID=3;X=30;Y=0;TYPE=3\n"},
+                         {0, "PE=2\n"}, {0, "ID=1;X=11;Y=0;TYPE=1\nID=4;X=4"}},
+                  {0, 1, 0, 1, 0});
+    ok = reader.open(path, error);
+    const std::size_t chunks = ok ? replay_capture(reader, 0) : 0;
+    assert(chunks == 5, "should replay every chunk");
+    ok = objects.size() == 3;
+    for (const int64_t id : {1, 2, 3})  ok = ok && objects.find(id) != ObjectStore::NOT_FOUND;
+    ok = ok && objects[objects.find(1)].x == 11 && objects[objects.find(2)].type == 2;
+    assert(ok, "the replay gave the wrong objects");
+
+    std::cout << "\tTest case: replay with the captured timing" << std::endl;
+    write_capture(path, {{0, "ID=1;X=1;Y=1;TYPE=1\n"}, {200000000, "ID=1;X=2;Y=1;TYPE=1\n"}}, {0, 0});
+    ok = reader.open(path, error);
+    long long waited = replay_milliseconds(reader, 1);
+    assert(ok && waited >= 190 && waited < 400, "a replay at 1x took " + std::to_string(waited) + " ms");
+    reader.rewind();
+    waited = replay_milliseconds(reader, 4);
+    assert(waited >= 40 && waited < 150, "a replay at 4x took " + std::to_string(waited) + " ms");
+    reader.rewind();
+    waited = replay_milliseconds(reader, 0);
+    assert(waited < 40, "a replay at max speed took " + std::to_string(waited) + " ms");
+
+    clear_objects(); // Remove side effects
+    std::filesystem::remove(path);
+}
+
+void test_latency_histogram() {
+    std::cout << "LatencyHistogram" << std::endl;
+
+    std::cout << "\tTest case: buckets cover every value in order" << std::endl;
+    bool ok = LatencyHistogram::bucket(UINT64_MAX) == LatencyHistogram::BUCKETS - 1;
+    for (unsigned bucket = 0; bucket < LatencyHistogram::BUCKETS; bucket++) {
+        const uint64_t floor = LatencyHistogram::bucket_floor(bucket);
+        ok = ok && LatencyHistogram::bucket(floor) == bucket;
+        if (bucket > 0)  ok = ok && LatencyHistogram::bucket(floor - 1) == bucket - 1;
+    }
+    assert(ok, "the buckets don't line up with their floors");
+
+    std::cout << "\tTest case: buckets are narrow relative to their values" << std::endl;
+    ok = true;
+    for (unsigned bucket = LatencyHistogram::SUB_BUCKETS; bucket + 1 < LatencyHistogram::BUCKETS; bucket++) {
+        const uint64_t floor = LatencyHistogram::bucket_floor(bucket);
+        const uint64_t width = LatencyHistogram::bucket_floor(bucket + 1) - floor;
+        ok = ok && width * LatencyHistogram::SUB_BUCKETS <= floor;
+    }
+    assert(ok, "a bucket is wider than its share of its values");
+
+    std::cout << "\tTest case: percentiles" << std::endl;
+    LatencyHistogram histogram;
+    assert(histogram.percentile(0.5) == 0 && histogram.count() == 0, "an empty histogram has no percentiles");
+    for (uint64_t value = 1; value <= 1000; value++)  histogram.record(value * 1000);
+    assert(histogram.count() == 1000 && histogram.max() == 1000000, "bad count or max");
+    ok = true;
+    for (const double share : {0.01, 0.5, 0.9, 0.99}) {
+        const double exact = share * 1000000;
+        const double estimate = histogram.percentile(share);
+        ok = ok && estimate >= exact && estimate <= exact * 1.125;
+    }
+    assert(ok, "a percentile is further off than a bucket");
+    assert(histogram.percentile(1) == 1000000, "the 100th percentile should be the max");
+
+    std::cout << "\tTest case: add histograms together" << std::endl;
+    LatencyHistogram other, total;
+    other.record(5);
+    other.record(2000000);
+    histogram.add_to(total);
+    other.add_to(total);
+    ok = total.count() == 1002 && total.max() == 2000000 && total.percentile(0) == 5;
+    assert(ok, "the sum of histograms is wrong");
+}
+
+void test_thread_stats() {
+    std::cout << "ThreadStats" << std::endl;
+
+    std::cout << "\tTest case: add up the counts of many threads" << std::endl;
+    ThreadStats before;
+    collect_stats(before);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([]() {
+            ThreadStats &stats = thread_stats();
+            for (int j = 0; j < 10000; j++) {
+                count(stats.lines);
+                count(stats.bytes, 20);
+                stats.stage(Stage::PARSE).record(j);
+            }
+            count(stats.parse_errors[static_cast<std::size_t>(ParseError::TYPE)]);
+        });
+    }
+    for (auto& thread : threads)  thread.join();
+
+    ThreadStats after;
+    collect_stats(after);
+    bool ok = after.lines - before.lines == 40000 && after.bytes - before.bytes == 800000;
+    ok = ok && after.stage(Stage::PARSE).count() - before.stage(Stage::PARSE).count() == 40000;
+    ok = ok && after.parse_errors[static_cast<std::size_t>(ParseError::TYPE)]
+             - before.parse_errors[static_cast<std::size_t>(ParseError::TYPE)] == 4;
+    assert(ok, "the counts of the threads weren't all added up");
+
+    std::cout << "\tTest case: the same stats for the same thread" << std::endl;
+    assert(&thread_stats() == &thread_stats(), "a thread got new stats");
+
+    std::cout << "\tTest case: the pipeline counts and times what it does" << std::endl;
+    clear_objects();
+    ThreadStats start;
+    collect_stats(start);
+    const std::string path = "out/test_stats.bin";
+    write_capture(path, {{0, "ID=1;X=1;Y=1;TYPE=1\nID=2;X=1;Y=1;TYPE=1\n"}, {0, "ID=1;X=2;Y=1;TYPE=1\nID=3;X=1;Y=1;TYPE=7\n"}},
+                  {0, 0});
+    CaptureReader reader;
+    std::string error;
+    std::stringstream stream;
+    std::streambuf *log_buffer = std::clog.rdbuf(stream.rdbuf()); // Hide the parse error
+    ok = reader.open(path, error) && replay_capture(reader, 0) == 2;
+    std::clog.rdbuf(log_buffer);
+    relay_info_once(stream);
+    ThreadStats end;
+    collect_stats(end);
+    ok = ok && end.lines - start.lines == 4 && end.inserts - start.inserts == 2 && end.updates - start.updates == 1;
+    ok = ok && end.parse_errors[static_cast<std::size_t>(ParseError::TYPE)]
+             - start.parse_errors[static_cast<std::size_t>(ParseError::TYPE)] == 1;
+    ok = ok && end.stage(Stage::PARSE).count() - start.stage(Stage::PARSE).count() == 2;
+    ok = ok && end.relays - start.relays == 1;
+    ok = ok && end.stage(Stage::RECEIVE_TO_RELAY).count() - start.stage(Stage::RECEIVE_TO_RELAY).count() == 1;
+    assert(ok, "the pipeline stats are wrong");
+
+    std::stringstream printed;
+    print_stats(printed, end);
+    ok = printed.str().find("invalid type") != std::string::npos && printed.str().find("receive to relay") != std::string::npos;
+    assert(ok, "the printed stats lack the parse errors or stages");
+
+    clear_objects(); // Remove side effects
+    std::filesystem::remove(path);
+}
+
+// Throws away what's written to it, without allocating
+class DiscardBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize count) override { return count; }
+};
+
+void test_allocations() {
+    std::cout << "Allocations" << std::endl;
+
+    std::cout << "\tTest case: count what this thread allocates" << std::endl;
+    uint64_t before = thread_allocations();
+    int *number = new int(5);
+    std::string text(100, 'x');
+    bool ok = thread_allocations() - before == 2;
+    delete number;
+    ok = ok && thread_allocations() - before == 2;
+    assert(ok, "should count each allocation once and nothing else");
+
+    before = thread_allocations();
+    std::thread([]() { std::string text(100, 'x'); }).join();
+    assert(thread_allocations() - before <= 2, "should not count the allocations of other threads");
+
+    std::cout << "\tTest case: nothing is allocated per record once warm" << std::endl;
+    clear_objects();
+    FeedParser parser("test");
+    std::vector<Object> batch;
+    DiscardBuffer discard;
+    std::ostream relay_stream(&discard);
+
+    // The objects move all over the map and back every 4 rounds, so that
+    // cells are dropped and made again, and each round is parsed in chunks
+    // that cut lines and relayed, as a delta and then as a keyframe
+    const auto ingest_round = [&](int round) {
+        std::string data;
+        for (int id = 0; id < 2000; id++) {
+            const int step = round % 4;
+            data += "ID=" + std::to_string(id) + ";X=" + std::to_string((id * 7 + step * 97) % 300);
+            data += ";Y=" + std::to_string((id * 3 + step * 41) % 300) + ";TYPE=" + std::to_string(1 + id % 3) + "\n";
+        }
+        uint64_t allocations = 0;
+        for (std::size_t offset = 0; offset < data.length(); offset += 4000) {
+            const std::size_t length = std::min<std::size_t>(4000, data.length() - offset);
+            const uint64_t start = thread_allocations();
+            std::memcpy(parser.prepare(length), data.data() + offset, length);
+            parser.parse(length, batch);
+            add_or_update_objects(batch.data(), batch.size());
+            allocations += thread_allocations() - start;
+        }
+        const uint64_t start = thread_allocations();
+        relay_info_once(relay_stream, FrameFormat::BINARY, false);
+        relay_info_once(relay_stream, FrameFormat::HEX, true);
+        return allocations + thread_allocations() - start;
+    };
+    for (int round = 0; round < 8; round++)  ingest_round(round);
+    uint64_t allocations = 0;
+    for (int round = 8; round < 20; round++)  allocations += ingest_round(round);
+    assert(objects.size() == 2000, "the objects weren't all added");
+    assert(allocations == 0, std::to_string(allocations) + " allocations for 24000 records");
+
+    clear_objects(); // Remove side effects
+}
+
+// Make a pipe, with the read end first. Returns false if that fails.
+bool make_pipe(int (&fds)[2]) {
+#ifdef _WIN32
+    return _pipe(fds, 1 << 16, _O_BINARY) == 0;
+#else
+    return pipe(fds) == 0;
+#endif
+}
+
+void close_fd(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+/*
+ * Read everything from the pipe until its write end is closed, on a
+ * thread of its own.
+ */
+std::thread read_pipe(int fd, std::string &read) {
+    return std::thread([fd, &read]() {
+        char buffer[4096];
+        while (true) {
+#ifdef _WIN32
+            const int length = _read(fd, buffer, sizeof(buffer));
+#else
+            const ssize_t length = ::read(fd, buffer, sizeof(buffer));
+#endif
+            if (length <= 0)  break;
+            read.append(buffer, length);
+        }
+    });
+}
+
+/*
+ * Start a writer on a pipe that nothing reads yet, and stall it with a
+ * keyframe larger than the pipe holds. The frames submitted next then
+ * wait in the queue until finish_writer() is called.
+ */
+std::string stall_writer(FrameWriter &writer, int (&fds)[2], SlowOutputPolicy policy) {
+    make_pipe(fds);
+    writer.attach(fds[1]);
+    writer.start(policy, 4);
+    std::string stall(1 << 20, '#');
+    const std::string written = stall;
+    writer.submit(stall, true);
+    while (writer.queued_frames() > 0)  std::this_thread::yield();
+    return written;
+}
+
+// Read the pipe while the writer writes what's left, and return all of it
+std::string finish_writer(FrameWriter &writer, int (&fds)[2]) {
+    std::string read;
+    std::thread reader = read_pipe(fds[0], read);
+    writer.close();
+    close_fd(fds[1]);
+    reader.join();
+    close_fd(fds[0]);
+    return read;
+}
+
+void test_frame_writer() {
+    std::cout << "FrameWriter" << std::endl;
+
+    FrameWriter writer;
+    int fds[2];
+    bool ok;
+    const auto submit = [&writer](std::string frame, bool keyframe) { return writer.submit(frame, keyframe); };
+
+    std::cout << "\tTest case: write every frame in order" << std::endl;
+    assert(make_pipe(fds), "could not make a pipe");
+    writer.attach(fds[1]);
+    writer.start(SlowOutputPolicy::BLOCK, 4);
+    std::string read;
+    std::thread reader = read_pipe(fds[0], read);
+    std::string expected;
+    ok = true;
+    for (int i = 0; i < 2000; i++) {
+        const std::string frame = "frame " + std::to_string(i) + (i % 10 ? "" : std::string(10000, '.')) + "\n";
+        ok = submit(frame, i % 10 == 0) && ok;
+        expected += frame;
+    }
+    ok = writer.close() && ok;
+    close_fd(fds[1]);
+    reader.join();
+    close_fd(fds[0]);
+    assert(ok, "should take and write every frame");
+    assert(read == expected, "the frames written differ from those submitted");
+    assert(writer.dropped_frames() == 0, "should not drop frames when blocking");
+
+    std::cout << "\tTest case: block until the output catches up" << std::endl;
+    std::string stall = stall_writer(writer, fds, SlowOutputPolicy::BLOCK);
+    for (int i = 0; i < 4; i++)  submit("D" + std::to_string(i) + "\n", false);
+    std::atomic<bool> submitted{false};
+    std::thread blocked([&]() { submit("K\n", true); submitted = true; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    assert(!submitted, "should wait while the queue is full");
+    read.clear();
+    reader = read_pipe(fds[0], read);
+    blocked.join();
+    writer.close();
+    close_fd(fds[1]);
+    reader.join();
+    close_fd(fds[0]);
+    assert(read == stall + "D0\nD1\nD2\nD3\nK\n", "should write every frame once the output catches up");
+
+    std::cout << "\tTest case: drop the oldest frames and the deltas after them" << std::endl;
+    stall = stall_writer(writer, fds, SlowOutputPolicy::DROP_OLDEST);
+    ok = submit("D1\n", false) && submit("K2\n", true) && submit("D3\n", false) && submit("D4\n", false);
+    ok = ok && submit("D5\n", false) && writer.dropped_frames() == 1;
+    ok = ok && submit("K6\n", true) && writer.dropped_frames() == 5;
+    ok = ok && submit("D7\n", false) && !writer.keyframe_needed();
+    read = finish_writer(writer, fds);
+    assert(ok, "should drop the oldest frame, then the deltas up to the next keyframe");
+    assert(read == stall + "K6\nD7\n", "should write the frames that were kept, in order");
+
+    std::cout << "\tTest case: refuse deltas after dropped frames until a keyframe" << std::endl;
+    stall = stall_writer(writer, fds, SlowOutputPolicy::DROP_OLDEST);
+    ok = submit("K1\n", true) && submit("D2\n", false) && submit("D3\n", false) && submit("D4\n", false);
+    ok = ok && !submit("D5\n", false) && writer.keyframe_needed() && writer.dropped_frames() == 4;
+    ok = ok && !submit("D6\n", false) && submit("K7\n", true) && !writer.keyframe_needed();
+    read = finish_writer(writer, fds);
+    assert(ok, "should only take a keyframe once the deltas have nothing to follow");
+    assert(read == stall + "K7\n", "should only write the keyframe after the stall");
+
+    std::cout << "\tTest case: keep only the latest frame" << std::endl;
+    stall = stall_writer(writer, fds, SlowOutputPolicy::LATEST);
+    ok = submit("K1\n", true) && submit("K2\n", true) && submit("K3\n", true) && writer.queued_frames() == 1;
+    ok = ok && !submit("D4\n", false) && submit("K5\n", true) && writer.dropped_frames() == 3;
+    read = finish_writer(writer, fds);
+    assert(ok, "should replace the queued frame with each new one");
+    assert(read == stall + "K5\n", "should only write the latest frame after the stall");
+
+    std::cout << "\tTest case: write to a file" << std::endl;
+    const std::string path = "out/test_output.txt";
+    std::string error;
+    ok = writer.open(path, error);
+    assert(ok, "could not open the file: " + error);
+    writer.start(SlowOutputPolicy::BLOCK);
+    ok = submit("first\n", true) && submit("second\n", false) && writer.close();
+    std::ifstream file(path);
+    std::stringstream written;
+    written << file.rdbuf();
+    file.close();
+    assert(ok && written.str() == "first\nsecond\n", "the file differs from the frames written");
+    assert(!writer.open("out/no such directory/output", error), "should not open a file in a missing directory");
+    assert(!writer.open("tcp:localhost", error), "should not open a TCP output without a port");
+    std::filesystem::remove(path);
+}
+
+void test_shm_frames() {
+    std::cout << "Shared-memory frames" << std::endl;
+
+    const std::string path = "out/test_frames.shm";
+    std::string error;
+    ShmPublisher publisher;
+    ShmReader reader;
+    ShmFrame frame;
+    std::string data;
+    bool ok;
+
+    std::cout << "\tTest case: nothing published" << std::endl;
+    std::filesystem::remove(path);
+    assert(!reader.open(path, error), "should not open a missing region");
+    const bool created = publisher.create(path, error);
+    assert(created, "could not create the region: " + error);
+    ok = reader.open(path, error) && reader.latest() == 0 && !reader.read(frame);
+    assert(ok, "should open the region but find no frame");
+
+    std::cout << "\tTest case: read the latest frame in place" << std::endl;
+    publisher.publish("first", 5, true);
+    publisher.publish("second", 6, false);
+    ok = reader.read(frame) && frame.number == 2 && !frame.keyframe && std::string(frame.data, frame.length) == "second";
+    assert(ok && reader.still_valid(frame), "should read the latest frame");
+    ok = reader.copy(data, frame, 1) && data == "first" && frame.keyframe;
+    assert(ok, "should read an earlier frame by its number");
+    assert(!reader.read(frame, 3), "should not read a frame that isn't published");
+
+    std::cout << "\tTest case: frames that are overwritten" << std::endl;
+    ok = reader.read(frame, 2);
+    for (uint32_t i = 0; i < SHM_SLOTS; i++)  publisher.publish("later", 5, true);
+    ok = ok && !reader.still_valid(frame) && !reader.read(frame, 2);
+    assert(ok, "should tell that a frame was overwritten while it was read");
+    ok = reader.read(frame, 2 + SHM_SLOTS) && reader.latest() == 2 + SHM_SLOTS;
+    assert(ok, "should read the frame that overwrote it");
+
+    std::cout << "\tTest case: a frame larger than the slots" << std::endl;
+    const std::string large(3 * ShmPublisher::MIN_SLOT_LENGTH, 'L');
+    const uint64_t mappings = reader.mappings();
+    ok = publisher.publish(large.data(), large.length(), true);
+    ok = ok && reader.copy(data, frame) && data == large && frame.number == 3 + SHM_SLOTS;
+    assert(ok && reader.mappings() == mappings + 1, "should replace the region with larger slots and follow it");
+    ok = publisher.publish("small", 5, false) && reader.copy(data, frame) && data == "small";
+    assert(ok, "should keep publishing in the new region");
+
+    std::cout << "\tTest case: read while frames are published" << std::endl;
+    // Each frame is one byte repeated, so a torn read would mix bytes
+    const uint64_t before = reader.latest();
+    std::atomic<bool> publishing{true};
+    std::atomic<uint64_t> copies{0};
+    std::thread writer([&]() {
+        // Until the reader has had plenty of chances, even on one core, if there's a region to read
+        std::string published;
+        for (int i = 0; i < 20000 || (created && copies < 1000); i++) {
+            published.assign(1000 + i % 3000, static_cast<char>('a' + i % 26));
+            publisher.publish(published.data(), published.length(), true);
+            if (i % 64 == 0)  std::this_thread::yield();
+        }
+        publishing = false;
+    });
+    bool torn = false;
+    while (publishing) {
+        if (!reader.copy(data, frame) || frame.number <= before)  continue;
+        copies++;
+        torn = torn || data.find_first_not_of(data[0]) != std::string::npos;
+    }
+    writer.join();
+    assert(!torn, "a frame that was read differs from any published");
+    publisher.close();
+
+    std::cout << "\tTest case: write relay frames to a region" << std::endl;
+    FrameWriter output;
+    ok = output.open("shm:" + path, error);
+    assert(ok, "could not open the region as an output: " + error);
+    output.start(SlowOutputPolicy::BLOCK);
+    std::string submitted = "relay";
+    ok = output.submit(submitted, true) && output.close() && reader.copy(data, frame) && data == "relay";
+    assert(ok && frame.number == 1, "should follow the new region and read the frame written to it");
+    reader.close();
+    std::filesystem::remove(path);
+}
+
+#ifndef _WIN32
+// Connect to the subscription socket and send the request
+socket_t subscribe_to(const std::string &path, const std::string &request) {
+    const socket_t sock = connect_to_path(path.c_str());
+    if (sock != NO_SOCKET)  send_all(sock, request.data(), request.length());
+    return sock;
+}
+
+// Receive one line, including its '\n', or what came before the connection closed
+std::string receive_line(socket_t sock) {
+    std::string line;
+    char c;
+    while (line.empty() || line.back() != '\n') {
+        if (recv(sock, &c, 1, 0) != 1)  break;
+        line += c;
+    }
+    return line;
+}
+
+// Receive exactly length bytes, or what came before the connection closed
+std::string receive_bytes(socket_t sock, std::size_t length) {
+    std::string data(length, '\0');
+    std::size_t received = 0;
+    while (received < length) {
+        const ssize_t result = recv(sock, &data[received], length - received, 0);
+        if (result <= 0)  break;
+        received += result;
+    }
+    data.resize(received);
+    return data;
+}
+
+// Whether anything was sent that hasn't been received
+bool nothing_received(socket_t sock) {
+    char c;
+    return recv(sock, &c, 1, MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+#endif
+
+// The full frame of the objects, as a subscriber is sent it
+std::string subscribed_frame(FrameFormat format, const std::vector<Object> &frame_objects, bool predictions = false) {
+    std::string frame;
+    append_frame(frame, format, frame_objects.data(), frame_objects.size(), predictions);
+    if (format == FrameFormat::HEX)  frame += '\n';
+    return frame;
+}
+
+void test_subscriptions() {
+    std::cout << "Subscriptions" << std::endl;
+
+    SubscriptionRequest request;
+    std::string error;
+    bool ok;
+
+    std::cout << "\tTest case: parse a request" << std::endl;
+    ok = parse_subscription("types=3,1,3 colors=RED,GREEN region=100,0,0,50 ids=5,2 rate=10 format=binary", request, error);
+    assert(ok, "could not parse the request: " + error);
+    const SubscriptionFilter &filter = request.filter;
+    ok = filter.types == std::vector<uint32_t>{1, 3} && filter.ids == std::vector<int64_t>{2, 5}
+      && filter.colors.size() == 2 && std::is_sorted(filter.colors.begin(), filter.colors.end());
+    assert(ok, "the lists should be parsed and sorted");
+    ok = filter.has_region && filter.min_x == 0 && filter.min_y == 0 && filter.max_x == 100 && filter.max_y == 50;
+    assert(ok, "the region should be parsed with its corners in order");
+    assert(request.rate == 10 && request.format == FrameFormat::BINARY, "the rate and format should be parsed");
+    ok = parse_subscription("", request, error) && request.filter == SubscriptionFilter()
+      && request.rate == 0 && request.format == FrameFormat::HEX;
+    assert(ok, "an empty request should ask for everything");
+
+    std::cout << "\tTest case: parse bad requests" << std::endl;
+    const char *bad_requests[] = {"types=x", "types=", "colors=BLUE", "region=1,2,3", "ids=1,,2",
+                                  "rate=-1", "format=text", "speed=1", "types"};
+    for (const char *bad : bad_requests) {
+        error.clear();
+        ok = !parse_subscription(bad, request, error) && !error.empty();
+        assert(ok, std::string("should not parse ") + bad);
+    }
+
+    std::cout << "\tTest case: match objects" << std::endl;
+    parse_subscription("types=3 colors=RED region=0,0,100,100", request, error);
+    ok = request.filter.matches(Object{1, 100, 0, 3, RED, 0, 0}) && !request.filter.matches(Object{1, 101, 0, 3, RED, 0, 0})
+      && !request.filter.matches(Object{1, 50, 50, 2, RED, 0, 0}) && !request.filter.matches(Object{1, 50, 50, 3, GREEN, 0, 0});
+    assert(ok, "should match only objects that match every part of the filter");
+    parse_subscription("ids=7,3", request, error);
+    ok = request.filter.matches(Object{3, 0, 0, 1, GREEN, 0, 0}) && !request.filter.matches(Object{4, 0, 0, 1, GREEN, 0, 0});
+    assert(ok, "should match only objects with the IDs");
+
+    std::cout << "\tTest case: put a frame together from records" << std::endl;
+    const Object records[] = {{1, 2, 3, 1, RED, YELLOW, 40}, {-5, -6, 7, 3, GREEN, 0, 0}};
+    for (const FrameFormat format : {FrameFormat::HEX, FrameFormat::BINARY}) {
+        for (const bool predictions : {false, true}) {
+            std::string expected, frame;
+            append_frame(expected, format, records, 2, predictions);
+            append_frame_header(frame, format, 2, predictions);
+            const std::size_t length = object_record_length(format, predictions);
+            frame.resize(frame.length() + 2 * length);
+            char *out = &frame[frame.length() - 2 * length];
+            out = write_object_record(out, format, records[0], predictions);
+            out = write_object_record(out, format, records[1], predictions);
+            assert(frame == expected && out == &frame[0] + frame.length(), "the frame should equal append_frame()'s");
+        }
+    }
+
+#ifndef _WIN32
+    std::cout << "\tTest case: subscribers with different filters" << std::endl;
+    const std::string path = "out/test.sock";
+    SubscriptionServer server;
+    ok = server.listen(path, error);
+    assert(ok, "could not listen for subscribers: " + error);
+
+    const Object a{1, 10, 10, 1, RED, 0, 0}, b{2, 200, 200, 3, GREEN, 0, 0}, c{3, 50, 60, 3, YELLOW, 0, 0}, d{4, 140, 150, 2, RED, 0, 0};
+    ObjectStore store;
+    for (const Object &object : {a, b, c, d})  store.upsert(object);
+
+    const socket_t red = subscribe_to(path, "colors=RED\n");
+    const socket_t type3 = subscribe_to(path, "types=3\n");
+    const socket_t region = subscribe_to(path, "region=0,0,100,100 format=binary\n");
+    const socket_t ids = subscribe_to(path, "ids=4,2,9\n");
+    const socket_t red_again = subscribe_to(path, "colors=RED\r\n");
+    server.publish(store, false);
+    assert(server.subscribers() == 5, "every subscriber should be subscribed");
+    assert(receive_line(red) == subscribed_frame(FrameFormat::HEX, {a, d}), "should send only the RED objects");
+    assert(receive_line(type3) == subscribed_frame(FrameFormat::HEX, {b, c}), "should send only the objects of type 3");
+    const std::string binary = subscribed_frame(FrameFormat::BINARY, {a, c});
+    assert(receive_bytes(region, binary.length()) == binary, "should send only the objects in the region, in binary");
+    assert(receive_line(ids) == subscribed_frame(FrameFormat::HEX, {b, d}), "should send the objects with the IDs in order");
+    assert(receive_line(red_again) == subscribed_frame(FrameFormat::HEX, {a, d}), "should send the same frame to the same filter");
+
+    std::cout << "\tTest case: relays with predictions" << std::endl;
+    store.upsert(Object{1, 11, 10, 1, RED, RED, 0});
+    server.publish(store, true);
+    const std::vector<Object> predicted{Object{1, 11, 10, 1, RED, RED, 0}, d};
+    assert(receive_line(red) == subscribed_frame(FrameFormat::HEX, predicted, true), "should send the updated objects with predictions");
+    receive_line(type3);
+    receive_bytes(region, subscribed_frame(FrameFormat::BINARY, {a, c}, true).length());
+    receive_line(ids);
+    receive_line(red_again);
+
+    std::cout << "\tTest case: a rate limit" << std::endl;
+    const socket_t slow = subscribe_to(path, "rate=1\n");
+    server.publish(store, false);
+    ok = receive_line(slow) == subscribed_frame(FrameFormat::HEX, std::vector<Object>(store.begin(), store.end()));
+    assert(ok, "should send everything at first");
+    server.publish(store, false);
+    assert(nothing_received(slow), "should not send more than the rate allows");
+    assert(!nothing_received(red), "should still send every relay to the others");
+    for (const socket_t sock : {red, type3, ids, red_again})  receive_line(sock);
+    receive_bytes(region, binary.length());
+    receive_bytes(region, binary.length()); // Ends with a '\n' byte only in hex
+
+    std::cout << "\tTest case: a request in pieces" << std::endl;
+    const std::size_t before = server.subscribers();
+    const socket_t pieces = subscribe_to(path, "types=");
+    server.publish(store, false);
+    assert(server.subscribers() == before && nothing_received(pieces), "should wait for the rest of the request");
+    send_all(pieces, "2\n", 2);
+    server.publish(store, false);
+    assert(receive_line(pieces) == subscribed_frame(FrameFormat::HEX, {d}), "should subscribe once the request is whole");
+
+    std::cout << "\tTest case: a bad request" << std::endl;
+    const socket_t bad = subscribe_to(path, "format=text\n");
+    server.publish(store, false);
+    assert(receive_line(bad) == "error: unknown option format=text\n", "should answer with the error");
+    assert(receive_line(bad).empty() && server.subscribers() == before + 1, "should close the connection");
+    close_socket(bad);
+
+    std::cout << "\tTest case: subscribers that leave" << std::endl;
+    close_socket(red);
+    close_socket(slow);
+    server.publish(store, false);
+    assert(server.subscribers() == before - 1, "should remove the subscribers that left");
+
+    server.close();
+    assert(!std::filesystem::exists(path), "should remove the socket when closed");
+    for (const socket_t sock : {type3, region, ids, red_again, pieces})  close_socket(sock);
+
+    std::cout << "\tTest case: the same filter in both formats" << std::endl;
+    ok = server.listen(path, error);
+    const socket_t hex = subscribe_to(path, "types=3\n");
+    const socket_t both = subscribe_to(path, "types=3 format=binary\n");
+    server.publish(store, false);
+    assert(ok && receive_line(hex) == subscribed_frame(FrameFormat::HEX, {b, c}), "should send the hex frame");
+    const std::string binary_frame = subscribed_frame(FrameFormat::BINARY, {b, c});
+    assert(receive_bytes(both, binary_frame.length()) == binary_frame, "should send the binary frame");
+
+    std::cout << "\tTest case: a subscriber that keeps sending" << std::endl;
+    const std::string chatter(1 << 16, 'x');
+    for (std::size_t sent = 0; sent < chatter.length();) {
+        const ssize_t result = send(hex, chatter.data() + sent, chatter.length() - sent, MSG_DONTWAIT);
+        if (result <= 0)  break;
+        sent += result;
+    }
+    server.publish(store, false);
+    ok = server.subscribers() == 2 && receive_line(hex) == subscribed_frame(FrameFormat::HEX, {b, c});
+    assert(ok, "should keep sending frames to a subscriber that sends");
+    close_socket(hex);
+    close_socket(both);
+
+    std::cout << "\tTest case: what's at the socket path" << std::endl;
+    SubscriptionServer second;
+    assert(!second.listen(path, error) && std::filesystem::exists(path), "should not take over a socket in use");
+    server.close();
+    const socket_t stale = listen_on_path(path.c_str());
+    close_socket(stale); // Leaves the socket file behind, like a crash would
+    ok = second.listen(path, error);
+    assert(ok, "should replace a socket that nothing listens on: " + error);
+    second.close();
+    std::ofstream(path) << "keep";
+    ok = !second.listen(path, error) && std::filesystem::is_regular_file(path);
+    assert(ok, "should not replace anything but a socket");
+    std::filesystem::remove(path);
+#endif
+}
+
+void test_relay_trigger() {
+    std::cout << "RelayTrigger" << std::endl;
+
+    // Long enough apart that a busy machine doesn't blur them
+    RelayTiming timing;
+    timing.coalesce_window = std::chrono::milliseconds(100);
+    timing.max_latency     = std::chrono::milliseconds(300);
+    timing.min_interval    = std::chrono::milliseconds(0);
+    timing.heartbeat       = std::chrono::milliseconds(1000);
+    RelayTrigger trigger(timing);
+    bool relayed;
+    long long waited;
+
+    std::cout << "\tTest case: a change is relayed after the coalescing window" << std::endl;
+    trigger.notify();
+    waited = wait_milliseconds(trigger, relayed);
+    assert(relayed && waited >= 90 && waited < 300, "waited " + std::to_string(waited) + " ms");
+
+    std::cout << "\tTest case: an urgent change is relayed at once" << std::endl;
+    trigger.notify();
+    trigger.notify(true);
+    waited = wait_milliseconds(trigger, relayed);
+    assert(relayed && waited < 50, "waited " + std::to_string(waited) + " ms");
+
+    std::cout << "\tTest case: an urgent change wakes a waiting relay" << std::endl;
+    std::thread notifier([&trigger]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        trigger.notify(true);
+    });
+    waited = wait_milliseconds(trigger, relayed);
+    notifier.join();
+    assert(relayed && waited >= 40 && waited < 150, "waited " + std::to_string(waited) + " ms");
+
+    std::cout << "\tTest case: steady changes are relayed within the maximum latency" << std::endl;
+    std::atomic<bool> keep_changing(true);
+    std::thread changer([&trigger, &keep_changing]() {
+        while (keep_changing) {
+            trigger.notify();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    waited = wait_milliseconds(trigger, relayed);
+    keep_changing = false;
+    changer.join();
+    assert(relayed && waited >= 250 && waited < 450, "waited " + std::to_string(waited) + " ms");
+
+    std::cout << "\tTest case: the minimum interval holds back urgent changes" << std::endl;
+    timing.min_interval = std::chrono::milliseconds(200);
+    trigger.set_timing(timing);
+    trigger.notify(true);
+    waited = wait_milliseconds(trigger, relayed);
+    trigger.notify(true);
+    waited = wait_milliseconds(trigger, relayed);
+    assert(relayed && waited >= 150 && waited < 350, "waited " + std::to_string(waited) + " ms");
+
+    std::cout << "\tTest case: a heartbeat without changes" << std::endl;
+    timing.heartbeat = std::chrono::milliseconds(150);
+    trigger.set_timing(timing);
+    waited = wait_milliseconds(trigger, relayed);
+    assert(relayed && waited >= 100 && waited < 300, "waited " + std::to_string(waited) + " ms");
+
+    std::cout << "\tTest case: stopping wakes the relay at once" << std::endl;
+    timing.heartbeat = std::chrono::milliseconds(10000);
+    trigger.set_timing(timing);
+    std::thread stopper([&trigger]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        trigger.stop();
+    });
+    waited = wait_milliseconds(trigger, relayed);
+    stopper.join();
+    assert(!relayed && waited < 500, "waited " + std::to_string(waited) + " ms");
+    waited = wait_milliseconds(trigger, relayed);
+    assert(!relayed && waited < 50, "should stay stopped");
+    trigger.restart();
+    trigger.notify(true);
+    assert(trigger.wait(), "should relay again after a restart");
 }
 
 void test_relay_info_once() {
@@ -415,14 +2537,14 @@ void test_relay_info_once() {
     o3.color = 0xda61c64d;
 
     std::cout << "\tTest case: relay zero objects" << std::endl;
-    objects.clear();
+    clear_objects();
     ss.str(""); // Flush
     relay_info_once(ss);
     expected_string = preamble + "00000000";
     assert(ss.str() == expected_string, "bad output");
 
     std::cout << "\tTest case: relay one object" << std::endl;
-    objects.clear();
+    clear_objects();
     ss.str(""); // Flush
     add_or_update_object(o1);
     relay_info_once(ss);
@@ -437,7 +2559,7 @@ void test_relay_info_once() {
     assert(ss.str() == expected_string, "bad output");
 
     std::cout << "\tTest case: relay many objects" << std::endl;
-    objects.clear();
+    clear_objects();
     ss.str(""); // Flush
     add_or_update_object(o1);
     add_or_update_object(o2);
@@ -465,7 +2587,86 @@ void test_relay_info_once() {
     expected_string += "da61c64d";
     assert(ss.str() == expected_string, "bad output");
 
-    objects.clear(); // Remove side effects
+    std::cout << "\tTest case: relay changes made since the last relay" << std::endl;
+    clear_objects();
+    ss.str(""); // Flush
+    add_or_update_object(o1);
+    relay_info_once(ss);
+    ss.str(""); // Flush
+    o1.x = 0x00000fed;
+    add_or_update_object(o1);
+    add_or_update_object(o2);
+    relay_info_once(ss);
+    expected_string = preamble;
+    expected_string += "00000002";
+    // Append output from the updated o1
+    expected_string += "00000000000000ab";
+    expected_string += "00000fed";
+    expected_string += "000000ef";
+    expected_string += "00000001";
+    expected_string += "00002345";
+    // Append output from o2
+    expected_string += "83d74892fc8a1997";
+    expected_string += "deadbeef";
+    expected_string += "1e022c34";
+    expected_string += "8ed5452b";
+    expected_string += "b901dc4b";
+    assert(ss.str() == expected_string, "bad output");
+
+    std::cout << "\tTest case: relay a delta frame" << std::endl;
+    relay_info_once(ss);
+    ss.str(""); // Flush
+    add_or_update_object(o1); // Unchanged
+    add_or_update_object(o3); // New
+    o2.y = 0x00000001;
+    add_or_update_object(o2); // Moved
+    relay_info_once(ss, FrameFormat::HEX, false);
+    expected_string = "0000fefd"; // Delta preamble
+    expected_string += "00000002";
+    // Append output from o3
+    expected_string += "96d14c9f09f411d4";
+    expected_string += "51d0cdb6";
+    expected_string += "c183213f";
+    expected_string += "d9def867";
+    expected_string += "da61c64d";
+    // Append output from the moved o2
+    expected_string += "83d74892fc8a1997";
+    expected_string += "deadbeef";
+    expected_string += "00000001";
+    expected_string += "8ed5452b";
+    expected_string += "b901dc4b";
+    // No removed objects
+    expected_string += "00000000";
+    assert(ss.str() == expected_string, "bad output");
+
+    std::cout << "\tTest case: relay a delta frame without changes" << std::endl;
+    ss.str(""); // Flush
+    add_or_update_object(o1); // Unchanged
+    relay_info_once(ss, FrameFormat::HEX, false);
+    assert(ss.str() == "0000fefd0000000000000000", "bad output");
+
+    std::cout << "\tTest case: relay expired objects" << std::endl;
+    set_object_ttl(std::chrono::milliseconds(50));
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    add_or_update_object(o1); // Moved, so it's seen later than the others
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    ss.str(""); // Flush
+    relay_info_once(ss, FrameFormat::HEX, false);
+    set_object_ttl(std::chrono::milliseconds(0));
+    expected_string = "0000fefd00000000"; // No changed objects
+    expected_string += "00000002";
+    expected_string += "83d74892fc8a1997"; // o2
+    expected_string += "96d14c9f09f411d4"; // o3
+    assert(ss.str() == expected_string, "bad output: " + ss.str());
+    assert(objects.size() == 1 && objects[0].id == o1.id, "expired objects left in the list");
+
+    std::cout << "\tTest case: relay a full frame after clearing" << std::endl;
+    ss.str(""); // Flush
+    clear_objects();
+    relay_info_once(ss, FrameFormat::HEX, false);
+    assert(ss.str() == preamble + "00000000", "bad output");
+
+    clear_objects(); // Remove side effects
     ss.str(""); // Flush
 }
 
@@ -473,10 +2674,36 @@ int main() {
     std::cout << std::endl << "Running test suite..." << std::endl;
 
     test_split_string();
+    test_line_framer();
+    test_event_loop();
+    test_listen_on_port();
+    test_spsc_ring();
+    test_ingest_pipeline();
     test_parse_object();
+    test_scan_separators();
+    test_record_scanner();
     test_color_object();
+    test_color_objects();
+    test_zone_rules();
+    test_object_store();
+    test_object_snapshot();
+    test_timer_wheel();
+    test_object_expiry();
+    test_spatial_grid();
+    test_track_history();
+    test_predict_color();
     test_add_or_update_object();
+    test_append_hex_frame();
+    test_append_binary_frame();
     test_relay_info_once();
+    test_relay_trigger();
+    test_capture();
+    test_latency_histogram();
+    test_thread_stats();
+    test_allocations();
+    test_frame_writer();
+    test_shm_frames();
+    test_subscriptions();
 
     std::cout << "Tests complete (" << failed_assert_count << "/" << assert_count << " asserts failed)" << std::endl;
 }
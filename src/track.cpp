@@ -0,0 +1,84 @@
+#include "track.h"
+
+void TrackHistory::reset(std::size_t count) {
+    times.assign(count * SAMPLES, 0);
+    xs.assign(count * SAMPLES, 0);
+    ys.assign(count * SAMPLES, 0);
+    heads.assign(count, 0);
+    counts.assign(count, 0);
+}
+
+void TrackHistory::record(std::size_t track, uint64_t time, int32_t x, int32_t y) {
+    if (track == size()) {
+        times.resize(times.size() + SAMPLES);
+        xs.resize(xs.size() + SAMPLES);
+        ys.resize(ys.size() + SAMPLES);
+        heads.push_back(0);
+        counts.push_back(0);
+    }
+
+    std::size_t slot;
+    if (counts[track] < SAMPLES) {
+        slot = (heads[track] + counts[track]) % SAMPLES;
+        counts[track]++;
+    } else {
+        slot = heads[track];
+        heads[track] = (heads[track] + 1) % SAMPLES;
+    }
+    const std::size_t sample = track * SAMPLES + slot;
+    times[sample] = time;
+    xs[sample] = x;
+    ys[sample] = y;
+}
+
+void TrackHistory::remove(std::size_t track) {
+    const std::size_t last = size() - 1;
+    if (track != last) {
+        for (unsigned i = 0; i < SAMPLES; i++) {
+            times[track * SAMPLES + i] = times[last * SAMPLES + i];
+            xs[track * SAMPLES + i] = xs[last * SAMPLES + i];
+            ys[track * SAMPLES + i] = ys[last * SAMPLES + i];
+        }
+        heads[track] = heads[last];
+        counts[track] = counts[last];
+    }
+    times.resize(last * SAMPLES);
+    xs.resize(last * SAMPLES);
+    ys.resize(last * SAMPLES);
+    heads.pop_back();
+    counts.pop_back();
+}
+
+/*
+ * The slope of the least-squares line through the positions over time,
+ * for x and y separately. Times are taken relative to the newest sample
+ * so that they fit in a double without losing precision.
+ */
+bool TrackHistory::velocity(std::size_t track, double &vx, double &vy) const {
+    const unsigned count = counts[track];
+    if (count < 2)  return false;
+
+    const std::size_t first = track * SAMPLES;
+    const uint64_t newest = times[first + (heads[track] + count - 1) % SAMPLES];
+    double mean_t = 0, mean_x = 0, mean_y = 0;
+    for (unsigned i = 0; i < count; i++) {
+        mean_t += static_cast<int64_t>(times[first + i] - newest) / 1e9;
+        mean_x += xs[first + i];
+        mean_y += ys[first + i];
+    }
+    mean_t /= count;
+    mean_x /= count;
+    mean_y /= count;
+
+    double tt = 0, tx = 0, ty = 0;
+    for (unsigned i = 0; i < count; i++) {
+        const double t = static_cast<int64_t>(times[first + i] - newest) / 1e9 - mean_t;
+        tt += t * t;
+        tx += t * (xs[first + i] - mean_x);
+        ty += t * (ys[first + i] - mean_y);
+    }
+    if (tt == 0)  return false;
+    vx = tx / tt;
+    vy = ty / tt;
+    return true;
+}
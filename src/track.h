@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * The last SAMPLES positions of every object in an ObjectStore, and when
+ * they were received, kept at the same indices as the objects so that no
+ * lookup of its own is needed. The samples are kept as a structure of
+ * arrays, with the SAMPLES times, x and y of a track next to each other
+ * in their own arrays, so estimating a velocity reads three short runs of
+ * memory. Each track is a ring that overwrites its oldest sample, so
+ * nothing is allocated per sample once the arrays have grown.
+ */
+class TrackHistory {
+public:
+    static const unsigned SAMPLES = 8;
+
+    std::size_t size() const { return counts.size(); }
+
+    // Forget every sample, keeping empty tracks for the first count indices
+    void reset(std::size_t count);
+
+    // Add a sample to the track at the index, which may be size() for a new track
+    void record(std::size_t track, uint64_t time, int32_t x, int32_t y);
+
+    // Remove the track, moving the last track into its place, which is
+    // what ObjectStore::erase() does with the objects
+    void remove(std::size_t track);
+
+    unsigned samples(std::size_t track) const { return counts[track]; }
+
+    // Estimate the velocity of the track, in coordinates per second, by a
+    // least-squares fit to its samples, with times in nanoseconds. Returns
+    // false if the samples don't span any time.
+    bool velocity(std::size_t track, double &vx, double &vy) const;
+
+private:
+    std::vector<uint64_t> times; // SAMPLES for each track
+    std::vector<int32_t> xs;
+    std::vector<int32_t> ys;
+    std::vector<uint8_t> heads;  // The oldest sample of each track
+    std::vector<uint8_t> counts; // How many samples each track has
+};
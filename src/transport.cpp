@@ -0,0 +1,231 @@
+#include "transport.h"
+#include <iostream>
+#include <cstring>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <cerrno>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+bool init_sockets() {
+#ifdef _WIN32
+    // Init Winsock
+    WORD wVersionRequested = MAKEWORD(2,2);
+    WSADATA lpWSAData;
+    int error_code = WSAStartup(wVersionRequested, &lpWSAData);
+    if (error_code) {
+        std::clog << "WSAStartup() failed with the error code " << error_code << std::endl;
+        return false;
+    }
+#endif
+    return true;
+}
+
+void cleanup_sockets() {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+int last_socket_error() {
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+void close_socket(socket_t sock) {
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+}
+
+socket_t connect_to_server(const char *server_ip, const char *server_port) {
+
+    // Set hints for the socket communication
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;   // Unspecified address family
+    hints.ai_socktype = SOCK_STREAM; // Byte stream socket
+    hints.ai_protocol = IPPROTO_TCP; // Use TCP
+
+    // Resolve the server address and port
+    struct addrinfo *addrinfos = nullptr; // Linked list
+    int error_code = getaddrinfo(server_ip, server_port, &hints, &addrinfos);
+    if (error_code) {
+        std::clog << "getaddrinfo() failed with the error code " << error_code << std::endl;
+        return NO_SOCKET;
+    }
+
+    // Attempt to connect to an address until one succeeds
+    socket_t sock = NO_SOCKET;
+    struct addrinfo *ptr = nullptr;
+    for (ptr = addrinfos; ptr != nullptr; ptr = ptr->ai_next) {
+
+        // Create the socket
+        sock = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
+        if (sock == NO_SOCKET) {
+            std::clog << "socket() failed with the error code " << last_socket_error() << std::endl;
+            break;
+        }
+
+        // Connect to the server
+        error_code = connect(sock, ptr->ai_addr, (int)ptr->ai_addrlen);
+        if (error_code) {
+            close_socket(sock);
+            sock = NO_SOCKET;
+            continue;
+        }
+
+        break; // Success!
+    }
+
+    freeaddrinfo(addrinfos);
+
+    if (sock == NO_SOCKET) {
+        std::clog << "Failed to connect to " << server_ip << ":" << server_port << std::endl;
+    }
+    return sock;
+}
+
+socket_t listen_on_port(const char *port) {
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;     // The clients connect over IPv4
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags    = AI_PASSIVE;  // Any interface
+
+    struct addrinfo *addrinfos = nullptr;
+    int error_code = getaddrinfo(nullptr, port, &hints, &addrinfos);
+    if (error_code) {
+        std::clog << "getaddrinfo() failed with the error code " << error_code << std::endl;
+        return NO_SOCKET;
+    }
+
+    socket_t sock = socket(addrinfos->ai_family, addrinfos->ai_socktype, addrinfos->ai_protocol);
+    if (sock == NO_SOCKET) {
+        std::clog << "socket() failed with the error code " << last_socket_error() << std::endl;
+        freeaddrinfo(addrinfos);
+        return NO_SOCKET;
+    }
+
+    // Let the port be reused right away after a restart
+    const int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+
+    if (bind(sock, addrinfos->ai_addr, (int)addrinfos->ai_addrlen) != 0 || listen(sock, SOMAXCONN) != 0) {
+        std::clog << "Failed to listen on port " << port << " with the error code " << last_socket_error() << std::endl;
+        close_socket(sock);
+        sock = NO_SOCKET;
+    }
+
+    freeaddrinfo(addrinfos);
+    return sock;
+}
+
+#ifndef _WIN32
+// Fill in the address of the path. Returns false if the path is too long for it.
+bool unix_address(const char *path, sockaddr_un &address) {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (std::strlen(path) >= sizeof(address.sun_path)) {
+        std::clog << "The socket path " << path << " is too long" << std::endl;
+        return false;
+    }
+    std::strcpy(address.sun_path, path);
+    return true;
+}
+#endif
+
+socket_t listen_on_path(const char *path) {
+#ifdef _WIN32
+    std::clog << "UNIX-domain sockets are only supported on POSIX systems" << std::endl;
+    return NO_SOCKET;
+#else
+    sockaddr_un address;
+    if (!unix_address(path, address))  return NO_SOCKET;
+    socket_t sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == NO_SOCKET) {
+        std::clog << "socket() failed with the error code " << last_socket_error() << std::endl;
+        return NO_SOCKET;
+    }
+
+    // A socket file outlives its listener, so one may be left from an earlier run.
+    // It's only removed if nothing answers on it, and nothing else is ever removed.
+    struct stat status;
+    if (lstat(path, &status) == 0) {
+        if (!S_ISSOCK(status.st_mode)) {
+            std::clog << "Won't listen on " << path << " since something other than a socket is there" << std::endl;
+            close_socket(sock);
+            return NO_SOCKET;
+        }
+        const socket_t probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        const bool listened = probe != NO_SOCKET
+                           && connect(probe, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+        if (probe != NO_SOCKET)  close_socket(probe);
+        if (listened) {
+            std::clog << "Won't listen on " << path << " since something already listens there" << std::endl;
+            close_socket(sock);
+            return NO_SOCKET;
+        }
+        unlink(path);
+    }
+    if (bind(sock, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(sock, SOMAXCONN) != 0) {
+        std::clog << "Failed to listen on " << path << " with the error code " << last_socket_error() << std::endl;
+        close_socket(sock);
+        sock = NO_SOCKET;
+    }
+    return sock;
+#endif
+}
+
+socket_t connect_to_path(const char *path) {
+#ifdef _WIN32
+    std::clog << "UNIX-domain sockets are only supported on POSIX systems" << std::endl;
+    return NO_SOCKET;
+#else
+    sockaddr_un address;
+    if (!unix_address(path, address))  return NO_SOCKET;
+    socket_t sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == NO_SOCKET) {
+        std::clog << "socket() failed with the error code " << last_socket_error() << std::endl;
+        return NO_SOCKET;
+    }
+    if (connect(sock, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        std::clog << "Failed to connect to " << path << " with the error code " << last_socket_error() << std::endl;
+        close_socket(sock);
+        sock = NO_SOCKET;
+    }
+    return sock;
+#endif
+}
+
+bool send_all(socket_t sock, const char *data, std::size_t length) {
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL; // Fail instead of raising SIGPIPE if the peer has gone
+#else
+    const int flags = 0;
+#endif
+    while (length > 0) {
+        const auto bytes_sent = send(sock, data, (int)length, flags);
+        if (bytes_sent < 0) {
+#ifndef _WIN32
+            if (errno == EINTR)  continue;
+#endif
+            return false;
+        }
+        data   += bytes_sent;
+        length -= bytes_sent;
+    }
+    return true;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+
+#ifdef _WIN32
+#include <winsock2.h>
+typedef SOCKET socket_t;
+const socket_t NO_SOCKET = INVALID_SOCKET;
+#else
+typedef int socket_t;
+const socket_t NO_SOCKET = -1;
+#endif
+
+/*
+ * The socket functions that differ between platforms. They are shared by
+ * every I/O backend, so only the event loop itself is platform specific.
+ */
+bool init_sockets();
+void cleanup_sockets();
+int last_socket_error();
+void close_socket(socket_t sock);
+
+/*
+ * Connect to the server with a TCP socket. Every address the server name
+ * resolves to is tried until one succeeds. If none does, the error is
+ * printed to std::clog and NO_SOCKET is returned.
+ */
+socket_t connect_to_server(const char *server_ip, const char *server_port);
+
+/*
+ * Listen for TCP connections on the port on every interface, or on a
+ * free port if it's "0". If that fails, the error is printed to std::clog
+ * and NO_SOCKET is returned.
+ */
+socket_t listen_on_port(const char *port);
+
+/*
+ * Listen for connections on a UNIX-domain socket at the path, or connect
+ * to one. A socket at the path that nothing listens on is left from an
+ * earlier run and is replaced, but listening fails if anything else is
+ * there, or if something still listens on it. They're only supported on
+ * POSIX systems. If that fails, the error is printed to std::clog and
+ * NO_SOCKET is returned.
+ */
+socket_t listen_on_path(const char *path);
+socket_t connect_to_path(const char *path);
+
+/*
+ * Send all length bytes, however many calls it takes. Returns false if
+ * the connection closed or failed first.
+ */
+bool send_all(socket_t sock, const char *data, std::size_t length);
+
+/*
+ * Receives the byte stream of one connection from an event loop.
+ */
+class StreamHandler {
+public:
+    virtual ~StreamHandler() {}
+
+    // Returns where the next received bytes should be written, and sets
+    // length to how many bytes may be written there. It's not always
+    // followed by received(), e.g. if there turned out to be nothing to read.
+    virtual char *receive_buffer(std::size_t &length) = 0;
+
+    // Called after length bytes were written to the receive buffer
+    virtual void received(std::size_t length) = 0;
+
+    // Called once when the connection has closed or failed
+    virtual void closed() = 0;
+};
+
+/*
+ * Waits for data on any number of connections and hands it to the
+ * handlers of the connections as it arrives, all on the thread that
+ * runs the loop. The backend depends on the platform: epoll on Linux
+ * and select() with Winsock elsewhere.
+ */
+class EventLoop {
+public:
+    virtual ~EventLoop() {}
+
+    // Starts watching the connected socket. The handler must outlive the loop.
+    virtual bool add(socket_t sock, StreamHandler *handler) = 0;
+
+    // Hands data to the handlers until every connection has closed. If an
+    // error occurs, it's printed to std::clog and false is returned.
+    virtual bool run() = 0;
+
+    // Creates the event loop of the platform
+    static std::unique_ptr<EventLoop> create();
+};
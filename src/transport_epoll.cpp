@@ -0,0 +1,122 @@
+#include "transport.h"
+#include <iostream>
+#include <vector>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// The most events handled per epoll_wait() call
+const int MAX_EVENTS = 64;
+
+/*
+ * An event loop for Linux. Sockets are non-blocking and registered as
+ * edge-triggered, so each readiness event is followed by reading the
+ * socket until it would block. One thread can then serve any number of
+ * connections with one system call per batch of ready sockets.
+ */
+class EpollLoop : public EventLoop {
+public:
+    EpollLoop();
+    ~EpollLoop();
+    bool add(socket_t sock, StreamHandler *handler) override;
+    bool run() override;
+
+private:
+    struct Connection {
+        socket_t sock;
+        StreamHandler *handler;
+    };
+
+    int epoll_fd;
+    std::vector<std::unique_ptr<Connection>> connections; // Owned here so epoll can point at them
+    std::size_t open_count = 0;
+
+    void drain(Connection &connection);
+};
+
+std::unique_ptr<EventLoop> EventLoop::create() {
+    return std::unique_ptr<EventLoop>(new EpollLoop());
+}
+
+EpollLoop::EpollLoop() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        std::clog << "epoll_create1() failed with the error code " << errno << std::endl;
+    }
+}
+
+EpollLoop::~EpollLoop() {
+    if (epoll_fd >= 0)  close(epoll_fd);
+}
+
+bool EpollLoop::add(socket_t sock, StreamHandler *handler) {
+    if (epoll_fd < 0)  return false;
+
+    const int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+        std::clog << "fcntl() failed with the error code " << errno << std::endl;
+        return false;
+    }
+
+    connections.emplace_back(new Connection{sock, handler});
+
+    struct epoll_event event;
+    event.events   = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = connections.back().get();
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &event) < 0) {
+        std::clog << "epoll_ctl() failed with the error code " << errno << std::endl;
+        connections.pop_back();
+        return false;
+    }
+
+    open_count++;
+    return true;
+}
+
+bool EpollLoop::run() {
+    struct epoll_event events[MAX_EVENTS];
+    while (open_count > 0) {
+        const int event_count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (event_count < 0) {
+            if (errno == EINTR)  continue;
+            std::clog << "epoll_wait() failed with the error code " << errno << std::endl;
+            return false;
+        }
+
+        for (int i = 0; i < event_count; i++) {
+            drain(*static_cast<Connection *>(events[i].data.ptr));
+        }
+    }
+    return true;
+}
+
+/*
+ * Read from the socket until there's nothing left to read. Since the
+ * socket is edge-triggered, epoll won't report it again until new data
+ * arrives, so stopping any earlier could leave data behind.
+ */
+void EpollLoop::drain(Connection &connection) {
+    while (true) {
+        std::size_t length;
+        char *buffer = connection.handler->receive_buffer(length);
+        const ssize_t bytes_received = recv(connection.sock, buffer, length, 0);
+
+        if (bytes_received > 0) {
+            connection.handler->received(bytes_received);
+            continue;
+        }
+        if (bytes_received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)  return; // Drained
+            if (errno == EINTR)  continue;
+            std::clog << "recv() failed with the error code " << errno << std::endl;
+        }
+
+        // The connection closed or failed
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection.sock, nullptr);
+        connection.handler->closed();
+        open_count--;
+        return;
+    }
+}
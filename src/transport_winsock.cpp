@@ -0,0 +1,72 @@
+#include "transport.h"
+#include <iostream>
+#include <vector>
+
+/*
+ * An event loop for Winsock. select() waits until at least one socket
+ * has data, and each ready socket is then read once with a blocking
+ * recv(), which won't block since data is known to be waiting.
+ */
+class SelectLoop : public EventLoop {
+public:
+    bool add(socket_t sock, StreamHandler *handler) override;
+    bool run() override;
+
+private:
+    struct Connection {
+        socket_t sock;
+        StreamHandler *handler;
+        bool open;
+    };
+
+    std::vector<Connection> connections;
+};
+
+std::unique_ptr<EventLoop> EventLoop::create() {
+    return std::unique_ptr<EventLoop>(new SelectLoop());
+}
+
+bool SelectLoop::add(socket_t sock, StreamHandler *handler) {
+    if (connections.size() >= FD_SETSIZE) {
+        std::clog << "Can't watch more than " << FD_SETSIZE << " sockets" << std::endl;
+        return false;
+    }
+    connections.push_back(Connection{sock, handler, true});
+    return true;
+}
+
+bool SelectLoop::run() {
+    while (true) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        for (const auto &connection : connections) {
+            if (connection.open)  FD_SET(connection.sock, &readable);
+        }
+        if (readable.fd_count == 0)  return true; // Every connection has closed
+
+        // The first argument is ignored by Winsock
+        if (select(0, &readable, nullptr, nullptr, nullptr) == SOCKET_ERROR) {
+            std::clog << "select() failed with the error code " << WSAGetLastError() << std::endl;
+            return false;
+        }
+
+        for (auto &connection : connections) {
+            if (!connection.open || !FD_ISSET(connection.sock, &readable))  continue;
+
+            std::size_t length;
+            char *buffer = connection.handler->receive_buffer(length);
+            const int bytes_received = recv(connection.sock, buffer, (int)length, 0);
+            if (bytes_received > 0) {
+                connection.handler->received(bytes_received);
+                continue;
+            }
+
+            // The connection closed or failed
+            if (bytes_received == SOCKET_ERROR) {
+                std::clog << "recv() failed with the error code " << WSAGetLastError() << std::endl;
+            }
+            connection.open = false;
+            connection.handler->closed();
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#include "trigger.h"
+#include <algorithm>
+
+RelayTrigger::RelayTrigger(const RelayTiming &timing) : timing(timing), last_relay(clock::now()) {}
+
+void RelayTrigger::set_timing(const RelayTiming &new_timing) {
+    std::lock_guard<std::mutex> lock(mutex);
+    timing = new_timing;
+    condition.notify_one();
+}
+
+void RelayTrigger::notify(bool is_urgent) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto now = clock::now();
+    const bool due_sooner = !pending || (is_urgent && !urgent);
+    if (!pending) {
+        pending = true;
+        first_change = now;
+    }
+    last_change = now;
+    urgent = urgent || is_urgent;
+
+    // Later changes only push the deadline back, so the relay thread
+    // only has to be woken when it might have to relay sooner
+    if (due_sooner)  condition.notify_one();
+}
+
+bool RelayTrigger::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopped) {
+        clock::time_point due;
+        if (!pending) {
+            due = last_relay + timing.heartbeat;
+        } else if (urgent) {
+            due = last_relay + timing.min_interval;
+        } else {
+            due = std::min(last_change + timing.coalesce_window, first_change + timing.max_latency);
+            due = std::max(due, last_relay + timing.min_interval);
+        }
+
+        const auto now = clock::now();
+        if (now >= due) {
+            pending = urgent = false;
+            last_relay = now;
+            return true;
+        }
+        condition.wait_until(lock, due);
+    }
+    return false;
+}
+
+void RelayTrigger::stop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+    condition.notify_all();
+}
+
+void RelayTrigger::restart() {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = false;
+    last_relay = clock::now();
+}
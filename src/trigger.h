@@ -0,0 +1,58 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+// When relays are published, relative to the changes that call for them
+struct RelayTiming {
+    // Changes this close after each other are relayed together
+    std::chrono::milliseconds coalesce_window = std::chrono::milliseconds(50);
+
+    // No change waits longer than this to be relayed while changes keep coming
+    std::chrono::milliseconds max_latency = std::chrono::milliseconds(250);
+
+    // Relays are never published closer to each other than this
+    std::chrono::milliseconds min_interval = std::chrono::milliseconds(20);
+
+    // A relay is published this long after the last one even without changes
+    std::chrono::milliseconds heartbeat = std::chrono::milliseconds(1500);
+};
+
+/*
+ * Tells the relay thread when to publish. Threads that change the global
+ * list notify the trigger, and the relay thread waits on it. A relay is
+ * due when the changes have settled for the coalescing window, or the
+ * first of them has waited for the maximum latency, but never sooner than
+ * the minimum interval after the last relay. Urgent changes, e.g. objects
+ * turning red, skip the coalescing window.
+ */
+class RelayTrigger {
+public:
+    explicit RelayTrigger(const RelayTiming &timing = RelayTiming());
+
+    void set_timing(const RelayTiming &timing);
+
+    // Called after the global list changed
+    void notify(bool urgent = false);
+
+    // Blocks until a relay is due and returns true, or returns false
+    // as soon as the trigger is stopped
+    bool wait();
+
+    // Makes wait() return false, now and from now on, until restarted
+    void stop();
+    void restart();
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    RelayTiming timing;
+    bool stopped = false;
+    bool pending = false;       // Something changed since the last relay
+    bool urgent = false;        // Something urgent changed since the last relay
+    clock::time_point first_change;
+    clock::time_point last_change;
+    clock::time_point last_relay;
+};
@@ -0,0 +1,342 @@
+#include "zones.h"
+#include "client.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+uint32_t level_color(uint8_t level) {
+    static const uint32_t colors[] = {GREEN, YELLOW, RED};
+    return colors[level];
+}
+
+uint8_t color_level(uint32_t color) {
+    return color == RED ? RED_LEVEL : color == YELLOW ? YELLOW_LEVEL : GREEN_LEVEL;
+}
+
+ZoneRules ZoneRules::defaults() {
+    ZoneRules rules;
+    rules.points.push_back(ZonePoint{DESIGNATED_X, DESIGNATED_Y});
+    rules.types[1].rings = {ZoneRing{YELLOW_LEVEL, 75 * 75}, ZoneRing{RED_LEVEL, 50 * 50}};
+    rules.types[2].rings = {ZoneRing{YELLOW_LEVEL, 50 * 50}};
+    rules.types[3].base  = YELLOW_LEVEL;
+    rules.types[3].rings = {ZoneRing{RED_LEVEL, 100 * 100}};
+    return rules;
+}
+
+bool same_type_rules(const TypeRules &a, const TypeRules &b) {
+    if (a.base != b.base || a.rings.size() != b.rings.size())  return false;
+    for (std::size_t i = 0; i < a.rings.size(); i++) {
+        if (a.rings[i].level != b.rings[i].level || a.rings[i].radius_squared != b.rings[i].radius_squared) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ZoneRules::is_default() const {
+    // The map bounds don't matter, objects are colored exactly either way
+    const ZoneRules original = defaults();
+    if (points.size() != 1 || points[0].x != DESIGNATED_X || points[0].y != DESIGNATED_Y)  return false;
+    if (types.size() != original.types.size() || !same_type_rules(other, original.other))  return false;
+    for (const auto& [type, type_rules] : original.types) {
+        const auto found = types.find(type);
+        if (found == types.end() || !same_type_rules(found->second, type_rules))  return false;
+    }
+    return true;
+}
+
+const TypeRules &ZoneRules::rules_for(uint32_t type) const {
+    const auto found = types.find(type);
+    return found == types.end() ? other : found->second;
+}
+
+// Each square fits in an unsigned 64-bit int even at the ends of the int32
+// range, but not in a signed one, so the magnitudes are squared unsigned.
+// Their sum might not fit either, so it saturates instead of wrapping.
+uint64_t distance_squared(int32_t x1, int32_t y1, int32_t x2, int32_t y2) {
+    const int64_t dx = static_cast<int64_t>(x1) - x2;
+    const int64_t dy = static_cast<int64_t>(y1) - y2;
+    const uint64_t ux = dx < 0 ? -static_cast<uint64_t>(dx) : dx;
+    const uint64_t uy = dy < 0 ? -static_cast<uint64_t>(dy) : dy;
+    const uint64_t sum = ux*ux + uy*uy;
+    return sum < ux*ux ? UINT64_MAX : sum;
+}
+
+uint8_t ZoneRules::evaluate(int32_t x, int32_t y, uint32_t type) const {
+    const TypeRules &type_rules = rules_for(type);
+    if (type_rules.rings.empty())  return type_rules.base;
+
+    uint64_t nearest = UINT64_MAX;
+    for (const auto& point : points) {
+        nearest = std::min(nearest, distance_squared(x, y, point.x, point.y));
+    }
+
+    uint8_t level = type_rules.base;
+    for (const auto& ring : type_rules.rings) {
+        if (nearest < static_cast<uint64_t>(ring.radius_squared))  level = std::max(level, ring.level);
+    }
+    return level;
+}
+
+/*
+ * The object is within a ring once its squared distance to a designated
+ * coordinate is less than the radius squared. Along the line p + v*t that
+ * is a quadratic in t, and the object enters the ring at its first root.
+ */
+uint8_t ZoneRules::predict(int32_t x, int32_t y, uint32_t type, uint8_t level,
+                           double vx, double vy, double horizon, double &seconds) const {
+    uint8_t predicted = level;
+    seconds = 0;
+    const double a = vx * vx + vy * vy;
+    if (a == 0)  return level;
+
+    for (const auto& ring : rules_for(type).rings) {
+        if (ring.level <= predicted)  continue;
+
+        double earliest = INFINITY;
+        for (const auto& point : points) {
+            const double dx = static_cast<double>(x) - point.x;
+            const double dy = static_cast<double>(y) - point.y;
+            const double b = 2 * (dx * vx + dy * vy);
+            const double c = dx * dx + dy * dy - static_cast<double>(ring.radius_squared);
+            if (c < 0) {
+                earliest = 0;
+                break;
+            }
+            const double discriminant = b * b - 4 * a * c;
+            if (b >= 0 || discriminant < 0)  continue; // Heading away, or passing by
+            earliest = std::min(earliest, (-b - std::sqrt(discriminant)) / (2 * a));
+        }
+        if (earliest <= horizon) {
+            predicted = ring.level;
+            seconds = earliest;
+        }
+    }
+    return predicted;
+}
+
+// Remove spaces and tabs from both ends of the text
+std::string_view trim(std::string_view text) {
+    const auto first = text.find_first_not_of(" \t\r");
+    if (first == std::string_view::npos)  return std::string_view();
+    const auto last = text.find_last_not_of(" \t\r");
+    return text.substr(first, last - first + 1);
+}
+
+bool read_properties(std::istream &stream, Properties &properties, std::string &error) {
+    std::string line;
+    for (int number = 1; std::getline(stream, line); number++) {
+        const std::string_view text = trim(line);
+        if (text.empty() || text[0] == '#' || text[0] == '!')  continue;
+
+        const auto equals = text.find('=');
+        if (equals == std::string_view::npos) {
+            error = "line " + std::to_string(number) + " has no =";
+            return false;
+        }
+        properties[std::string(trim(text.substr(0, equals)))] = std::string(trim(text.substr(equals + 1)));
+    }
+    return true;
+}
+
+// Parse the whole text as an integer. Returns false if it isn't one.
+template <typename Integer>
+bool parse_whole(std::string_view text, Integer &value) {
+    const char *last = text.data() + text.length();
+    const auto result = std::from_chars(text.data(), last, value);
+    return result.ec == std::errc() && result.ptr == last;
+}
+
+bool parse_level(std::string_view name, uint8_t &level) {
+    if      (name == "GREEN")   level = GREEN_LEVEL;
+    else if (name == "YELLOW")  level = YELLOW_LEVEL;
+    else if (name == "RED")     level = RED_LEVEL;
+    else                        return false;
+    return true;
+}
+
+// Split the text at spaces, skipping empty words
+std::vector<std::string_view> split_words(std::string_view text) {
+    std::vector<std::string_view> words;
+    std::size_t start = 0;
+    while (start < text.length()) {
+        std::size_t end = text.find(' ', start);
+        if (end == std::string_view::npos)  end = text.length();
+        if (end > start)  words.push_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+    return words;
+}
+
+bool parse_points(std::string_view text, std::vector<ZonePoint> &points) {
+    points.clear();
+    for (const auto word : split_words(text)) {
+        const auto comma = word.find(',');
+        ZonePoint point;
+        if (comma == std::string_view::npos
+                || !parse_whole(word.substr(0, comma), point.x)
+                || !parse_whole(word.substr(comma + 1), point.y)) {
+            return false;
+        }
+        points.push_back(point);
+    }
+    return !points.empty();
+}
+
+bool parse_type_rules(std::string_view text, TypeRules &type_rules) {
+    const auto words = split_words(text);
+    if (words.empty() || !parse_level(words[0], type_rules.base))  return false;
+
+    type_rules.rings.clear();
+    for (std::size_t i = 1; i < words.size(); i++) {
+        const auto less = words[i].find('<');
+        ZoneRing ring;
+        int32_t radius;
+        if (less == std::string_view::npos
+                || !parse_level(words[i].substr(0, less), ring.level)
+                || !parse_whole(words[i].substr(less + 1), radius)
+                || radius <= 0) {
+            return false;
+        }
+        ring.radius_squared = static_cast<int64_t>(radius) * radius;
+        type_rules.rings.push_back(ring);
+    }
+    return true;
+}
+
+bool zone_rules_from(const Properties &properties, ZoneRules &rules, std::string &error) {
+    const std::string TYPE_PREFIX = "ZONE_TYPE_";
+
+    const auto points = properties.find("ZONES");
+    if (points != properties.end() && !parse_points(points->second, rules.points)) {
+        error = "ZONES should be coordinates like 150,150 separated by spaces";
+        return false;
+    }
+
+    bool types_given = false;
+    for (const auto& [key, value] : properties) {
+        if (key.rfind(TYPE_PREFIX, 0) != 0)  continue;
+        if (!types_given) {
+            rules.types.clear();
+            rules.other = TypeRules();
+            types_given = true;
+        }
+
+        const std::string_view name = std::string_view(key).substr(TYPE_PREFIX.length());
+        uint32_t type = 0;
+        // Objects only have the types 1 to 3, which also keeps ColorRaster small
+        if (name != "OTHER" && (!parse_whole(name, type) || type < 1 || type > 3)) {
+            error = key + " should end with a type from 1 to 3 or OTHER";
+            return false;
+        }
+        TypeRules &type_rules = name == "OTHER" ? rules.other : rules.types[type];
+        if (!parse_type_rules(value, type_rules)) {
+            error = key + " should be a color followed by colors like RED<50";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool read_gif_size(std::istream &stream, uint32_t &width, uint32_t &height) {
+    // The signature is followed by the little-endian 16-bit width and height
+    unsigned char header[10];
+    if (!stream.read(reinterpret_cast<char *>(header), sizeof(header)))  return false;
+    if (std::string_view(reinterpret_cast<char *>(header), 3) != "GIF")  return false;
+    const uint32_t image_width  = header[6] | header[7] << 8;
+    const uint32_t image_height = header[8] | header[9] << 8;
+    if (image_width == 0 || image_height == 0)  return false;
+    if (static_cast<uint64_t>(image_width) * image_height > MAX_MAP_CELLS)  return false;
+    width  = image_width;
+    height = image_height;
+    return true;
+}
+
+bool load_zone_rules(const std::string &path, ZoneRules &rules, std::string &error) {
+    std::ifstream file(path);
+    Properties properties;
+    if (!file) {
+        error = "could not open " + path;
+        return false;
+    }
+    if (!read_properties(file, properties, error) || !zone_rules_from(properties, rules, error)) {
+        error = path + ": " + error;
+        return false;
+    }
+
+    const auto map = properties.find("MAP");
+    if (map != properties.end()) {
+        const auto map_path = std::filesystem::path(path).parent_path() / map->second;
+        std::ifstream image(map_path, std::ios::binary);
+        if (!image || !read_gif_size(image, rules.map_width, rules.map_height)) {
+            std::clog << "Could not read the size of the map " << map_path.string() << ", so it's taken to be ";
+            std::clog << rules.map_width << "x" << rules.map_height << std::endl;
+        }
+    }
+    return true;
+}
+
+ColorRaster::ColorRaster(const ZoneRules &rules) : rules(rules) {
+    // Types without rules of their own share the last raster
+    for (const auto& [type, type_rules] : rules.types) {
+        if (type >= type_rasters.size())  type_rasters.resize(type + 1, rules.types.size());
+    }
+    other_raster = rules.types.size();
+    levels.resize(static_cast<std::size_t>(other_raster + 1) * rules.map_width * rules.map_height);
+
+    uint32_t raster = 0;
+    for (const auto& [type, type_rules] : rules.types) {
+        type_rasters[type] = raster;
+        fill(raster++, type_rules);
+    }
+    fill(other_raster, rules.other);
+}
+
+/*
+ * Fill the raster with the base color and then raise the level within each
+ * ring around each designated coordinate. Only the bounding square of each
+ * ring is visited, so compiling takes time proportional to the area of the
+ * zones rather than the map times the number of zones.
+ */
+void ColorRaster::fill(uint32_t raster, const TypeRules &type_rules) {
+    const int64_t width = rules.map_width, height = rules.map_height;
+    uint8_t *cells = levels.data() + raster * width * height;
+    std::fill(cells, cells + width * height, type_rules.base);
+
+    for (const auto& ring : type_rules.rings) {
+        if (ring.level <= type_rules.base)  continue;
+
+        // The largest whole distance within the ring
+        int64_t reach = static_cast<int64_t>(std::sqrt(static_cast<double>(ring.radius_squared)));
+        while (reach * reach >= ring.radius_squared)  reach--;
+        while ((reach + 1) * (reach + 1) < ring.radius_squared)  reach++;
+
+        for (const auto& point : rules.points) {
+            const int64_t top    = std::max<int64_t>(point.y - reach, 0);
+            const int64_t bottom = std::min<int64_t>(point.y + reach, height - 1);
+            const int64_t left   = std::max<int64_t>(point.x - reach, 0);
+            const int64_t right  = std::min<int64_t>(point.x + reach, width - 1);
+            for (int64_t y = top; y <= bottom; y++) {
+                for (int64_t x = left; x <= right; x++) {
+                    uint8_t &cell = cells[y * width + x];
+                    if (distance_squared(x, y, point.x, point.y) < static_cast<uint64_t>(ring.radius_squared)) {
+                        cell = std::max(cell, ring.level);
+                    }
+                }
+            }
+        }
+    }
+}
+
+uint32_t ColorRaster::color(int32_t x, int32_t y, uint32_t type) const {
+    // Negative coordinates turn into large unsigned ones, which are off the map too
+    if (static_cast<uint32_t>(x) >= rules.map_width || static_cast<uint32_t>(y) >= rules.map_height) {
+        return level_color(rules.evaluate(x, y, type));
+    }
+    const uint32_t raster = type < type_rasters.size() ? type_rasters[type] : other_raster;
+    const std::size_t cell = (static_cast<std::size_t>(raster) * rules.map_height + y) * rules.map_width + x;
+    return level_color(levels[cell]);
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include "object.h"
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The size of the map the server uses if it can't be read from the map file
+const uint32_t MAP_WIDTH  = 300;
+const uint32_t MAP_HEIGHT = 300;
+
+// The most cells a map may have. A ColorRaster holds a level for every
+// cell of the map for each type, and the map file isn't trusted to keep
+// that small.
+const uint64_t MAX_MAP_CELLS = 4096 * 4096;
+
+// Colors ordered by severity, so that the more severe of two colors is
+// the one with the higher level
+enum ColorLevel : uint8_t { GREEN_LEVEL, YELLOW_LEVEL, RED_LEVEL };
+
+uint32_t level_color(uint8_t level);
+uint8_t color_level(uint32_t color);
+
+// Parse GREEN, YELLOW or RED as its level. Returns false if it's neither.
+bool parse_level(std::string_view name, uint8_t &level);
+
+// The squared distance between two coordinates, saturated at UINT64_MAX
+uint64_t distance_squared(int32_t x1, int32_t y1, int32_t x2, int32_t y2);
+
+struct ZonePoint {
+    int32_t x, y;
+};
+
+// Objects closer than the radius to any designated coordinate get the color
+struct ZoneRing {
+    uint8_t level;
+    int64_t radius_squared;
+};
+
+// The color an object of some type gets away from every designated
+// coordinate, and the colors it gets close to them
+struct TypeRules {
+    uint8_t base = GREEN_LEVEL;
+    std::vector<ZoneRing> rings;
+};
+
+/*
+ * The rules for coloring objects. An object gets the most severe color
+ * of the base color of its type and every ring of its type that it's
+ * within. The default rules are the original ones, with one designated
+ * coordinate at DESIGNATED_X, DESIGNATED_Y.
+ */
+struct ZoneRules {
+    std::vector<ZonePoint> points;
+    std::map<uint32_t, TypeRules> types; // Rules for specific types
+    TypeRules other;                     // Rules for all other types
+    uint32_t map_width  = MAP_WIDTH;
+    uint32_t map_height = MAP_HEIGHT;
+
+    static ZoneRules defaults();
+
+    // True if objects are colored the same way as with the default rules
+    bool is_default() const;
+
+    const TypeRules &rules_for(uint32_t type) const;
+
+    // Evaluate the rules for the object exactly, without any raster
+    uint8_t evaluate(int32_t x, int32_t y, uint32_t type) const;
+
+    // The most severe level above the object's level that it gets within
+    // the horizon if it keeps moving in a straight line at the velocity,
+    // with seconds set to when it gets it. Returns the object's level if
+    // it gets none.
+    uint8_t predict(int32_t x, int32_t y, uint32_t type, uint8_t level,
+                    double vx, double vy, double horizon, double &seconds) const;
+};
+
+using Properties = std::map<std::string, std::string>;
+
+/*
+ * Read Java-style key=value lines, skipping blank lines and comments
+ * starting with # or !. Returns false and a message for a malformed line.
+ */
+bool read_properties(std::istream &stream, Properties &properties, std::string &error);
+
+/*
+ * Apply the zone keys of the properties to the rules:
+ *
+ *     ZONES=150,150 40,260           Designated coordinates, x,y separated by spaces
+ *     ZONE_TYPE_1=GREEN YELLOW<75 RED<50  Rules for one of the types 1 to 3
+ *     ZONE_TYPE_OTHER=GREEN          Rules for types without their own key
+ *
+ * A type's rules are its base color followed by colors for being closer
+ * than a radius to any designated coordinate. If any ZONE_TYPE_ key is
+ * given, the default type rules are replaced altogether and types without
+ * a key are green unless ZONE_TYPE_OTHER says otherwise. Other keys are
+ * ignored, so the rules can live in server.properties.
+ */
+bool zone_rules_from(const Properties &properties, ZoneRules &rules, std::string &error);
+
+// Read the width and height from the header of a GIF image. Returns false
+// if it isn't one, or if it has more than MAX_MAP_CELLS pixels.
+bool read_gif_size(std::istream &stream, uint32_t &width, uint32_t &height);
+
+/*
+ * Load the rules from a properties file. The map bounds are read from
+ * the image named by its MAP key, relative to the file, if there is one.
+ * If the image can't be read, a warning is printed to std::clog and the
+ * bounds are left as they are, since they only decide which coordinates
+ * the ColorRaster covers.
+ */
+bool load_zone_rules(const std::string &path, ZoneRules &rules, std::string &error);
+
+/*
+ * Zone rules compiled into one color level per map coordinate for each
+ * type with rules of its own and one for all other types, so that coloring
+ * an object on the map is one table lookup however many designated
+ * coordinates and rings there are. Objects off the map are evaluated
+ * exactly instead.
+ */
+class ColorRaster {
+public:
+    explicit ColorRaster(const ZoneRules &rules);
+
+    uint32_t color(int32_t x, int32_t y, uint32_t type) const;
+
+private:
+    ZoneRules rules;
+    std::vector<uint8_t> levels;        // One width * height raster after the other
+    std::vector<uint32_t> type_rasters; // The raster of each type, indexed by type
+    uint32_t other_raster;              // The raster of types past the end of type_rasters
+
+    void fill(uint32_t raster, const TypeRules &type_rules);
+};